@@ -0,0 +1,337 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Benchmark of the Backgrounder/Active: throughput and send-to-execute
+* latency percentiles for
+*  - 1, 2 and 4 producer threads
+*  - int, std::string and a 256 byte struct as payload
+*  - the fake processing time of a job, see Backgrounder::setProcessTime
+*  - one job per value, with pooled or shared_ptr payloads, and batching mode
+*  - the queue backend, that is a compile time choice: the benchmark is
+*    built once per backend, see CMakeLists.txt
+* and the scaling of the ActivePool from 1 to hardware_concurrency()
+* workers, with CPU bound unsigned and std::string jobs ("pool_scaling").
+*
+* Time is wall time, from the first send until the Backgrounder, or the
+* pool, is destroyed, i.e. until every value is stored. The latencies are taken
+* from the Active's metrics. Heap allocations are counted by a replaced
+* global operator new, all threads, and reported per value.
+*
+* The results are written as JSON, to stdout or to the file given as the
+* first argument, so that runs on different releases can be compared:
+*    ActiveObjCpp0x-benchmark results.json */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <algorithm>
+
+#include "backgrounder.h"
+#include "active_pool.h"
+
+namespace {
+std::atomic<unsigned long> g_allocations(0);
+} // anonymous
+
+void* operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size ? size : 1);
+  if (nullptr == ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+// bounded, as in a real system, so that the producers cannot run away from the Active
+const size_t c_capacity = 4096;
+
+struct Large {
+  char bytes[256];
+};
+
+const char* backendName() {
+#if defined(ACTIVE_LOCKFREE_QUEUE)
+  return "mpsc_ring_queue";
+#else
+  return "shared_queue";
+#endif
+}
+
+// payloads are made before the clock starts
+template<typename T> T makePayload(unsigned value_);
+
+template<> int makePayload<int>(unsigned value_) {
+  return static_cast<int>(value_);
+}
+
+template<> std::string makePayload<std::string>(unsigned value_) {
+  std::ostringstream oss;
+  oss << "payload that is too long for the small string optimization #" << value_;
+  return oss.str();
+}
+
+template<> Large makePayload<Large>(unsigned value_) {
+  Large large;
+  std::memset(large.bytes, static_cast<int>(value_ & 0xff), sizeof(large.bytes));
+  return large;
+}
+
+template<typename T> const char* payloadName();
+template<> const char* payloadName<int>() { return "int"; }
+template<> const char* payloadName<unsigned>() { return "unsigned"; }
+template<> const char* payloadName<std::string>() { return "std::string"; }
+template<> const char* payloadName<Large>() { return "struct[256]"; }
+
+struct Config {
+  unsigned producers;
+  unsigned job_cost_us;
+  size_t batch;
+  bool pooled;
+  unsigned items;
+};
+
+struct Result {
+  Config config;
+  const char* payload;
+  double seconds;
+  unsigned long allocations;
+  kjellkod::ActiveMetrics metrics;
+};
+
+template<typename T>
+void produce(Backgrounder<T>* worker_, const std::vector<T>* values_) {
+  for (size_t idx = 0; idx < values_->size(); ++idx) {
+    worker_->saveData((*values_)[idx]);
+  }
+}
+
+template<typename T>
+Result runOne(const Config& config_) {
+  std::vector<std::vector<T> > values(config_.producers);
+  for (unsigned producer = 0; producer < config_.producers; ++producer) {
+    for (unsigned idx = 0; idx < config_.items / config_.producers; ++idx) {
+      values[producer].push_back(makePayload<T>(idx));
+    }
+  }
+
+  Result result;
+  result.config = config_;
+  result.payload = payloadName<T>();
+  std::vector<T> stored;
+  stored.reserve(config_.items);
+  const unsigned long allocations = g_allocations.load();
+  const Clock::time_point start = Clock::now();
+  {
+    Backgrounder<T> worker(stored, c_capacity, config_.batch, std::chrono::microseconds(500));
+    worker.setProcessTime(std::chrono::microseconds(config_.job_cost_us));
+    worker.setPooled(config_.pooled);
+    std::vector<std::thread> producers;
+    for (unsigned producer = 0; producer < config_.producers; ++producer) {
+      producers.push_back(std::thread(&produce<T>, &worker, &values[producer]));
+    }
+    for (size_t idx = 0; idx < producers.size(); ++idx) {
+      producers[idx].join();
+    }
+    // the last values may still be in the lanes, the metrics are taken
+    // when the Active has caught up, still before it is destroyed
+    while (worker.metrics().depth != 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    result.metrics = worker.metrics();
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  result.allocations = g_allocations.load() - allocations;
+  return result;
+}
+
+// CPU bound versions of the main.cpp jobs, for the ActivePool scaling
+unsigned intWork(unsigned value_) {
+  unsigned hash = value_;
+  for (int round = 0; round < 2000; ++round) {
+    hash = hash * 2654435761u + round;
+  }
+  return hash;
+}
+
+unsigned stringWork(const std::string& value_) {
+  unsigned hash = 0;
+  for (int round = 0; round < 200; ++round) {
+    for (size_t idx = 0; idx < value_.size(); ++idx) {
+      hash = hash * 31 + value_[idx];
+    }
+  }
+  return hash;
+}
+
+void storeInt(const std::vector<unsigned>* in_, std::vector<unsigned>* out_, size_t index_) {
+  (*out_)[index_] = intWork((*in_)[index_]);
+}
+
+void storeString(const std::vector<std::string>* in_, std::vector<unsigned>* out_, size_t index_) {
+  (*out_)[index_] = stringWork((*in_)[index_]);
+}
+
+struct PoolResult {
+  unsigned workers;
+  const char* payload;
+  unsigned items;
+  double seconds;
+};
+
+// wall time from the first send until the pool is destroyed, i.e. drained
+template<typename T>
+PoolResult runPool(unsigned workers_, const std::vector<T>& in_,
+                   void (*store_)(const std::vector<T>*, std::vector<unsigned>*, size_t)) {
+  std::vector<unsigned> out(in_.size());
+  const Clock::time_point start = Clock::now();
+  {
+    std::unique_ptr<kjellkod::ActivePool> pool = kjellkod::ActivePool::createActivePool(workers_);
+    for (size_t idx = 0; idx < in_.size(); ++idx) {
+      pool->send(std::bind(store_, &in_, &out, idx));
+    }
+  }
+  PoolResult result = { workers_, payloadName<T>(), static_cast<unsigned>(in_.size()),
+                        std::chrono::duration<double>(Clock::now() - start).count() };
+  return result;
+}
+
+std::vector<PoolResult> runPoolScaling() {
+  const unsigned c_nbrItems = 20000;
+  std::vector<unsigned> ints;
+  std::vector<std::string> strings;
+  for (unsigned idx = 0; idx < c_nbrItems; ++idx) {
+    ints.push_back(idx * 2654435761u);
+    std::ostringstream oss;
+    oss << ints.back();
+    strings.push_back(oss.str());
+  }
+
+  const unsigned max_workers = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned> worker_counts;
+  for (unsigned workers = 1; workers < max_workers; workers *= 2) {
+    worker_counts.push_back(workers);
+  }
+  worker_counts.push_back(max_workers);
+
+  std::vector<PoolResult> results;
+  for (size_t idx = 0; idx < worker_counts.size(); ++idx) {
+    results.push_back(runPool(worker_counts[idx], ints, &storeInt));
+    results.push_back(runPool(worker_counts[idx], strings, &storeString));
+    std::cerr << "." << std::flush;
+  }
+  return results;
+}
+
+void printPoolResult(std::ostream& out_, const PoolResult& result_) {
+  out_ << "    {\"workers\": " << result_.workers
+       << ", \"payload\": \"" << result_.payload << "\""
+       << ", \"items\": " << result_.items
+       << ", \"seconds\": " << result_.seconds
+       << ", \"items_per_second\": " << static_cast<uint64_t>(result_.items / result_.seconds) << "}";
+}
+
+void printHistogram(std::ostream& out_, const char* name_, const kjellkod::histogram_snapshot& histogram_) {
+  out_ << "\"" << name_ << "\": {\"p50\": " << histogram_.percentile(50)
+       << ", \"p90\": " << histogram_.percentile(90)
+       << ", \"p99\": " << histogram_.percentile(99)
+       << ", \"p999\": " << histogram_.percentile(99.9)
+       << ", \"max\": " << histogram_.max
+       << ", \"mean\": " << static_cast<uint64_t>(histogram_.mean()) << "}";
+}
+
+void printResult(std::ostream& out_, const Result& result_) {
+  const unsigned items = result_.config.items / result_.config.producers * result_.config.producers;
+  out_ << "    {\"producers\": " << result_.config.producers
+       << ", \"payload\": \"" << result_.payload << "\""
+       << ", \"job_cost_us\": " << result_.config.job_cost_us
+       << ", \"batch\": " << result_.config.batch
+       << ", \"storage\": \"" << (result_.config.batch > 1 ? "batch" : (result_.config.pooled ? "pooled" : "shared_ptr")) << "\""
+       << ", \"items\": " << items
+       << ", \"seconds\": " << result_.seconds
+       << ", \"items_per_second\": " << static_cast<uint64_t>(items / result_.seconds)
+       << ", \"allocations_per_item\": " << static_cast<double>(result_.allocations) / items
+       << ", \"jobs\": " << result_.metrics.executed
+       << ", \"high_water\": " << result_.metrics.high_water
+       << ", \"busy_ratio\": " << result_.metrics.busy_ratio()
+       << ",\n      ";
+  printHistogram(out_, "wait_ns", result_.metrics.wait_ns);
+  out_ << ",\n      ";
+  printHistogram(out_, "service_ns", result_.metrics.service_ns);
+  out_ << "}";
+}
+} // anonymous
+
+
+int main(int argc, char** argv) {
+  const unsigned c_producers[] = { 1, 2, 4 };
+  const unsigned c_jobCostsUs[] = { 0, 1 };
+  // one job per value with pooled payloads, with shared_ptr payloads, and batches
+  const size_t c_batches[] = { 1, 1, 1024 };
+  const bool c_pooled[] = { true, false, true };
+  // a job that sleeps is ~1000 times slower, fewer items keeps the run short
+  const unsigned c_itemsNoCost = 200000;
+  const unsigned c_itemsWithCost = 4000;
+
+  std::vector<Result> results;
+  for (unsigned cost : c_jobCostsUs) {
+    for (size_t mode = 0; mode < sizeof(c_batches) / sizeof(c_batches[0]); ++mode) {
+      for (unsigned producers : c_producers) {
+        const Config config = { producers, cost, c_batches[mode], c_pooled[mode],
+                                (0 == cost) ? c_itemsNoCost : c_itemsWithCost };
+        results.push_back(runOne<int>(config));
+        results.push_back(runOne<std::string>(config));
+        results.push_back(runOne<Large>(config));
+        std::cerr << "." << std::flush;
+      }
+    }
+  }
+  const std::vector<PoolResult> pool_results = runPoolScaling();
+  std::cerr << std::endl;
+
+  std::ofstream file;
+  if (argc > 1) {
+    file.open(argv[1]);
+    if (!file) {
+      std::cerr << "cannot write to " << argv[1] << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& out = (argc > 1) ? file : std::cout;
+  out << "{\n  \"benchmark\": \"ActiveObjCpp0x\",\n"
+      << "  \"backend\": \"" << backendName() << "\",\n"
+      << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+      << "  \"results\": [\n";
+  for (size_t idx = 0; idx < results.size(); ++idx) {
+    printResult(out, results[idx]);
+    out << (idx + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ],\n  \"pool_scaling\": [\n";
+  for (size_t idx = 0; idx < pool_results.size(); ++idx) {
+    printPoolResult(out, pool_results[idx]);
+    out << (idx + 1 < pool_results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+  return 0;
+}
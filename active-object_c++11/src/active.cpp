@@ -23,36 +23,398 @@
 
 using namespace kjellkod;
 
-Active::Active(): done_(false){}
+const unsigned Active::c_normal_per_bulk;
+const unsigned Active::c_jobs_per_timer_check;
+
+
+Active::Active(const ActiveOptions& options_)
+  : urgent_(options_.capacity, options_.policy)
+  , normal_(options_.capacity, options_.policy)
+  , bulk_(options_.capacity, options_.policy)
+  , urgent_ready_(false)
+  , bulk_ready_(false)
+  , doorbell_(options_.strategy)
+  , done_(false)
+  , stop_(false)
+  , closed_(false)
+  , exited_(false)
+  , completed_(0)
+  , idle_seq_(0)
+  , idle_waiters_(0)
+  , exit_spot_(wait_strategy::block)
+  , joined_(false)
+  , next_timer_id_(1){
+#if defined(ACTIVE_TRACING)
+  if (options_.trace_capacity) {
+    trace_.reset(new trace_ring(options_.trace_capacity, options_.name.empty() ? "Active" : options_.name));
+    register_trace(trace_);
+  }
+#endif
+}
 
 Active::~Active() {
-  Callback quit_token = std::bind(&Active::doDone, this);
-  send(quit_token); // tell thread to exit
+  shutdown();
+#if defined(ACTIVE_TRACING)
+  if (trace_) {
+    unregister_trace(trace_);
+  }
+#endif
+}
+
+// tell thread to exit when all the lanes are drained
+void Active::shutdown() {
+  if (joined_) {
+    return;
+  }
+  done_.store(true, std::memory_order_release);
+  doorbell_.notify();
   thd_.join();
+  joined_ = true;
+  closed_.store(true, std::memory_order_relaxed);
+}
+
+// The stop request goes through the urgent lane's flag, so that it costs
+// run() nothing while it is not stopped
+std::vector<Job> Active::shutdown_now() {
+  if (joined_) {
+    return std::vector<Job>();
+  }
+  stop_.store(true, std::memory_order_relaxed);
+  done_.store(true, std::memory_order_release);
+  signal(lane::urgent);
+  thd_.join();
+  joined_ = true;
+  closed_.store(true, std::memory_order_relaxed);
+  return collectUnprocessed();
+}
+
+std::vector<Job> Active::shutdown_until(std::chrono::steady_clock::time_point deadline_) {
+  if (joined_) {
+    return std::vector<Job>();
+  }
+  done_.store(true, std::memory_order_release);
+  doorbell_.notify();
+  if (exit_spot_.wait_until(deadline_, [this]() { return exited_.load(std::memory_order_acquire); })) {
+    shutdown(); // drained in time
+    return std::vector<Job>();
+  }
+  return shutdown_now();
 }
 
-// Add asynchronously a work-message to queue
-void Active::send(Callback msg_){
-  mq_.push(msg_);
+void Active::keepUnprocessed(std::queue<Message>& urgent_, std::queue<Message>& normal_, std::queue<Message>& bulk_) {
+  std::swap(unprocessed_[0], urgent_);
+  std::swap(unprocessed_[1], normal_);
+  std::swap(unprocessed_[2], bulk_);
 }
 
+void Active::closeLanes() {
+  urgent_.close();
+  normal_.close();
+  bulk_.close();
+}
+
+// After the join: the jobs that run() had in hand come before the ones still
+// in the lane. The lanes are closed first, a producer that is blocked on a
+// full lane fails instead of pushing after the lane was emptied. Neither
+// kind is left behind in the metrics' enqueued and depth
+std::vector<Job> Active::collectUnprocessed() {
+  closeLanes();
+  MessageQueue* lanes[] = { &urgent_, &normal_, &bulk_ };
+  std::vector<Job> jobs;
+  for (size_t idx = 0; idx < 3; ++idx) {
+    std::queue<Message>& left = unprocessed_[idx];
+    metrics_.handed_back(left.size()); // taken, but never run
+    lanes[idx]->try_and_pop_all(left);
+    for (; !left.empty(); left.pop()) {
+      jobs.push_back(std::move(left.front().job));
+    }
+  }
+  return jobs;
+}
+
+// A marker that has run in a lane comes after every job that was in that
+// lane, or in run()'s hands, when it was sent. A marker that was dropped
+// (drop_oldest) is sent again, a marker that was rejected or handed back
+// means that the Active is shut down, and then there is nothing to wait for
+void Active::flush() {
+  const lane lanes[] = { lane::urgent, lane::normal, lane::bulk };
+  active_future<void> passed[3];
+  for (size_t idx = 0; idx < 3; ++idx) {
+    MarkerSender sender = { *this, lanes[idx] };
+    passed[idx] = call_on(sender, []() {});
+  }
+  for (size_t idx = 0; idx < 3; ++idx) {
+    for (;;) {
+      try {
+        passed[idx].get();
+        break;
+      } catch (const std::future_error&) {
+        if (closed_.load(std::memory_order_relaxed) || stop_.load(std::memory_order_relaxed)
+            || queueFor(lanes[idx]).closed()) {
+          return;
+        }
+        MarkerSender sender = { *this, lanes[idx] };
+        passed[idx] = call_on(sender, []() {});
+      }
+    }
+  }
+}
+
+// Idle if run() was waiting, with empty batches, all through the check of
+// the lanes. run() bumps idle_seq_ BEFORE it takes from a lane when it wakes
+// up, so a job that was taken in between changes the sequence
+bool Active::isIdle() const {
+  if (exited_.load(std::memory_order_acquire)) {
+    return true;
+  }
+  const uint64_t before = idle_seq_.load(std::memory_order_seq_cst);
+  if (0 == before % 2) {
+    return false;
+  }
+  const bool empty = urgent_.empty() && normal_.empty() && bulk_.empty();
+  return empty && before == idle_seq_.load(std::memory_order_seq_cst);
+}
+
+bool Active::waitIdleUntil(std::chrono::steady_clock::time_point deadline_) {
+  idle_waiters_.fetch_add(1, std::memory_order_seq_cst);
+  bool idle = false;
+  {
+    std::unique_lock<std::mutex> lock(idle_m_);
+    idle = idle_cond_.wait_until(lock, deadline_, [this]() { return isIdle(); });
+  }
+  idle_waiters_.fetch_sub(1, std::memory_order_relaxed);
+  return idle;
+}
 
-// Will wait for msgs if queue is empty
+// Add asynchronously a work-message to a lane
+bool Active::send(Job msg_, lane lane_){
+  const metrics_clock::time_point sent = metrics_clock::now();
+#if defined(ACTIVE_TRACING)
+  if (trace_) {
+    stamp(msg_, nullptr, sent);
+  }
+#endif
+  return enqueue(lane_, [&](MessageQueue& queue) { return queue.emplace(std::move(msg_), sent); });
+}
+
+bool Active::send(Job msg_, const char* label_, lane lane_){
+#if defined(ACTIVE_TRACING)
+  const metrics_clock::time_point sent = metrics_clock::now();
+  if (trace_) {
+    stamp(msg_, label_, sent);
+  }
+  return enqueue(lane_, [&](MessageQueue& queue) { return queue.emplace(std::move(msg_), sent); });
+#else
+  (void)label_;
+  return send(std::move(msg_), lane_);
+#endif
+}
+
+bool Active::try_send(Job msg_, lane lane_){
+#if defined(ACTIVE_TRACING)
+  if (trace_) {
+    stamp(msg_, nullptr, metrics_clock::now());
+  }
+#endif
+  return enqueue(lane_, [&](MessageQueue& queue) { return queue.try_push(std::move(msg_)); });
+}
+
+bool Active::force_send(Job msg_, lane lane_){
+#if defined(ACTIVE_TRACING)
+  if (trace_) {
+    stamp(msg_, nullptr, metrics_clock::now());
+  }
+#endif
+  return enqueue(lane_, [&](MessageQueue& queue) { return queue.force_push(std::move(msg_)); });
+}
+
+timer_id Active::addTimer(timer_clock::time_point when_, Job msg_, timer_clock::duration period_){
+  const timer_id id = next_timer_id_.fetch_add(1, std::memory_order_relaxed);
+  AddTimer add = { this, id, when_, period_, std::move(msg_) };
+  return sendInternal(std::move(add), lane::urgent) ? id : 0;
+}
+
+bool Active::cancel_timer(timer_id id_){
+  return sendInternal([this, id_]() { timers_.cancel(id_); }, lane::urgent);
+}
+
+#if defined(ACTIVE_TRACING)
+void Active::Traced::operator()() {
+  const metrics_clock::time_point start = metrics_clock::now();
+  stamp->job();
+  const metrics_clock::time_point end = metrics_clock::now();
+  active->trace_->record(stamp->label, stamp->producer, stamp->sent, active->dequeued_, start, end);
+}
+#endif
+
+void Active::runOne(Batch& jobs_) {
+  Message& msg = jobs_.front();
+#if defined(ACTIVE_TRACING)
+  if (trace_) {
+    dequeued_ = jobs_.dequeued.front();
+    jobs_.dequeued.pop_front();
+  }
+#endif
+  if (msg.isInternal()) {
+    msg.job();
+    metrics_.internal();
+    jobs_.pop();
+    return;
+  }
+  const metrics_clock::time_point start = metrics_clock::now();
+  msg.job();
+  const metrics_clock::time_point end = metrics_clock::now();
+  metrics_.executed(msg.sent, start, end);
+  completed_.store(completed_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  jobs_.pop();
+}
+
+
+// Will wait for msgs if all the lanes are empty
 // A great explanation of how this is done (using Qt's library):
 // http://doc.qt.nokia.com/stable/qwaitcondition.html
+// How it waits, block, spin then park or busy poll, is the doorbell's
+// wait_strategy. Senders only pay for a wakeup when run() is parked
+//
+// Swap-and-drain: all pending jobs in a lane are taken with one lock
+// acquisition and are then executed, in FIFO order, without holding the lock.
+// The only cost of the lanes for a normal job is the load of the two flags.
+//
+// Metrics: the jobs are time stamped when sent and when they start and end.
+// The depth is sampled after each swap-and-drain, the idle time is the time
+// spent waiting on the doorbell
+//
+// Due timers are run when the lanes are empty, and every
+// c_jobs_per_timer_check jobs when busy. The clock is only read while
+// timers are pending. When idle the wait ends at the next timer deadline
+//
+// shutdown sets done_ after the owner's last send, so when done_ is seen and
+// all the lanes are empty every job, also jobs sent by jobs, has been executed.
+// Other threads may still send: the lanes are then closed and what got in
+// before the close is executed. Jobs sent by these last jobs are rejected
+//
+// shutdown_now sets stop_ and raises the urgent flag. It is seen at the next
+// check of the urgent lane, i.e. after the job that is executing, and the
+// jobs in hand are kept for shutdown_now
 void Active::run() {
-  while (!done_) {
-    // wait till job is available, then retrieve it and
-    // executes the retrieved job in this thread (background)
-    Callback func;
-    mq_.wait_and_pop(func);
-    func();
+  runLanes();
+  exited_.store(true, std::memory_order_release);
+  exit_spot_.notify();
+  std::lock_guard<std::mutex> lock(idle_m_);
+  idle_cond_.notify_all();
+}
+
+void Active::runLanes() {
+  Batch urgent, normal, bulk;
+  unsigned normal_in_a_row = 0;
+  unsigned jobs_since_timers = 0;
+  auto take = [&](MessageQueue& lane_, Batch& jobs_) {
+    const size_t before = jobs_.size();
+    if (!lane_.try_and_pop_all(jobs_)) {
+      return false;
+    }
+    metrics_.taken(jobs_.size() - before, urgent.size() + normal.size() + bulk.size());
+#if defined(ACTIVE_TRACING)
+    if (trace_) {
+      jobs_.dequeued.resize(jobs_.size(), metrics_clock::now());
+    }
+#endif
+    return true;
+  };
+#if defined(ACTIVE_TRACING)
+  if (trace_) {
+    trace_->set_thread(trace_thread_id());
+  }
+#endif
+  for (;;) {
+    if (urgent_ready_.load(std::memory_order_relaxed) && urgent_ready_.exchange(false, std::memory_order_acquire)) {
+      if (stop_.load(std::memory_order_relaxed)) {
+        keepUnprocessed(urgent, normal, bulk);
+        return;
+      }
+      take(urgent_, urgent);
+      while (!urgent.empty() && !stop_.load(std::memory_order_relaxed)) {
+        runOne(urgent);
+      }
+    }
+    if (!timers_.empty() && ++jobs_since_timers >= c_jobs_per_timer_check) {
+      jobs_since_timers = 0;
+      timers_.advance(timer_clock::now());
+    }
+    if (bulk_ready_.load(std::memory_order_relaxed) && bulk_ready_.exchange(false, std::memory_order_acquire)) {
+      take(bulk_, bulk);
+    }
+    if (normal.empty()) {
+      take(normal_, normal);
+    }
+
+    if (!normal.empty() && (bulk.empty() || normal_in_a_row < c_normal_per_bulk)) {
+      runOne(normal);
+      ++normal_in_a_row;
+      continue;
+    }
+    normal_in_a_row = 0;
+    if (!bulk.empty()) {
+      runOne(bulk);
+      continue;
+    }
+
+    // all the lanes are empty, run the due timers or wait till jobs are
+    // available or the next timer is due. Nothing is taken while waiting,
+    // see isIdle()
+    bool done = false;
+    auto ready = [&]() {
+      done = done_.load(std::memory_order_acquire);
+      return done || urgent_ready_.load(std::memory_order_acquire)
+             || bulk_ready_.load(std::memory_order_acquire) || !normal_.empty();
+    };
+    if (!timers_.empty() && timers_.advance(timer_clock::now()) > 0) {
+      continue;
+    }
+    metrics_.idle(metrics_clock::now());
+    idle_seq_.fetch_add(1, std::memory_order_seq_cst);
+    if (0 != idle_waiters_.load(std::memory_order_seq_cst)) {
+      std::lock_guard<std::mutex> lock(idle_m_);
+      idle_cond_.notify_all();
+    }
+    if (timers_.empty()) {
+      doorbell_.wait(ready);
+    } else {
+      doorbell_.wait_until(timers_.next_deadline(), ready);
+    }
+    idle_seq_.fetch_add(1, std::memory_order_seq_cst);
+    metrics_.awake(metrics_clock::now());
+    if (done && normal.empty() && !take(normal_, normal)
+        && !urgent_ready_.load(std::memory_order_acquire) && !bulk_ready_.load(std::memory_order_acquire)) {
+      closeLanes();
+      take(urgent_, urgent);
+      take(normal_, normal);
+      take(bulk_, bulk);
+      Batch* batches[] = { &urgent, &normal, &bulk };
+      for (Batch* jobs : batches) {
+        while (!jobs->empty() && !stop_.load(std::memory_order_relaxed)) {
+          runOne(*jobs);
+        }
+      }
+      if (stop_.load(std::memory_order_relaxed)) {
+        keepUnprocessed(urgent, normal, bulk); // shutdown_until ran out of time
+      }
+      return;
+    }
   }
 }
 
 // Factory: safe construction of object before thread start
-std::unique_ptr<Active> Active::createActive(){
-  std::unique_ptr<Active> aPtr(new Active());
-  aPtr->thd_ = std::thread(&Active::run, aPtr.get());
+std::unique_ptr<Active> Active::createActive(size_t capacity_, overflow_policy policy_, wait_strategy strategy_){
+  ActiveOptions options;
+  options.capacity = capacity_;
+  options.policy = policy_;
+  options.strategy = strategy_;
+  return createActive(options);
+}
+
+std::unique_ptr<Active> Active::createActive(const ActiveOptions& options_){
+  std::unique_ptr<Active> aPtr(new Active(options_));
+  aPtr->thd_.start(options_, std::bind(&Active::run, aPtr.get()));
   return aPtr;
 }
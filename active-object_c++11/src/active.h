@@ -22,33 +22,448 @@
 #define ACTIVE_H_
 
 #include <thread>
+#include <atomic>
 #include <functional>
 #include <condition_variable>
 #include <mutex>
 #include <memory>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <queue>
+#include <iterator>
+#include <system_error>
+#include <vector>
 
+#if defined(ACTIVE_LOCKFREE_QUEUE)
+#include "ring_queue.h"
+#else
 #include "shared_queue.h"
+#endif
+#include "parking_spot.h"
+#include "wait_strategy.h"
+#include "active_options.h"
+#include "active_thread.h"
+#include "active_metrics.h"
+#if defined(ACTIVE_TRACING)
+#include <deque>
+#include "active_trace.h"
+#include "message_pool.h"
+#endif
+#include "timer_wheel.h"
+#include "unique_function.h"
+#include "active_future.h"
 
 namespace kjellkod {
 typedef std::function<void()> Callback;
 
+// What is actually queued. Move-only, lambdas and binds capturing up to
+// 64 bytes are stored inline. A Callback is also accepted (it fits inline)
+typedef unique_function<void(), 64> Job;
+
+// A Job and when it was sent, for the wait time metrics. send() makes it
+// in the lane with emplace, the Job is moved once and the clock is read
+// before the lane's lock is taken. The same with and without ACTIVE_TRACING,
+// what a trace needs is only added to the jobs of a traced Active
+//
+// The Active's own jobs, the flush markers and the timer control jobs, are
+// sent at internal(). They are not counted in completed() or the metrics
+struct Message {
+  Message() {}
+  Message(Job&& job_, metrics_clock::time_point sent_ = metrics_clock::now())
+    : job(std::move(job_)), sent(sent_) {}
+  Job job;
+  metrics_clock::time_point sent;
+
+  static metrics_clock::time_point internal() { return metrics_clock::time_point::min(); }
+  bool isInternal() const { return internal() == sent; }
+};
+
+// The message queue backend is chosen at compile time. The lock-free ring
+// is always bounded, shared_queue is unbounded unless given a capacity.
+// What a send to a full queue does is decided by the overflow_policy.
+// run() waits on the doorbell, not on the ring, the ring does no parking
+#if defined(ACTIVE_LOCKFREE_QUEUE)
+typedef mpsc_ring_queue<Message, no_parking> MessageQueue;
+#else
+typedef shared_queue<Message> MessageQueue;
+#endif
+
+/// Priority lanes. Jobs are FIFO within a lane. Urgent jobs overtake
+/// everything else (quit, flush, config, health checks ...). Bulk jobs run
+/// when the normal lane is empty, but never wait for more than
+/// c_normal_per_bulk normal jobs in a row, so that bulk work still moves
+enum class lane { urgent, normal, bulk };
+
+typedef timer_wheel<Job>::clock timer_clock;
+typedef timer_wheel<Job>::timer_id timer_id; // 0 is never a valid id
+
 class Active {
 private:
   Active(const Active&) = delete;
   Active& operator=(const Active&) = delete;
 
-  Active();                               // Construction ONLY through factory createActive();
+  explicit Active(const ActiveOptions& options_); // Construction ONLY through factory createActive();
+
+  MessageQueue& queueFor(lane lane_) {
+    return (lane::normal == lane_) ? normal_ : ((lane::urgent == lane_) ? urgent_ : bulk_);
+  }
+
+  // The normal lane is found by run() without any flag. A job in the urgent
+  // or bulk lane raises the lane's flag AFTER it is queued, run() lowers the
+  // flag BEFORE it empties the lane, so a queued job is never missed
+  void signal(lane lane_) {
+    if (lane::urgent == lane_) {
+      urgent_ready_.store(true, std::memory_order_release);
+    } else if (lane::bulk == lane_) {
+      bulk_ready_.store(true, std::memory_order_release);
+    }
+    doorbell_.notify();
+  }
+
+  template<typename Push>
+  auto enqueue(lane lane_, Push push) -> decltype(push(std::declval<MessageQueue&>())) {
+    if (closed_.load(std::memory_order_relaxed)) {
+      return decltype(push(std::declval<MessageQueue&>()))(); // false or 0, the thread is gone
+    }
+    const auto queued = push(queueFor(lane_));
+    signal(lane_);
+    return queued;
+  }
+
+  // not stamped and not counted, see Message::internal
+  bool sendInternal(Job msg_, lane lane_) {
+    return enqueue(lane_, [&](MessageQueue& queue) { return queue.emplace(std::move(msg_), Message::internal()); });
+  }
+
+  // Timers are owned by the background thread. They are added and
+  // cancelled through the urgent lane
+  timer_id addTimer(timer_clock::time_point when_, Job msg_, timer_clock::duration period_);
+
+  struct AddTimer {
+    Active* active;
+    timer_id id;
+    timer_clock::time_point when;
+    timer_clock::duration period;
+    Job job;
+    void operator()() { active->timers_.add(id, when, std::move(job), period); }
+  };
+
+  // the jobs in hand. With tracing, also when each one was taken from its lane
+  struct Batch : std::queue<Message> {
+#if defined(ACTIVE_TRACING)
+    std::deque<metrics_clock::time_point> dequeued; // only filled if traced
+#endif
+  };
+
+#if defined(ACTIVE_TRACING)
+  // The label and the producer of a job sent to a traced Active. The job is
+  // wrapped in a Traced, with the stamp from the producer's message_pool
+  struct TraceStamp {
+    Job job;
+    const char* label;
+    uint32_t producer;
+    metrics_clock::time_point sent;
+    TraceStamp(Job&& job_, const char* label_, metrics_clock::time_point sent_)
+      : job(std::move(job_)), label(label_), producer(trace_thread_id()), sent(sent_) {}
+  };
+
+  struct Traced {
+    Active* active;
+    pooled<TraceStamp> stamp;
+    void operator()();
+  };
+
+  // only called if trace_ is set
+  void stamp(Job& job_, const char* label_, metrics_clock::time_point sent_) {
+    Traced traced = { this, make_pooled<TraceStamp>(std::move(job_), label_, sent_) };
+    job_ = Job(std::move(traced));
+  }
+#endif
+
+  // sends without a trace stamp, see send_bulk
+  template<typename InputIt>
+  size_t sendBulk(InputIt first_, InputIt last_, lane lane_) {
+    // a batch bigger than a bounded lane: run() must see the first part before the rest can fit
+    return enqueue(lane_, [&](MessageQueue& queue) {
+      return queue.push_range(first_, last_, [this, lane_]() { signal(lane_); });
+    });
+  }
 
-  void doDone(){done_ = true;}
   void run();
-  shared_queue<Callback> mq_;
-  std::thread thd_;
-  bool done_;  // finished flag to be set through msg queue by ~Active
+  void runLanes();
+  void runOne(Batch& jobs_);
+
+  // later sends fail, see shared_queue::close
+  void closeLanes();
+
+  // jobs in hand when run() was stopped, per lane, see shutdown_now()
+  void keepUnprocessed(std::queue<Message>& urgent_, std::queue<Message>& normal_, std::queue<Message>& bulk_);
+  std::vector<Job> collectUnprocessed();
+
+  MessageQueue urgent_;
+  MessageQueue normal_;
+  MessageQueue bulk_;
+  std::atomic<bool> urgent_ready_;
+  std::atomic<bool> bulk_ready_;
+  parking_spot doorbell_;      // run() waits here when all the lanes are empty
+  std::atomic<bool> done_;     // set by shutdown, the lanes are drained before the thread exits
+  std::atomic<bool> stop_;     // set by shutdown_now, run() exits after the current job
+  std::atomic<bool> closed_;   // the thread is gone, sends are rejected. The lanes are closed before
+  std::atomic<bool> exited_;   // run() has returned
+  std::atomic<uint64_t> completed_; // written by run() only, see completed()
+  std::atomic<uint64_t> idle_seq_;  // odd while run() waits for jobs with nothing in hand
+  std::atomic<int> idle_waiters_;   // threads in wait_idle, run() only notifies if there are any
+  std::mutex idle_m_;
+  std::condition_variable idle_cond_;
+  parking_spot exit_spot_;     // shutdown_until waits here for run() to return
+  bool joined_;                // owner only
+  std::queue<Message> unprocessed_[3]; // written by run() when stopped, read after the join
+  std::atomic<timer_id> next_timer_id_;
+  timer_wheel<Job> timers_;    // only touched by run()
+  active_metrics metrics_;     // only updated by run()
+#if defined(ACTIVE_TRACING)
+  std::shared_ptr<trace_ring> trace_; // null if not traced, written by run()
+  metrics_clock::time_point dequeued_; // of the job that run() executes, for Traced
+#endif
+  active_thread thd_;
+
+  /// Binds a lane to call_on, see call()
+  struct LaneSender {
+    Active& active;
+    lane to;
+    bool send(Job msg_) { return active.send(std::move(msg_), to); }
+  };
+
+  /// As LaneSender but the job is never lost to a full lane, see force_push.
+  /// For the flush markers
+  struct MarkerSender {
+    Active& active;
+    lane to;
+    bool send(Job msg_) {
+      return active.enqueue(to, [&](MessageQueue& queue) {
+        return queue.force_push(Message(std::move(msg_), Message::internal()));
+      });
+    }
+  };
+
+  // the lanes are empty and run() waits for jobs, see idle_seq_
+  bool isIdle() const;
+  bool waitIdleUntil(std::chrono::steady_clock::time_point deadline_);
+
+  // A suspended coroutine as a job, the handle is stored inline in the Job
+  template<typename Handle>
+  struct Resume {
+    Handle handle;
+    void operator()() { handle.resume(); }
+  };
 
 public:
+  /// Max number of normal jobs in a row while bulk jobs are waiting
+  static const unsigned c_normal_per_bulk = 16;
+
+  /// Max number of jobs in a row before due timers are run, when busy
+  static const unsigned c_jobs_per_timer_check = 64;
+
+  /// Graceful shutdown, shutdown() if it was not called before
   virtual ~Active();
-  void send(Callback msg_);
-  static std::unique_ptr<Active> createActive(); // Factory: safe construction & thread start
+
+  /// Drains: every queued job is executed, also jobs that are sent by the
+  /// jobs, then the thread is joined. Pending timers are dropped. Call it
+  /// from the owner, not from a job. Later sends are rejected and later
+  /// shutdown calls do nothing. A send that races with the end of the drain
+  /// is either executed or rejected, never lost
+  void shutdown();
+
+  /// Stops after the job that is executing now, the jobs in the lanes are not
+  /// executed but handed back: urgent first, then normal, then bulk, FIFO
+  /// within a lane. They can be persisted, or sent to another Active.
+  /// Pending timers are dropped. A send that races with it is either handed
+  /// back or rejected, also one that was blocked on a full lane
+  /// @return the jobs that were not executed, their number is size()
+  std::vector<Job> shutdown_now();
+
+  /// Drains, as shutdown(), until 'deadline_' and then stops as shutdown_now()
+  /// @return the jobs that were not executed by the deadline
+  std::vector<Job> shutdown_until(std::chrono::steady_clock::time_point deadline_);
+
+  template<typename Rep, typename Period>
+  std::vector<Job> shutdown_for(const std::chrono::duration<Rep, Period>& timeout_) {
+    return shutdown_until(std::chrono::steady_clock::now()
+                          + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout_));
+  }
+
+  /// The Active takes ownership of the job, it is moved, never copied, into
+  /// the lane. A lambda or a moved Callback is not copied on the way in either
+  /// @return false if the job was rejected or dropped (drop_newest policy)
+  bool send(Job msg_, lane lane_ = lane::normal);
+
+  /// As above, the job is shown with 'label_' in the trace, see active_trace.h.
+  /// The label is not copied, use a string literal. Without tracing it is ignored
+  bool send(Job msg_, const char* label_, lane lane_ = lane::normal);
+
+  /// Sends all jobs in [first_, last_) with one lock acquisition and one
+  /// wakeup of the background thread. Jobs are moved in with std::make_move_iterator,
+  /// anything that a Job can be made from (a Callback, a bind ...) can also be copied in
+  /// @return number of jobs that were queued, see overflow_policy
+  template<typename InputIt>
+  size_t send_bulk(InputIt first_, InputIt last_, lane lane_ = lane::normal) {
+#if defined(ACTIVE_TRACING)
+    if (trace_) {
+      const metrics_clock::time_point sent = metrics_clock::now();
+      std::vector<Job> stamped;
+      for (; first_ != last_; ++first_) {
+        stamped.push_back(Job(*first_));
+        stamp(stamped.back(), nullptr, sent);
+      }
+      return sendBulk(std::make_move_iterator(stamped.begin()), std::make_move_iterator(stamped.end()), lane_);
+    }
+#endif
+    return sendBulk(first_, last_, lane_);
+  }
+
+  /// Never waits for room in a full queue, see overflow_policy
+  bool try_send(Job msg_, lane lane_ = lane::normal);
+
+  /// Queued even if the lane is full, whatever the policy, see force_push.
+  /// For the few jobs that must never be lost, e.g. a job that reschedules
+  /// work that is kept elsewhere
+  /// @return false only if the Active is shut down
+  bool force_send(Job msg_, lane lane_ = lane::normal);
+
+  /// With the block policy: waits at most 'timeout' for room in a full queue
+  template<typename Rep, typename Period>
+  bool send_for(Job msg_, const std::chrono::duration<Rep, Period>& timeout_, lane lane_ = lane::normal) {
+#if defined(ACTIVE_TRACING)
+    if (trace_) {
+      stamp(msg_, nullptr, metrics_clock::now());
+    }
+#endif
+    return enqueue(lane_, [&](MessageQueue& queue) { return queue.push_for(std::move(msg_), timeout_); });
+  }
+
+  /// Delayed job, executed on the background thread once 'when_' has passed.
+  /// Timers that are not due when the Active is destroyed are dropped
+  /// @return id for cancel_timer(), 0 if the timer could not be queued
+  timer_id send_at(timer_clock::time_point when_, Job msg_) {
+    return addTimer(when_, std::move(msg_), timer_clock::duration::zero());
+  }
+
+  template<typename Rep, typename Period>
+  timer_id send_after(const std::chrono::duration<Rep, Period>& delay_, Job msg_) {
+    return addTimer(timer_clock::now() + std::chrono::duration_cast<timer_clock::duration>(delay_),
+                    std::move(msg_), timer_clock::duration::zero());
+  }
+
+  /// Periodic job, first executed one period from now. Fixed rate: periods
+  /// missed by a busy thread are skipped, not executed back to back
+  template<typename Rep, typename Period>
+  timer_id send_every(const std::chrono::duration<Rep, Period>& period_, Job msg_) {
+    const timer_clock::duration period = std::chrono::duration_cast<timer_clock::duration>(period_);
+    return addTimer(timer_clock::now() + period, std::move(msg_), period);
+  }
+
+  /// Asynchronous, a timer that is already due may still run once.
+  /// Can also be called from the timer's own job
+  /// @return false if the cancel request could not be queued
+  bool cancel_timer(timer_id id_);
+
+  /// failed sends, all lanes
+  uint64_t rejected() const { return urgent_.rejected() + normal_.rejected() + bulk_.rejected(); }
+  /// jobs thrown away by a drop policy, all lanes
+  uint64_t dropped() const { return urgent_.dropped() + normal_.dropped() + bulk_.dropped(); }
+
+  /// Awaiter of schedule(). Only instantiated by a co_await, i.e. with C++20
+  struct Schedule {
+    Active* active;
+    lane to;
+    bool rejected;
+
+    bool await_ready() const { return false; }
+
+    template<typename Handle>
+    bool await_suspend(Handle handle_) {
+      Resume<Handle> resume = { handle_ };
+      if (active->send(std::move(resume), "co_await", to)) {
+        return true; // may already run on the background thread, 'this' is not touched again
+      }
+      rejected = true;
+      return false;
+    }
+
+    void await_resume() const {
+      if (rejected) {
+        throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again),
+                                "Active::schedule, the lane is full");
+      }
+    }
+  };
+
+  /// co_await active->schedule() continues the coroutine on the background
+  /// thread, see active_coroutine.h. If the send fails, see overflow_policy,
+  /// the co_await throws std::system_error on the calling thread
+  Schedule schedule(lane lane_ = lane::normal) {
+    Schedule awaiter = { this, lane_, false };
+    return awaiter;
+  }
+
+  /// Jobs from the lanes that have been executed, timers not included, nor
+  /// the Active's own jobs (flush markers, adding and cancelling timers).
+  /// Any thread, no lock: the effects of the jobs that are counted are
+  /// visible to the caller
+  uint64_t completed() const { return completed_.load(std::memory_order_acquire); }
+
+  /// Returns when every job that was sent before the call, in any lane, has
+  /// been executed. A marker job is sent to each lane and waited for, it is
+  /// never rejected, and is sent again if a drop policy drops it.
+  /// Jobs sent during the flush are not waited for. Never call it from a
+  /// job on this Active, it would wait for itself
+  void flush();
+
+  /// Waits until the Active is idle: the lanes are empty and no job is
+  /// executing, i.e. also the jobs that the jobs sent are done. It is woken by
+  /// the background thread, there is no polling and no job is sent.
+  /// Timers are not jobs, pending timers do not keep it busy
+  /// @return false if the Active was still busy after 'timeout_'
+  template<typename Rep, typename Period>
+  bool wait_idle(const std::chrono::duration<Rep, Period>& timeout_) {
+    return waitIdleUntil(std::chrono::steady_clock::now()
+                         + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout_));
+  }
+
+  /// Snapshot of the runtime metrics, can be called from any thread
+  ActiveMetrics metrics() const {
+    ActiveMetrics snapshot = metrics_.snapshot(urgent_.size() + normal_.size() + bulk_.size());
+    snapshot.rejected = rejected();
+    snapshot.dropped = dropped();
+    return snapshot;
+  }
+
+  /// Request/response job: 'func' is executed on the background thread and
+  /// its return value, or exception, is given through the returned future
+  template<typename F>
+  active_future<typename std::result_of<F()>::type> call(F func, lane lane_ = lane::normal) {
+    if (lane::normal == lane_) {
+      return call_on(*this, std::move(func));
+    }
+    LaneSender sender = { *this, lane_ };
+    return call_on(sender, std::move(func));
+  }
+
+  /// Factory: safe construction & thread start
+  /// @param capacity_ max number of queued jobs per lane, 0 is unbounded
+  ///        (shared_queue) or the default ring size (lock-free ring)
+  /// @param policy_ what a send to a full queue does
+  /// @param strategy_ how the background thread waits for jobs when idle.
+  ///        block burns no cpu, spin_then_park and busy_poll are opt-in
+  static std::unique_ptr<Active> createActive(size_t capacity_ = 0, overflow_policy policy_ = overflow_policy::block,
+                                              wait_strategy strategy_ = wait_strategy::block);
+
+  /// Factory with all options, also for the thread: affinity, NUMA node,
+  /// name, stack size and scheduling class
+  /// @throw std::system_error if the thread cannot be started with the options
+  static std::unique_ptr<Active> createActive(const ActiveOptions& options_);
 };
 } // end namespace kjellkod
 
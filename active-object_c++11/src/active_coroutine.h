@@ -0,0 +1,242 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* C++20 coroutines on Active objects: sequential looking code that hops
+* between Actives instead of nested callbacks.
+*
+*   task<int> parse(Active& parser, Active& store, std::string text) {
+*     co_await parser.schedule();        // runs on the parser's thread
+*     int value = std::stoi(text);
+*     co_await store.schedule();         // and now on the store's thread
+*     co_return value;
+*   }
+*   int value = spawn(parse(*parser, *store, "42")).get();
+*
+* A hop is one send. The Job holds the coroutine handle inline, there is
+* no std::function and no allocation. The coroutine frames are allocated
+* from per-thread message_pools, one per size class, so a warm chain of
+* coroutines does not malloc either. A frame is made on the thread that
+* calls the coroutine and is given back from the thread where it ends.
+*
+* task<T> is lazy, it starts when it is awaited and runs on the awaiting
+* thread until it hops. When it ends the awaiting coroutine goes on, on the
+* thread where the task ended. co_await a.schedule() to hop back.
+*
+* A hop must not be lost, do not use it with the drop_oldest policy: the
+* coroutine would never be resumed. A rejected hop throws, see schedule().
+*
+* Needs C++20, with an older standard this header is empty. */
+
+#ifndef ACTIVE_COROUTINE_H_
+#define ACTIVE_COROUTINE_H_
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <utility>
+
+#include "active_future.h"
+#include "message_pool.h"
+
+namespace kjellkod {
+
+template<typename T> class task;
+
+namespace coroutine_detail {
+
+template<size_t Size>
+struct frame_block {
+  alignas(std::max_align_t) unsigned char bytes[Size];
+};
+
+template<size_t Size>
+void* allocateIn() {
+  return message_pool<frame_block<Size> >::local().acquire()->value();
+}
+
+template<size_t Size>
+void releaseIn(void* frame) {
+  typedef message_pool<frame_block<Size> > Pool;
+  Pool::release(Pool::nodeOf(static_cast<frame_block<Size>*>(frame)));
+}
+
+// size classes, a bigger frame is a plain new/delete
+const size_t c_largest_pooled_frame = 1024;
+
+/// Frame allocation of all the coroutine types below
+struct pooled_frame {
+  static void* operator new(size_t size) {
+    if (size <= 128) return allocateIn<128>();
+    if (size <= 256) return allocateIn<256>();
+    if (size <= 512) return allocateIn<512>();
+    if (size <= c_largest_pooled_frame) return allocateIn<c_largest_pooled_frame>();
+    return ::operator new(size);
+  }
+
+  static void operator delete(void* frame, size_t size) {
+    if (size <= 128) releaseIn<128>(frame);
+    else if (size <= 256) releaseIn<256>(frame);
+    else if (size <= 512) releaseIn<512>(frame);
+    else if (size <= c_largest_pooled_frame) releaseIn<c_largest_pooled_frame>(frame);
+    else ::operator delete(frame);
+  }
+};
+
+
+template<typename T>
+struct task_promise_base : pooled_frame {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+
+  // the awaiting coroutine goes on without a round trip through a queue
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept {
+      std::coroutine_handle<> next = done.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+
+  void rethrowError() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+template<typename T>
+struct task_promise : task_promise_base<T> {
+  future_detail::value_slot<T> value;
+
+  task<T> get_return_object();
+
+  template<typename U>
+  void return_value(U&& value_) { value.set(std::forward<U>(value_)); }
+
+  T result() {
+    this->rethrowError();
+    return value.take();
+  }
+};
+
+template<>
+struct task_promise<void> : task_promise_base<void> {
+  task<void> get_return_object();
+  void return_void() {}
+  void result() { rethrowError(); }
+};
+
+
+// Eager and self-destroying, the bridge from a task to an active_future
+struct detached {
+  struct promise_type : pooled_frame {
+    detached get_return_object() { return detached(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); } // the promise below takes all exceptions
+  };
+};
+
+template<typename T>
+detached runDetached(task<T> work, active_promise<T> promise) {
+  try {
+    promise.set_value(co_await std::move(work));
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+}
+
+inline detached runDetached(task<void> work, active_promise<void> promise);
+} // coroutine_detail
+
+
+
+/** Lazy coroutine with a result. Move-only, co_await it once */
+template<typename T = void>
+class task {
+public:
+  typedef coroutine_detail::task_promise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> handle_type;
+
+  task() : handle_(nullptr) {}
+  explicit task(handle_type handle) : handle_(handle) {}
+  task(task&& other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+  task& operator=(task&& other) noexcept {
+    std::swap(handle_, other.handle_);
+    return *this;
+  }
+  ~task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  bool valid() const { return static_cast<bool>(handle_); }
+
+  struct awaiter {
+    handle_type handle;
+    bool await_ready() const { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+      handle.promise().continuation = awaiting;
+      return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+  };
+
+  awaiter operator co_await() && { return awaiter{ handle_ }; }
+
+private:
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+
+  handle_type handle_;
+};
+
+
+namespace coroutine_detail {
+template<typename T>
+task<T> task_promise<T>::get_return_object() {
+  return task<T>(task<T>::handle_type::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() {
+  return task<void>(task<void>::handle_type::from_promise(*this));
+}
+
+inline detached runDetached(task<void> work, active_promise<void> promise) {
+  try {
+    co_await std::move(work);
+    promise.set_value();
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+}
+} // coroutine_detail
+
+
+/// Starts 'work' on the calling thread, for code that is not a coroutine.
+/// The result, or exception, is given through the returned future
+template<typename T>
+active_future<T> spawn(task<T> work) {
+  active_promise<T> promise;
+  active_future<T> future = promise.get_future();
+  coroutine_detail::runDetached(std::move(work), std::move(promise));
+  return future;
+}
+} // end namespace kjellkod
+
+#endif // __cpp_impl_coroutine
+#endif
@@ -0,0 +1,468 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Lightweight future/promise for request/response jobs on an Active object.
+*
+*   auto answer = active->call([]{ return 6 * 7; });     // asynchronous
+*   int value = answer.get();                            // waits, rethrows
+*
+*   auto next = active->call(parse).then(*other, store);  // 'store' runs on 'other'
+*
+* The shared state between promise and future is recycled through a pool,
+* one pool per result type, so a round trip does not allocate once the
+* pool is warm. The caller waits on a parking_spot, i.e. it spins shortly
+* and only sleeps on the (embedded) condition variable if the result takes
+* a while. An exception thrown by the job is rethrown by get().
+*
+* 'then' works with anything that has a send(Job) function, the continuation
+* is sent as a new job to that executor once the result is available. */
+
+#ifndef ACTIVE_FUTURE_H_
+#define ACTIVE_FUTURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "parking_spot.h"
+#include "unique_function.h"
+
+namespace kjellkod {
+
+template<typename T> class active_future;
+template<typename T> class active_promise;
+
+namespace future_detail {
+
+template<typename T>
+class value_slot {
+  typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage_;
+  bool has_value_;
+
+  T* get() { return reinterpret_cast<T*>(&storage_); }
+
+public:
+  value_slot() : has_value_(false) {}
+  ~value_slot() { reset(); }
+
+  template<typename U>
+  void set(U&& value_) {
+    new (&storage_) T(std::forward<U>(value_));
+    has_value_ = true;
+  }
+  T take() { return std::move(*get()); }
+  void reset() {
+    if (has_value_) {
+      get()->~T();
+      has_value_ = false;
+    }
+  }
+};
+
+template<>
+class value_slot<void> {
+public:
+  void set() {}
+  void take() {}
+  void reset() {}
+};
+
+
+enum Status { c_empty = 0, c_has_continuation = 1, c_ready = 2 };
+
+template<typename T> class state_pool;
+
+/// Shared between ONE promise and ONE future (or continuation). The
+/// 'status' transitions are what synchronizes value, error and continuation
+template<typename T>
+struct shared_state {
+  value_slot<T> value;
+  std::exception_ptr error;
+  unique_function<void()> continuation;
+  std::atomic<int> status;
+  std::atomic<int> references;
+  parking_spot parking;
+  shared_state* next_free;
+
+  shared_state() : status(c_empty), references(0), next_free(nullptr) {}
+
+  bool ready() const {
+    return c_ready == status.load(std::memory_order_acquire);
+  }
+
+  void wait() {
+    if (!ready()) {
+      parking.wait([this]() { return ready(); });
+    }
+  }
+
+  template<typename Clock, typename Duration>
+  bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+    return ready() || parking.wait_until(deadline, [this]() { return ready(); });
+  }
+
+  /// called by the promise AFTER value or error was set
+  void complete() {
+    int previous = status.exchange(c_ready, std::memory_order_acq_rel);
+    parking.notify();
+    if (c_has_continuation == previous) {
+      unique_function<void()> next(std::move(continuation));
+      next();
+    }
+  }
+
+  /// runs 'next' right away if the result is already available
+  void setContinuation(unique_function<void()> next) {
+    continuation = std::move(next);
+    int expected = c_empty;
+    if (!status.compare_exchange_strong(expected, c_has_continuation, std::memory_order_acq_rel)) {
+      unique_function<void()> now(std::move(continuation));
+      now();
+    }
+  }
+
+  void addReference() {
+    references.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release() {
+    if (1 == references.fetch_sub(1, std::memory_order_acq_rel)) {
+      state_pool<T>::instance().recycle(this);
+    }
+  }
+};
+
+
+/// Free list of shared states, one pool per result type. States are only
+/// allocated when the free list is empty and are never given back to the heap
+template<typename T>
+class state_pool {
+  std::mutex m_;
+  shared_state<T>* free_;
+
+  state_pool() : free_(nullptr) {}
+  state_pool(const state_pool&) = delete;
+  state_pool& operator=(const state_pool&) = delete;
+
+public:
+  static state_pool& instance() {
+    static state_pool pool;
+    return pool;
+  }
+
+  ~state_pool() {
+    while (free_) {
+      shared_state<T>* state = free_;
+      free_ = state->next_free;
+      delete state;
+    }
+  }
+
+  shared_state<T>* acquire() {
+    shared_state<T>* state = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      if (free_) {
+        state = free_;
+        free_ = state->next_free;
+      }
+    }
+    if (nullptr == state) {
+      state = new shared_state<T>;
+    }
+    state->status.store(c_empty, std::memory_order_relaxed);
+    state->references.store(1, std::memory_order_relaxed);
+    return state;
+  }
+
+  void recycle(shared_state<T>* state) {
+    state->value.reset();
+    state->error = nullptr;
+    state->continuation = nullptr;
+    std::lock_guard<std::mutex> lock(m_);
+    state->next_free = free_;
+    free_ = state;
+  }
+};
+
+
+/// Owns one reference to a shared state
+template<typename T>
+class state_ref {
+  shared_state<T>* state_;
+
+  state_ref(const state_ref&) = delete;
+  state_ref& operator=(const state_ref&) = delete;
+
+public:
+  explicit state_ref(shared_state<T>* state = nullptr) : state_(state) {}
+  state_ref(state_ref&& other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+  state_ref& operator=(state_ref&& other) noexcept {
+    std::swap(state_, other.state_);
+    return *this;
+  }
+  ~state_ref() {
+    if (state_) {
+      state_->release();
+    }
+  }
+
+  shared_state<T>* get() const { return state_; }
+  shared_state<T>* operator->() const { return state_; }
+  shared_state<T>* detach() {
+    shared_state<T>* state = state_;
+    state_ = nullptr;
+    return state;
+  }
+};
+
+
+template<typename F, typename T>
+struct continuation_result {
+  typedef typename std::result_of<F(T)>::type type;
+};
+
+template<typename F>
+struct continuation_result<F, void> {
+  typedef typename std::result_of<F()>::type type;
+};
+
+
+// Runs 'func' and stores its return value, or exception, in the promise
+template<typename R, typename F>
+void fulfil(active_promise<R>& promise_, F& func, std::true_type /*void*/) {
+  try {
+    func();
+  } catch (...) {
+    promise_.set_exception(std::current_exception());
+    return;
+  }
+  promise_.set_value();
+}
+
+template<typename R, typename F>
+void fulfil(active_promise<R>& promise_, F& func, std::false_type /*void*/) {
+  try {
+    promise_.set_value(func());
+  } catch (...) {
+    if (promise_.valid()) {
+      promise_.set_exception(std::current_exception());
+    }
+  }
+}
+
+template<typename R, typename F>
+void fulfil(active_promise<R>& promise_, F& func) {
+  fulfil(promise_, func, std::is_void<R>());
+}
+
+
+/// The job that is sent to the Active by 'call'
+template<typename F, typename R>
+struct promised_call {
+  F func;
+  active_promise<R> promise;
+
+  promised_call(F&& func_, active_promise<R>&& promise_)
+    : func(std::move(func_)), promise(std::move(promise_)) {}
+  promised_call(promised_call&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+    : func(std::move(other.func)), promise(std::move(other.promise)) {}
+
+  void operator()() { fulfil(promise, func); }
+};
+
+
+// Calls the continuation with the antecedent's value
+template<typename F, typename T>
+struct apply_value {
+  F& func;
+  shared_state<T>* antecedent;
+  typename continuation_result<F, T>::type operator()() { return func(antecedent->value.take()); }
+};
+
+template<typename F>
+struct apply_value<F, void> {
+  F& func;
+  shared_state<void>* antecedent;
+  typename continuation_result<F, void>::type operator()() { return func(); }
+};
+
+
+/// The job sent to the continuation's executor once the antecedent is ready
+template<typename F, typename T, typename R>
+struct continuation_job {
+  F func;
+  state_ref<T> antecedent;
+  active_promise<R> promise;
+
+  continuation_job(F&& func_, state_ref<T>&& antecedent_, active_promise<R>&& promise_)
+    : func(std::move(func_)), antecedent(std::move(antecedent_)), promise(std::move(promise_)) {}
+  continuation_job(continuation_job&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+    : func(std::move(other.func)), antecedent(std::move(other.antecedent)), promise(std::move(other.promise)) {}
+
+  void operator()() {
+    if (antecedent->error) {
+      promise.set_exception(antecedent->error);
+      return;
+    }
+    apply_value<F, T> call = { func, antecedent.get() };
+    fulfil(promise, call);
+  }
+};
+
+
+/// Stored in the antecedent's state, sends the continuation_job when it is ready
+template<typename Executor, typename F, typename T, typename R>
+struct schedule_continuation {
+  Executor* executor;
+  F func;
+  shared_state<T>* antecedent; // the reference is owned by the job once it is created
+  active_promise<R> promise;
+
+  schedule_continuation(Executor* executor_, F&& func_, shared_state<T>* antecedent_, active_promise<R>&& promise_)
+    : executor(executor_), func(std::move(func_)), antecedent(antecedent_), promise(std::move(promise_)) {}
+  schedule_continuation(schedule_continuation&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+    : executor(other.executor), func(std::move(other.func))
+    , antecedent(other.antecedent), promise(std::move(other.promise)) {}
+
+  void operator()() {
+    executor->send(continuation_job<F, T, R>(std::move(func), state_ref<T>(antecedent), std::move(promise)));
+  }
+};
+} // future_detail
+
+
+
+/** The receiving end of 'call'. Move-only, get() can be called once */
+template<typename T>
+class active_future {
+  future_detail::state_ref<T> state_;
+
+  active_future(const active_future&) = delete;
+  active_future& operator=(const active_future&) = delete;
+
+public:
+  active_future() {}
+  explicit active_future(future_detail::shared_state<T>* state) : state_(state) {}
+  active_future(active_future&& other) noexcept : state_(std::move(other.state_)) {}
+  active_future& operator=(active_future&& other) {
+    state_ = std::move(other.state_);
+    return *this;
+  }
+
+  bool valid() const { return nullptr != state_.get(); }
+  bool is_ready() const { return valid() && state_->ready(); }
+
+  /// waits till the result is available
+  void wait() const { state_->wait(); }
+
+  /// @return false if the result is still not available at 'deadline'
+  template<typename Clock, typename Duration>
+  bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline) const { return state_->wait_until(deadline); }
+
+  template<typename Rep, typename Period>
+  bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+    return wait_until(std::chrono::steady_clock::now() + timeout);
+  }
+
+  /// waits for, and returns, the result. A job exception is rethrown here
+  T get() {
+    future_detail::state_ref<T> state(std::move(state_));
+    state->wait();
+    if (state->error) {
+      std::rethrow_exception(state->error);
+    }
+    return state->value.take();
+  }
+
+  /** Continuation: 'func' gets the result and is executed as a new job on
+  * 'executor' (i.e. an Active) when the result is available. If this future
+  * holds an exception 'func' is not called, the exception is passed on.
+  * This future is consumed by the call */
+  template<typename Executor, typename F>
+  active_future<typename future_detail::continuation_result<F, T>::type> then(Executor& executor, F func) {
+    typedef typename future_detail::continuation_result<F, T>::type Result;
+    active_promise<Result> promise;
+    active_future<Result> future = promise.get_future();
+    future_detail::shared_state<T>* antecedent = state_.detach();
+    antecedent->setContinuation(future_detail::schedule_continuation<Executor, F, T, Result>(
+                                  &executor, std::move(func), antecedent, std::move(promise)));
+    return future;
+  }
+};
+
+
+
+/** The sending end, normally only used through 'call'. A promise that is
+* destroyed without a value gives a std::future_error(broken_promise) */
+template<typename T>
+class active_promise {
+  future_detail::shared_state<T>* state_;
+
+  active_promise(const active_promise&) = delete;
+  active_promise& operator=(const active_promise&) = delete;
+
+  void finish() {
+    future_detail::shared_state<T>* state = state_;
+    state_ = nullptr;
+    state->complete();
+    state->release();
+  }
+
+public:
+  active_promise() : state_(future_detail::state_pool<T>::instance().acquire()) {}
+  active_promise(active_promise&& other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+  active_promise& operator=(active_promise&& other) {
+    std::swap(state_, other.state_);
+    return *this;
+  }
+
+  ~active_promise() {
+    if (state_) {
+      set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+  }
+
+  bool valid() const { return nullptr != state_; }
+
+  /// must only be called once
+  active_future<T> get_future() {
+    state_->addReference();
+    return active_future<T>(state_);
+  }
+
+  template<typename... U>
+  void set_value(U&&... value) {
+    state_->value.set(std::forward<U>(value)...);
+    finish();
+  }
+
+  void set_exception(std::exception_ptr error) {
+    state_->error = error;
+    finish();
+  }
+};
+
+
+
+/// Sends 'func' as a job to 'executor', the result can be read from the returned future
+template<typename Executor, typename F>
+active_future<typename std::result_of<F()>::type> call_on(Executor& executor, F func) {
+  typedef typename std::result_of<F()>::type Result;
+  active_promise<Result> promise;
+  active_future<Result> future = promise.get_future();
+  executor.send(future_detail::promised_call<F, Result>(std::move(func), std::move(promise)));
+  return future;
+}
+
+} // end namespace kjellkod
+
+#endif
@@ -0,0 +1,256 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Always-on runtime metrics of an Active: how many jobs went through, how
+* deep the lanes got, how long a job waited in a lane, how long it ran and
+* how busy the background thread is.
+*
+* Everything is written by the background thread only, so the counters are
+* plain relaxed loads and stores, no read-modify-write and no lock. The
+* senders only pay for one clock read, the time stamp of the job.
+* metrics() is a snapshot, it can be read from any thread at any time */
+
+#ifndef ACTIVE_METRICS_H_
+#define ACTIVE_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kjellkod {
+typedef std::chrono::steady_clock metrics_clock;
+
+/// Snapshot of a log_histogram, values in nanoseconds
+struct histogram_snapshot {
+  std::vector<uint64_t> counts; // per bucket, see log_histogram
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+
+  histogram_snapshot() : count(0), sum(0), max(0) {}
+
+  double mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+
+  /// @param percent 0-100
+  /// @return upper bound of the bucket that holds the percentile, i.e. at
+  ///         most 25% above the real value, and never above max
+  uint64_t percentile(double percent) const;
+};
+
+
+/// HDR style histogram: every power of two is split in c_sub_buckets
+/// linear buckets, i.e. the precision is 25% over the whole 64 bit range.
+/// Single writer, any number of readers
+class log_histogram {
+public:
+  static const unsigned c_sub_bits = 2;
+  static const unsigned c_sub_buckets = 1u << c_sub_bits;
+  static const unsigned c_buckets = (64 - c_sub_bits + 1) * c_sub_buckets;
+
+  log_histogram() : count_(0), sum_(0), max_(0) {
+    for (unsigned idx = 0; idx < c_buckets; ++idx) {
+      counts_[idx].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  static unsigned bucketOf(uint64_t value) {
+    if (value < c_sub_buckets) {
+      return static_cast<unsigned>(value);
+    }
+    const unsigned msb = mostSignificantBit(value);
+    const unsigned sub = static_cast<unsigned>(value >> (msb - c_sub_bits)) & (c_sub_buckets - 1);
+    return (msb - c_sub_bits + 1) * c_sub_buckets + sub;
+  }
+
+  /// smallest value in the bucket
+  static uint64_t lowerBound(unsigned bucket) {
+    if (bucket < c_sub_buckets) {
+      return bucket;
+    }
+    const unsigned msb = bucket / c_sub_buckets + c_sub_bits - 1;
+    const uint64_t sub = bucket % c_sub_buckets;
+    return (c_sub_buckets + sub) << (msb - c_sub_bits);
+  }
+
+  /// largest value in the bucket
+  static uint64_t upperBound(unsigned bucket) {
+    return (bucket + 1 >= c_buckets) ? UINT64_MAX : lowerBound(bucket + 1) - 1;
+  }
+
+  /// writer side
+  void record(uint64_t value) {
+    bump(counts_[bucketOf(value)], 1);
+    bump(count_, 1);
+    bump(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  histogram_snapshot snapshot() const {
+    histogram_snapshot copy;
+    copy.counts.resize(c_buckets);
+    for (unsigned idx = 0; idx < c_buckets; ++idx) {
+      copy.counts[idx] = counts_[idx].load(std::memory_order_relaxed);
+      copy.count += copy.counts[idx]; // consistent with the buckets, count_ may be ahead
+    }
+    copy.sum = sum_.load(std::memory_order_relaxed);
+    copy.max = max_.load(std::memory_order_relaxed);
+    return copy;
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+  log_histogram(const log_histogram&) = delete;
+  log_histogram& operator=(const log_histogram&) = delete;
+
+  // single writer, no need for fetch_add
+  static void bump(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  static unsigned mostSignificantBit(uint64_t value) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(value);
+#else
+    unsigned msb = 0;
+    while (value >>= 1) {
+      ++msb;
+    }
+    return msb;
+#endif
+  }
+
+  std::atomic<uint64_t> counts_[c_buckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+
+inline uint64_t histogram_snapshot::percentile(double percent) const {
+  if (0 == count) {
+    return 0;
+  }
+  const double wanted = percent / 100.0 * count;
+  uint64_t seen = 0;
+  for (unsigned idx = 0; idx < counts.size(); ++idx) {
+    seen += counts[idx];
+    if (counts[idx] != 0 && seen >= wanted) {
+      const uint64_t upper = log_histogram::upperBound(idx);
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+
+/// Snapshot of the metrics of one Active, see Active::metrics()
+struct ActiveMetrics {
+  uint64_t enqueued;   // taken by the background thread + still in the lanes, handed back jobs not included
+  uint64_t executed;   // jobs from the lanes that have been run, timers and the Active's own jobs not included
+  uint64_t rejected;   // failed sends, see overflow_policy
+  uint64_t dropped;    // thrown away by a drop policy
+  uint64_t depth;      // jobs in the lanes, and taken but not yet run
+  uint64_t high_water; // max depth seen by the background thread
+  histogram_snapshot wait_ns;    // send to start of execution
+  histogram_snapshot service_ns; // execution time of a job
+  metrics_clock::duration busy;  // the background thread's time outside of waiting for jobs
+  metrics_clock::duration idle;
+
+  /// 0.0 - 1.0, close to 1.0 means that the Active is saturated
+  double busy_ratio() const {
+    const metrics_clock::duration total = busy + idle;
+    return total.count() ? static_cast<double>(busy.count()) / total.count() : 0.0;
+  }
+};
+
+
+/// The writer side, owned by the Active and only updated by its background thread
+class active_metrics {
+public:
+  active_metrics() : started_(metrics_clock::now()), taken_(0), high_water_(0), idle_ns_(0), idle_since_ns_(0) {}
+
+  /// 'depth' is all the jobs in hand after a swap-and-drain of the lanes
+  void taken(size_t jobs, size_t depth) {
+    taken_.store(taken_.load(std::memory_order_relaxed) + jobs, std::memory_order_relaxed);
+    if (depth > high_water_.load(std::memory_order_relaxed)) {
+      high_water_.store(depth, std::memory_order_relaxed);
+    }
+  }
+
+  void executed(metrics_clock::time_point sent, metrics_clock::time_point start, metrics_clock::time_point end) {
+    wait_ns_.record(nanoseconds(start - sent));
+    service_ns_.record(nanoseconds(end - start));
+  }
+
+  /// one of the Active's own jobs has been run, it is not counted as taken
+  void internal() {
+    taken_.store(taken_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+  }
+
+  /// taken jobs that were not run but handed back by shutdown_now(). Called
+  /// after the background thread was joined, it is still the only writer
+  void handed_back(size_t jobs) {
+    taken_.store(taken_.load(std::memory_order_relaxed) - jobs, std::memory_order_relaxed);
+  }
+
+  /// the background thread waits for jobs, until awake()
+  void idle(metrics_clock::time_point since) {
+    idle_since_ns_.store(nanoseconds(since - started_) + 1, std::memory_order_relaxed); // 0: not waiting
+  }
+
+  void awake(metrics_clock::time_point now) {
+    const uint64_t since = idle_since_ns_.load(std::memory_order_relaxed) - 1;
+    idle_since_ns_.store(0, std::memory_order_relaxed);
+    idle_ns_.store(idle_ns_.load(std::memory_order_relaxed) + nanoseconds(now - started_) - since, std::memory_order_relaxed);
+  }
+
+  /// @param in_lanes jobs that are queued but not yet taken by the background thread
+  ActiveMetrics snapshot(uint64_t in_lanes) const {
+    ActiveMetrics metrics = ActiveMetrics();
+    metrics.service_ns = service_ns_.snapshot();
+    metrics.wait_ns = wait_ns_.snapshot();
+    const uint64_t taken = taken_.load(std::memory_order_relaxed);
+    metrics.executed = metrics.service_ns.count;
+    metrics.enqueued = taken + in_lanes;
+    metrics.depth = metrics.enqueued > metrics.executed ? metrics.enqueued - metrics.executed : 0;
+    metrics.high_water = high_water_.load(std::memory_order_relaxed);
+    const uint64_t total = nanoseconds(metrics_clock::now() - started_);
+    const uint64_t idle_since = idle_since_ns_.load(std::memory_order_relaxed);
+    uint64_t idle = idle_ns_.load(std::memory_order_relaxed);
+    if (idle_since != 0 && total > idle_since - 1) {
+      idle += total - (idle_since - 1); // the ongoing wait
+    }
+    idle = idle < total ? idle : total;
+    metrics.idle = std::chrono::duration_cast<metrics_clock::duration>(std::chrono::nanoseconds(idle));
+    metrics.busy = std::chrono::duration_cast<metrics_clock::duration>(std::chrono::nanoseconds(total - idle));
+    return metrics;
+  }
+
+private:
+  active_metrics(const active_metrics&) = delete;
+  active_metrics& operator=(const active_metrics&) = delete;
+
+  static uint64_t nanoseconds(metrics_clock::duration duration) {
+    const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+  }
+
+  const metrics_clock::time_point started_;
+  std::atomic<uint64_t> taken_;
+  std::atomic<uint64_t> high_water_;
+  std::atomic<uint64_t> idle_ns_;
+  std::atomic<uint64_t> idle_since_ns_; // +1 since the start, 0 when not waiting
+  log_histogram wait_ns_;
+  log_histogram service_ns_;
+};
+} // end namespace kjellkod
+
+#endif
@@ -0,0 +1,59 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* ActiveOptions: everything Active::createActive can be told, the queue and
+* the thread that it starts. The defaults give the same Active as
+* createActive() without arguments.
+*
+* The thread settings are applied on Linux, on other platforms the thread
+* is a plain std::thread and they are ignored. */
+
+#ifndef ACTIVE_OPTIONS_H_
+#define ACTIVE_OPTIONS_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "overflow_policy.h"
+#include "wait_strategy.h"
+
+namespace kjellkod {
+
+/// Scheduling class of the thread. fifo and round_robin are real time
+/// classes and normally need privileges (CAP_SYS_NICE)
+enum class scheduling { inherit, normal, batch, idle, fifo, round_robin };
+
+struct ActiveOptions {
+  size_t capacity;              // max queued jobs per lane, see createActive
+  overflow_policy policy;
+  wait_strategy strategy;       // block, the other strategies burn cpu while idle
+
+  std::vector<unsigned> cpus;   // CPU affinity, empty: any cpu
+  int numa_node;                // -1: none. Memory is preferably allocated on the node and,
+                                // if 'cpus' is empty, the thread is kept on the node's cpus
+  std::string name;             // shown by top/perf, at most 15 characters are kept
+  size_t stack_size;            // bytes, 0: the platform default
+  scheduling sched;
+  int priority;                 // fifo and round_robin: 1-99, otherwise 0
+
+  size_t trace_capacity;        // jobs kept for dump_trace(), 0: no tracing.
+                                // Only with ACTIVE_TRACING, see active_trace.h
+
+  ActiveOptions()
+    : capacity(0)
+    , policy(overflow_policy::block)
+    , strategy(wait_strategy::block)
+    , numa_node(-1)
+    , stack_size(0)
+    , sched(scheduling::inherit)
+    , priority(0)
+    , trace_capacity(0) {}
+};
+
+} // end namespace kjellkod
+
+#endif
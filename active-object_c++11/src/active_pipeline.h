@@ -0,0 +1,410 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* ActivePipeline: a chain of stages, each stage a function In -> Out that
+* runs on its own Active. For processing like parse -> enrich -> persist
+*
+*   std::unique_ptr<ActivePipeline<std::string> > pipeline =
+*     PipelineBuilder<std::string>(1024)
+*       .stage("parse", &parse)            // std::string -> Record
+*       .stage("enrich", &enrich)          // Record -> Record
+*       .sink("persist", &persist);        // Record -> void
+*   pipeline->push(std::move(line));
+*
+* Each stage has its own bounded single producer, single consumer ring.
+* Payloads are moved from ring to ring, they are never copied and they do
+* not go through the Active's lanes. A lane only carries a wakeup, the
+* 'drain' job, and only when the stage is not already draining. A drain
+* takes up to c_drain_batch items before it sends itself again.
+*
+* Backpressure: a stage that finds the next ring full waits (yields) until
+* there is room. Its own ring then fills up, and so on up to push(), which
+* waits too. try_push() gives up instead.
+*
+* stats() shows each stage's throughput, how busy it is and how long it
+* was stalled by a full ring after it. The bottleneck is the busiest stage,
+* the stages before it are stalled, the stages after it are idle.
+*
+* The stage functions must not throw. An item type must be movable and
+* default constructible. Destruction drains the stages, first to last, so
+* every item that was pushed reaches the sink. */
+
+#ifndef ACTIVE_PIPELINE_H_
+#define ACTIVE_PIPELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "active.h"
+#include "active_metrics.h"
+#include "ring_queue.h"
+
+namespace kjellkod {
+
+struct PipelineStageStats {
+  std::string name;
+  uint64_t processed;
+  uint64_t queued;                  // items in the stage's ring
+  metrics_clock::duration busy;     // running the stage function
+  metrics_clock::duration stalled;  // waiting for room in the next stage's ring
+  double throughput;                // items per second since the start
+  double utilization;               // busy / time since the start, 0.0 - 1.0
+};
+
+struct PipelineStats {
+  std::vector<PipelineStageStats> stages;
+  size_t bottleneck;                // the stage with the highest utilization
+  metrics_clock::duration stalled;  // push() waiting for room in the first stage
+};
+
+template<typename In> class ActivePipeline;
+template<typename In, typename Tail> class PipelineBuilder;
+
+namespace pipeline_detail {
+
+inline uint64_t nanoseconds(metrics_clock::duration duration_) {
+  const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration_).count();
+  return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+}
+
+// single writer, no need for fetch_add
+inline void bump(std::atomic<uint64_t>& counter_, uint64_t value_) {
+  counter_.store(counter_.load(std::memory_order_relaxed) + value_, std::memory_order_relaxed);
+}
+
+
+class stage_base {
+public:
+  explicit stage_base(const ActiveOptions& options_)
+    : name_(options_.name)
+    , started_(metrics_clock::now())
+    , processed_(0)
+    , busy_ns_(0)
+    , stalled_ns_(0)
+    , active_(Active::createActive(options_))
+    , worker_(active_.get()) {}
+
+  virtual ~stage_base() {}
+
+  /// Drains the stage and stops its thread. The stage after it must still run
+  void stop() { active_.reset(); }
+
+  PipelineStageStats stats() const {
+    PipelineStageStats stats;
+    stats.name = name_;
+    stats.processed = processed_.load(std::memory_order_relaxed);
+    stats.queued = queued();
+    stats.busy = std::chrono::duration_cast<metrics_clock::duration>(
+                   std::chrono::nanoseconds(busy_ns_.load(std::memory_order_relaxed)));
+    stats.stalled = std::chrono::duration_cast<metrics_clock::duration>(
+                      std::chrono::nanoseconds(stalled_ns_.load(std::memory_order_relaxed)));
+    const double seconds = std::chrono::duration<double>(metrics_clock::now() - started_).count();
+    stats.throughput = seconds > 0 ? stats.processed / seconds : 0.0;
+    stats.utilization = seconds > 0 ? std::chrono::duration<double>(stats.busy).count() / seconds : 0.0;
+    stats.utilization = stats.utilization < 1.0 ? stats.utilization : 1.0;
+    return stats;
+  }
+
+protected:
+  virtual size_t queued() const = 0;
+
+  // one item in 'elapsed_', of which 'stalled_' waiting for the next stage
+  void record(metrics_clock::duration elapsed_, uint64_t stalled_) {
+    const uint64_t elapsed = nanoseconds(elapsed_);
+    bump(processed_, 1);
+    if (stalled_) {
+      bump(stalled_ns_, stalled_);
+    }
+    bump(busy_ns_, elapsed > stalled_ ? elapsed - stalled_ : 0);
+  }
+
+  const std::string name_;
+  const metrics_clock::time_point started_;
+  std::atomic<uint64_t> processed_;  // only written by the stage's thread
+  std::atomic<uint64_t> busy_ns_;
+  std::atomic<uint64_t> stalled_ns_;
+  std::unique_ptr<Active> active_;
+  Active* const worker_; // for the sends, also while ~Active drains and active_ is already null
+
+private:
+  stage_base(const stage_base&) = delete;
+  stage_base& operator=(const stage_base&) = delete;
+};
+
+
+/// The receiving side of a stage: its ring and the drain scheduling
+template<typename In>
+class stage_input : public stage_base {
+public:
+  static const size_t c_drain_batch = 256;
+
+  stage_input(const ActiveOptions& options_, size_t capacity)
+    : stage_base(options_)
+    , ring_(capacity)
+    , scheduled_(false) {}
+
+  /// Producer side, one thread: the stage before or the pipeline's push().
+  /// Waits while the ring is full
+  /// @return nanoseconds spent waiting for room, 0 if there was room
+  uint64_t push(In&& item_) {
+    if (try_push(std::move(item_))) {
+      return 0;
+    }
+    const metrics_clock::time_point start = metrics_clock::now();
+    do {
+      std::this_thread::yield();
+    } while (!try_push(std::move(item_)));
+    return nanoseconds(metrics_clock::now() - start);
+  }
+
+  /// 'item_' is only moved from if it was queued
+  bool try_push(In&& item_) {
+    if (!ring_.try_push(std::move(item_))) {
+      return false;
+    }
+    schedule();
+    return true;
+  }
+
+protected:
+  /// Runs the stage function on one item
+  /// @return nanoseconds stalled by the next stage
+  virtual uint64_t process(In&& item_) = 0;
+
+  size_t queued() const { return ring_.size(); }
+
+private:
+  struct Drain {
+    stage_input* stage;
+    void operator()() { stage->drain(); }
+  };
+
+  // The drain is sent when the flag is raised, the drain lowers it before it
+  // looks at the ring for the last time. The fences make sure that either
+  // the producer sees the flag lowered or the drain sees the item.
+  // The drain is forced into the lane: a drain lost to a full lane, with a
+  // reject or drop policy, would leave the flag raised and the stage stuck
+  void schedule() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!scheduled_.load(std::memory_order_relaxed) && !scheduled_.exchange(true, std::memory_order_acq_rel)) {
+      worker_->force_send(Drain{ this });
+    }
+  }
+
+  // The stats are updated per item, so that a long drain is seen while it runs
+  void drain() {
+    metrics_clock::time_point last = metrics_clock::now();
+    size_t items = 0;
+    In item;
+    for (;;) {
+      while (items < c_drain_batch && ring_.try_and_pop(item)) {
+        const uint64_t stalled = process(std::move(item));
+        const metrics_clock::time_point now = metrics_clock::now();
+        record(now - last, stalled);
+        last = now;
+        ++items;
+      }
+      if (items >= c_drain_batch) {
+        worker_->force_send(Drain{ this }); // still scheduled, other jobs get a turn
+        break;
+      }
+      scheduled_.store(false, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ring_.empty() || scheduled_.exchange(true, std::memory_order_acq_rel)) {
+        break;
+      }
+    }
+  }
+
+  spsc_ring_queue<In, no_parking> ring_; // woken through schedule(), not by the ring
+  std::atomic<bool> scheduled_;
+};
+
+template<typename In>
+const size_t stage_input<In>::c_drain_batch;
+
+
+template<typename In, typename Out, typename F>
+class stage : public stage_input<In> {
+public:
+  stage(const ActiveOptions& options_, size_t capacity, F func)
+    : stage_input<In>(options_, capacity)
+    , next(nullptr)
+    , func_(std::move(func)) {}
+
+  ~stage() { this->stop(); }
+
+  stage_input<Out>* next; // set when the next stage is added
+
+protected:
+  uint64_t process(In&& item_) { return next->push(func_(std::move(item_))); }
+
+private:
+  F func_;
+};
+
+/// The last stage
+template<typename In, typename F>
+class stage<In, void, F> : public stage_input<In> {
+public:
+  stage(const ActiveOptions& options_, size_t capacity, F func)
+    : stage_input<In>(options_, capacity)
+    , func_(std::move(func)) {}
+
+  ~stage() { this->stop(); }
+
+protected:
+  uint64_t process(In&& item_) {
+    func_(std::move(item_));
+    return 0;
+  }
+
+private:
+  F func_;
+};
+
+inline ActiveOptions named(const std::string& name_) {
+  ActiveOptions options;
+  options.name = name_;
+  return options;
+}
+} // pipeline_detail
+
+
+
+/** The built pipeline, see PipelineBuilder. Items of type In go in */
+template<typename In>
+class ActivePipeline {
+public:
+  /// Drains every stage, first to last
+  ~ActivePipeline() {
+    for (size_t idx = 0; idx < stages_.size(); ++idx) {
+      stages_[idx]->stop();
+    }
+  }
+
+  /// One producer thread at a time. Waits while the first stage is full
+  void push(In item_) {
+    pipeline_detail::bump(stalled_ns_, entry_->push(std::move(item_)));
+  }
+
+  /// Never waits, 'item_' is only moved from if it was queued
+  bool try_push(In&& item_) {
+    return entry_->try_push(std::move(item_));
+  }
+
+  size_t size() const { return stages_.size(); }
+
+  /// Can be called from any thread
+  PipelineStats stats() const {
+    PipelineStats stats;
+    stats.bottleneck = 0;
+    for (size_t idx = 0; idx < stages_.size(); ++idx) {
+      stats.stages.push_back(stages_[idx]->stats());
+      if (stats.stages[idx].utilization > stats.stages[stats.bottleneck].utilization) {
+        stats.bottleneck = idx;
+      }
+    }
+    stats.stalled = std::chrono::duration_cast<metrics_clock::duration>(
+                      std::chrono::nanoseconds(stalled_ns_.load(std::memory_order_relaxed)));
+    return stats;
+  }
+
+private:
+  template<typename, typename> friend class PipelineBuilder;
+
+  ActivePipeline() : entry_(nullptr), stalled_ns_(0) {}
+  ActivePipeline(const ActivePipeline&) = delete;
+  ActivePipeline& operator=(const ActivePipeline&) = delete;
+
+  std::vector<std::unique_ptr<pipeline_detail::stage_base> > stages_;
+  pipeline_detail::stage_input<In>* entry_;
+  std::atomic<uint64_t> stalled_ns_; // only written by the producer
+};
+
+
+
+/** Adds the stages in order, each stage's input is the previous stage's
+* output. 'Tail' is the type that comes out of the stages added so far.
+* Every stage gets a ring of 'capacity' items, rounded up to a power of two */
+template<typename In, typename Tail = In>
+class PipelineBuilder {
+public:
+  explicit PipelineBuilder(size_t capacity = 1024)
+    : pipeline_(new ActivePipeline<In>)
+    , next_(&pipeline_->entry_)
+    , capacity_(capacity) {}
+
+  PipelineBuilder(PipelineBuilder&& other)
+    : pipeline_(std::move(other.pipeline_))
+    , next_(other.next_)
+    , capacity_(other.capacity_) {}
+
+  /// A stage Tail -> Out on its own Active, the options are for its thread
+  template<typename F>
+  PipelineBuilder<In, typename std::result_of<F(Tail)>::type> stage(const ActiveOptions& options_, F func_) {
+    typedef typename std::result_of<F(Tail)>::type Out;
+    static_assert(!std::is_void<Out>::value, "the last stage is added with sink()");
+    std::unique_ptr<pipeline_detail::stage<Tail, Out, F> > added(
+      new pipeline_detail::stage<Tail, Out, F>(options_, capacity_, std::move(func_)));
+    pipeline_detail::stage_input<Out>** next = &added->next;
+    add(std::move(added));
+    return PipelineBuilder<In, Out>(std::move(pipeline_), next, capacity_);
+  }
+
+  /// As above, 'name_' is the stage's name in the stats and its thread name
+  template<typename F>
+  PipelineBuilder<In, typename std::result_of<F(Tail)>::type> stage(const std::string& name_, F func_) {
+    return stage(pipeline_detail::named(name_), std::move(func_));
+  }
+
+  /// The last stage, Tail -> void
+  template<typename F>
+  std::unique_ptr<ActivePipeline<In> > sink(const ActiveOptions& options_, F func_) {
+    std::unique_ptr<pipeline_detail::stage<Tail, void, F> > added(
+      new pipeline_detail::stage<Tail, void, F>(options_, capacity_, std::move(func_)));
+    add(std::move(added));
+    return std::move(pipeline_);
+  }
+
+  template<typename F>
+  std::unique_ptr<ActivePipeline<In> > sink(const std::string& name_, F func_) {
+    return sink(pipeline_detail::named(name_), std::move(func_));
+  }
+
+private:
+  template<typename, typename> friend class PipelineBuilder;
+
+  PipelineBuilder(std::unique_ptr<ActivePipeline<In> > pipeline, pipeline_detail::stage_input<Tail>** next,
+                  size_t capacity)
+    : pipeline_(std::move(pipeline))
+    , next_(next)
+    , capacity_(capacity) {}
+
+  PipelineBuilder(const PipelineBuilder&) = delete;
+  PipelineBuilder& operator=(const PipelineBuilder&) = delete;
+
+  template<typename Stage>
+  void add(std::unique_ptr<Stage> added_) {
+    *next_ = added_.get();
+    pipeline_->stages_.push_back(std::unique_ptr<pipeline_detail::stage_base>(added_.release()));
+  }
+
+  std::unique_ptr<ActivePipeline<In> > pipeline_;
+  pipeline_detail::stage_input<Tail>** next_; // where the next stage is hooked in
+  size_t capacity_;
+};
+} // end namespace kjellkod
+
+#endif
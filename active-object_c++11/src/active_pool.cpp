@@ -0,0 +1,190 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* ActivePool, N background threads with work stealing. See active_pool.h */
+
+#include "active_pool.h"
+
+#include <queue>
+
+using namespace kjellkod;
+
+namespace {
+// The pool, and worker index, that the calling thread belongs to.
+// Jobs sent from a pool thread go to its own deque
+struct WorkerIdentity {
+  const ActivePool* pool;
+  unsigned index;
+};
+thread_local WorkerIdentity t_identity = { nullptr, 0 };
+} // anonymous
+
+
+ActivePool::ActivePool(unsigned nbr_workers_)
+  : next_inbox_(0)
+  , wake_seq_(0)
+  , pending_(0)
+  , done_(false)
+  , sleepers_(0) {
+  for (unsigned idx = 0; idx < nbr_workers_; ++idx) {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker));
+  }
+}
+
+
+// Drain: every job, also the ones sent by jobs, is done before the threads exit
+ActivePool::~ActivePool() {
+  done_.store(true);
+  {
+    std::lock_guard<std::mutex> lock(idle_m_);
+    idle_cond_.notify_all();
+  }
+  for (size_t idx = 0; idx < workers_.size(); ++idx) {
+    workers_[idx]->thd.join();
+  }
+}
+
+
+// Add asynchronously a work-message to the pool. A job from outside the
+// pool is queued by value, its node is only made by the worker that takes it
+bool ActivePool::send(Job msg_) {
+  pending_.fetch_add(1);
+  if (this == t_identity.pool) {
+    workers_[t_identity.index]->deque.push(makeNode(std::move(msg_)));
+  } else {
+    unsigned index = next_inbox_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    if (!workers_[index]->inbox.push(std::move(msg_))) {
+      pending_.fetch_sub(1);
+      return false;
+    }
+  }
+  wakeOne();
+  return true;
+}
+
+
+// Eventcount: the sequence is bumped AFTER the jobs can be found, a worker
+// reads it BEFORE it looks for them. Both sides are seq_cst, so either the
+// worker sees the new sequence, or this sees the worker in sleepers_ and
+// notifies it under the lock that it waits with
+void ActivePool::wakeOne() {
+  wake_seq_.fetch_add(1);
+  if (sleepers_.load() > 0) {
+    std::lock_guard<std::mutex> lock(idle_m_);
+    idle_cond_.notify_one();
+  }
+}
+
+
+// Swap-and-drain of the inbox into the deque where it can be stolen
+// @return the first job in the inbox (FIFO), or nullptr if it was empty
+ActivePool::JobNode* ActivePool::moveInboxToDeque(Worker& worker_) {
+  std::queue<Job> batch;
+  if (!worker_.inbox.try_and_pop_all(batch)) {
+    return nullptr;
+  }
+  JobNode* first = makeNode(std::move(batch.front()));
+  batch.pop();
+  if (batch.empty()) {
+    return first;
+  }
+  // pushed in reverse: the owner pops from the bottom, i.e. in FIFO order,
+  // while thieves take from the top, i.e. the last sent jobs
+  std::vector<JobNode*> rest;
+  rest.reserve(batch.size());
+  while (!batch.empty()) {
+    rest.push_back(makeNode(std::move(batch.front())));
+    batch.pop();
+  }
+  for (size_t idx = rest.size(); idx > 0; --idx) {
+    worker_.deque.push(rest[idx - 1]);
+  }
+  wakeOne(); // a sleeping worker can steal them
+  return first;
+}
+
+
+// Own deque, own inbox, then steal from the others' deques and inboxes
+ActivePool::JobNode* ActivePool::findWork(unsigned index_) {
+  Worker& self = *workers_[index_];
+  JobNode* job = nullptr;
+  if (self.deque.pop(job)) {
+    return job;
+  }
+  job = moveInboxToDeque(self);
+  if (job) {
+    return job;
+  }
+
+  const size_t nbr_workers = workers_.size();
+  for (size_t offset = 1; offset < nbr_workers; ++offset) {
+    Worker& victim = *workers_[(index_ + offset) % nbr_workers];
+    work_stealing_deque<JobNode*>::StealResult result;
+    while (work_stealing_deque<JobNode*>::c_lost_race == (result = victim.deque.steal(job))) {}
+    if (work_stealing_deque<JobNode*>::c_stolen == result) {
+      return job;
+    }
+    Job stolen;
+    if (victim.inbox.try_and_pop(stolen)) {
+      return makeNode(std::move(stolen));
+    }
+  }
+  return nullptr;
+}
+
+
+// the node goes back to the pool of the worker that made it
+void ActivePool::execute(JobNode* job_) {
+  (*job_->value())();
+  message_pool<Job>::release(job_);
+  if (1 == pending_.fetch_sub(1) && done_.load()) {
+    // the last job is finished, tell the sleeping workers to exit
+    std::lock_guard<std::mutex> lock(idle_m_);
+    idle_cond_.notify_all();
+  }
+}
+
+
+// A worker that found nothing sleeps until the sequence moves, it does not
+// spin while jobs are executing, or are held, by other workers
+void ActivePool::run(unsigned index_) {
+  t_identity.pool = this;
+  t_identity.index = index_;
+  for (;;) {
+    const uint64_t seq = wake_seq_.load();
+    JobNode* job = findWork(index_);
+    if (job) {
+      execute(job);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(idle_m_);
+    sleepers_.fetch_add(1);
+    while (seq == wake_seq_.load() && !(done_.load() && 0 == pending_.load())) {
+      idle_cond_.wait(lock);
+    }
+    sleepers_.fetch_sub(1);
+    if (done_.load() && 0 == pending_.load()) {
+      return;
+    }
+  }
+}
+
+
+// Factory: safe construction of object before thread start
+std::unique_ptr<ActivePool> ActivePool::createActivePool(unsigned nbr_workers_) {
+  if (0 == nbr_workers_) {
+    nbr_workers_ = std::thread::hardware_concurrency();
+  }
+  if (0 == nbr_workers_) {
+    nbr_workers_ = 1;
+  }
+  std::unique_ptr<ActivePool> pool(new ActivePool(nbr_workers_));
+  for (unsigned idx = 0; idx < nbr_workers_; ++idx) {
+    pool->workers_[idx]->thd = std::thread(&ActivePool::run, pool.get(), idx);
+  }
+  return pool;
+}
@@ -0,0 +1,95 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* ActivePool: the same send(Job) interface as the Active object but backed
+* by N background threads, for CPU heavy jobs that should use more than
+* one core. There is NO ordering guarantee between jobs, use an Active
+* (or a ShardedActive) when the FIFO order matters.
+*
+* Each worker has its own Chase-Lev work stealing deque plus an inbox.
+*  - Jobs sent from outside the pool go round-robin to the workers' inboxes
+*  - Jobs sent from a job running in the pool go to that worker's own deque
+*  - A worker moves its whole inbox to its deque (swap-and-drain) and works
+*    off the deque. Idle workers steal from the top of the other deques,
+*    and from the other inboxes, before they go to sleep
+*
+* The deques hold pointers, a thief reads a slot that the owner may write.
+* The Job nodes come from the message_pool of the worker that made them
+* and go back to it from whichever worker ran the job, so a send does not
+* allocate in a steady state. A worker that finds nothing sleeps until
+* the next send, or until another worker has put jobs in its deque
+*
+* Destruction drains the pool the same way as ~Active: every job that was
+* sent, also jobs sent by jobs, is executed before the threads exit. */
+
+#ifndef ACTIVE_POOL_H_
+#define ACTIVE_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "active.h"
+#include "message_pool.h"
+#include "shared_queue.h"
+#include "work_stealing_deque.h"
+
+namespace kjellkod {
+
+class ActivePool {
+private:
+  typedef message_pool<Job>::Node JobNode;
+
+  struct Worker {
+    work_stealing_deque<JobNode*> deque;
+    shared_queue<Job> inbox;
+    std::thread thd;
+  };
+
+  ActivePool(const ActivePool&) = delete;
+  ActivePool& operator=(const ActivePool&) = delete;
+
+  explicit ActivePool(unsigned nbr_workers_); // Construction ONLY through factory createActivePool();
+
+  static JobNode* makeNode(Job&& job_) { return message_pool<Job>::local().acquire(std::move(job_)); }
+
+  void run(unsigned index_);
+  JobNode* findWork(unsigned index_);
+  JobNode* moveInboxToDeque(Worker& worker_);
+  void execute(JobNode* job_);
+  void wakeOne();
+
+  std::vector<std::unique_ptr<Worker> > workers_;
+  std::atomic<unsigned> next_inbox_;   // round-robin for sends from outside the pool
+  std::atomic<uint64_t> wake_seq_;     // bumped after jobs are made stealable, see run()
+  std::atomic<long> pending_;          // sent but not yet finished
+  std::atomic<bool> done_;             // set by ~ActivePool
+  std::atomic<unsigned> sleepers_;
+  std::mutex idle_m_;
+  std::condition_variable idle_cond_;
+
+public:
+  virtual ~ActivePool();
+  /// @return false if the job was not enqueued, as Active::send
+  bool send(Job msg_);
+
+  /// Request/response job, see Active::call
+  template<typename F>
+  active_future<typename std::result_of<F()>::type> call(F func) {
+    return call_on(*this, std::move(func));
+  }
+
+  unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+  /// Factory: safe construction & thread start. Zero workers means one per hardware thread
+  static std::unique_ptr<ActivePool> createActivePool(unsigned nbr_workers_ = 0);
+};
+} // end namespace kjellkod
+
+#endif
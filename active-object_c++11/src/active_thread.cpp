@@ -0,0 +1,185 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================*/
+
+#include "active_thread.h"
+
+#include <fstream>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+#if defined(__linux__)
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+using namespace kjellkod;
+
+namespace {
+#if defined(__linux__)
+struct StartData {
+  std::function<void()> body;
+  int numa_node;
+  scheduling sched;
+  int priority;
+  std::promise<int> started; // 0 or the error of the thread settings
+};
+
+void throwOnError(int error_, const char* what_) {
+  if (0 != error_) {
+    throw std::system_error(error_, std::system_category(), what_);
+  }
+}
+
+// best effort, the thread runs also if the node is unknown
+void preferNumaNode(int node_) {
+  const size_t c_bits = sizeof(unsigned long) * 8;
+  std::vector<unsigned long> mask(node_ / c_bits + 1, 0);
+  mask[node_ / c_bits] |= 1UL << (node_ % c_bits);
+  syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * c_bits + 1);
+}
+
+int schedPolicyOf(scheduling sched_) {
+  switch (sched_) {
+  case scheduling::batch: return SCHED_BATCH;
+  case scheduling::idle: return SCHED_IDLE;
+  case scheduling::fifo: return SCHED_FIFO;
+  case scheduling::round_robin: return SCHED_RR;
+  default: return SCHED_OTHER;
+  }
+}
+
+// The scheduling class is set by the thread itself, pthread attributes
+// do not take SCHED_BATCH and SCHED_IDLE
+void* threadMain(void* start_) {
+  std::unique_ptr<StartData> start(static_cast<StartData*>(start_));
+  if (scheduling::inherit != start->sched) {
+    sched_param parameters = sched_param();
+    parameters.sched_priority = start->priority;
+    const int error = pthread_setschedparam(pthread_self(), schedPolicyOf(start->sched), &parameters);
+    if (0 != error) {
+      start->started.set_value(error);
+      return nullptr;
+    }
+  }
+  if (start->numa_node >= 0) {
+    preferNumaNode(start->numa_node);
+  }
+  std::function<void()> body = std::move(start->body);
+  start->started.set_value(0);
+  start.reset();
+  body();
+  return nullptr;
+}
+
+#endif
+} // anonymous
+
+
+active_thread::active_thread()
+#if defined(__linux__)
+  : started_(false)
+#endif
+{}
+
+active_thread::~active_thread() {}
+
+#if defined(__linux__)
+void active_thread::start(const ActiveOptions& options_, std::function<void()> body_) {
+  pthread_attr_t attributes;
+  throwOnError(pthread_attr_init(&attributes), "pthread_attr_init");
+  // destroys the attributes also when a setting throws
+  std::unique_ptr<pthread_attr_t, int (*)(pthread_attr_t*)> guard(&attributes, &pthread_attr_destroy);
+
+  if (0 != options_.stack_size) {
+    const size_t min_stack_size = static_cast<size_t>(PTHREAD_STACK_MIN); // a long, or a sysconf call
+    const size_t stack_size = options_.stack_size < min_stack_size ? min_stack_size : options_.stack_size;
+    throwOnError(pthread_attr_setstacksize(&attributes, stack_size), "stack size");
+  }
+
+  const std::vector<unsigned> cpus = options_.cpus.empty() && options_.numa_node >= 0
+                                     ? cpusOfNumaNode(options_.numa_node) : options_.cpus;
+  if (!cpus.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (size_t idx = 0; idx < cpus.size(); ++idx) {
+      CPU_SET(cpus[idx], &cpu_set);
+    }
+    throwOnError(pthread_attr_setaffinity_np(&attributes, sizeof(cpu_set), &cpu_set), "cpu affinity");
+  }
+
+  StartData* start = new StartData();
+  start->body = std::move(body_);
+  start->numa_node = options_.numa_node;
+  start->sched = options_.sched;
+  start->priority = options_.priority;
+  std::future<int> started = start->started.get_future();
+  const int error = pthread_create(&thread_, &attributes, &threadMain, start);
+  if (0 != error) {
+    delete start;
+    throwOnError(error, "pthread_create");
+  }
+  const int settings_error = started.get();
+  if (0 != settings_error) {
+    pthread_join(thread_, nullptr);
+    throwOnError(settings_error, "scheduling");
+  }
+  started_ = true;
+
+  if (!options_.name.empty()) {
+    pthread_setname_np(thread_, options_.name.substr(0, 15).c_str());
+  }
+}
+
+void active_thread::join() {
+  if (started_) {
+    pthread_join(thread_, nullptr);
+    started_ = false;
+  }
+}
+
+std::vector<unsigned> kjellkod::cpusOfNumaNode(int node_) {
+  std::vector<unsigned> cpus;
+  std::ostringstream path;
+  path << "/sys/devices/system/node/node" << node_ << "/cpulist";
+  std::ifstream cpulist(path.str().c_str());
+  std::string range;
+  // e.g. "0-3,8-11"
+  while (std::getline(cpulist, range, ',')) {
+    std::istringstream parse(range);
+    unsigned first = 0, last = 0;
+    char dash = 0;
+    if (!(parse >> first)) {
+      continue;
+    }
+    last = (parse >> dash >> last) ? last : first;
+    for (unsigned cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+#else
+void active_thread::start(const ActiveOptions&, std::function<void()> body_) {
+  thread_ = std::thread(std::move(body_));
+}
+
+void active_thread::join() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+std::vector<unsigned> kjellkod::cpusOfNumaNode(int) {
+  return std::vector<unsigned>();
+}
+#endif
@@ -0,0 +1,51 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* The Active's thread. std::thread cannot be given a stack size or a
+* scheduling class before it starts so on Linux the thread is started with
+* pthread_create and the ActiveOptions' attributes. */
+
+#ifndef ACTIVE_THREAD_H_
+#define ACTIVE_THREAD_H_
+
+#include <functional>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+#include "active_options.h"
+
+namespace kjellkod {
+
+class active_thread {
+#if defined(__linux__)
+  pthread_t thread_;
+  bool started_;
+#else
+  std::thread thread_;
+#endif
+
+  active_thread(const active_thread&) = delete;
+  active_thread& operator=(const active_thread&) = delete;
+
+public:
+  active_thread();
+  ~active_thread(); // must be joined before
+
+  /// @throw std::system_error if the thread could not be started with
+  ///        'options_', e.g. a real time class without the privileges
+  void start(const ActiveOptions& options_, std::function<void()> body_);
+  void join();
+};
+
+/// The cpus of a NUMA node, empty if unknown (or not Linux)
+std::vector<unsigned> cpusOfNumaNode(int node_);
+
+} // end namespace kjellkod
+
+#endif
@@ -0,0 +1,168 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================*/
+
+#include "active_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+using namespace kjellkod;
+
+namespace {
+// all time stamps are relative to the first use, the trace starts near 0
+trace_clock::time_point epoch() {
+  static const trace_clock::time_point start = trace_clock::now();
+  return start;
+}
+
+uint64_t sinceEpoch(trace_clock::time_point when_) {
+  const long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when_ - epoch()).count();
+  return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+}
+
+// the trace's time unit is microseconds
+void writeTime(std::ostream& out_, uint64_t ns_) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%llu.%03u", static_cast<unsigned long long>(ns_ / 1000),
+                static_cast<unsigned>(ns_ % 1000));
+  out_ << buffer;
+}
+
+void writeString(std::ostream& out_, const char* text_) {
+  out_ << '"';
+  for (const char* c = text_; *c; ++c) {
+    if ('"' == *c || '\\' == *c) {
+      out_ << '\\' << *c;
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(*c));
+      out_ << escaped;
+    } else {
+      out_ << *c;
+    }
+  }
+  out_ << '"';
+}
+
+void separate(std::ostream& out_, bool& first_) {
+  if (!first_) {
+    out_ << ",\n";
+  }
+  first_ = false;
+}
+
+std::mutex g_registry_lock;
+std::vector<std::shared_ptr<trace_ring> > g_registry;
+std::atomic<uint32_t> g_next_tid(1);
+} // anonymous
+
+
+uint32_t kjellkod::trace_thread_id() {
+  thread_local uint32_t tid = g_next_tid.fetch_add(1, std::memory_order_relaxed);
+  return tid;
+}
+
+
+trace_ring::trace_ring(size_t capacity, const std::string& name)
+  : name_(name)
+  , tid_(0)
+  , head_(0)
+  , slots_(capacity ? capacity : 1) {
+  epoch();
+}
+
+void trace_ring::record(const char* label_, uint32_t producer_, trace_clock::time_point enqueued_,
+                        trace_clock::time_point dequeued_, trace_clock::time_point started_,
+                        trace_clock::time_point ended_) {
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  Slot& slot = slots_[head % slots_.size()];
+  const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.label.store(label_, std::memory_order_relaxed);
+  slot.producer.store(producer_, std::memory_order_relaxed);
+  slot.enqueued.store(sinceEpoch(enqueued_), std::memory_order_relaxed);
+  slot.dequeued.store(sinceEpoch(dequeued_), std::memory_order_relaxed);
+  slot.started.store(sinceEpoch(started_), std::memory_order_relaxed);
+  slot.ended.store(sinceEpoch(ended_), std::memory_order_relaxed);
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+  head_.store(head + 1, std::memory_order_release);
+}
+
+void trace_ring::dump(std::ostream& out_, bool& first_) const {
+  const uint32_t tid = tid_.load(std::memory_order_relaxed);
+  separate(out_, first_);
+  out_ << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid << ", \"args\": {\"name\": ";
+  writeString(out_, name_.c_str());
+  out_ << "}}";
+
+  const uint64_t head = head_.load(std::memory_order_acquire);
+  const uint64_t first = head > slots_.size() ? head - slots_.size() : 0;
+  for (uint64_t job = first; job < head; ++job) {
+    const Slot& slot = slots_[job % slots_.size()];
+    const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    const char* label = slot.label.load(std::memory_order_relaxed);
+    const uint32_t producer = slot.producer.load(std::memory_order_relaxed);
+    const uint64_t enqueued = slot.enqueued.load(std::memory_order_relaxed);
+    const uint64_t dequeued = slot.dequeued.load(std::memory_order_relaxed);
+    const uint64_t started = slot.started.load(std::memory_order_relaxed);
+    const uint64_t ended = slot.ended.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (before != 2 * (job / slots_.size() + 1) || before != slot.sequence.load(std::memory_order_relaxed)) {
+      continue; // overwritten before or while read
+    }
+    if (!label) {
+      label = "job";
+    }
+
+    separate(out_, first_);
+    out_ << "{\"name\": ";
+    writeString(out_, label);
+    out_ << ", \"cat\": \"job\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid << ", \"ts\": ";
+    writeTime(out_, started);
+    out_ << ", \"dur\": ";
+    writeTime(out_, ended - started);
+    out_ << ", \"args\": {\"job\": " << job << ", \"producer\": " << producer << "}}";
+
+    // the time in the lane, async so that the jobs in a lane can overlap
+    const char* c_phases[] = { "b", "n", "e" };
+    const uint64_t c_times[] = { enqueued, dequeued, started };
+    for (unsigned phase = 0; phase < 3; ++phase) {
+      separate(out_, first_);
+      out_ << "{\"name\": " << (1 == phase ? "\"dequeue\"" : "\"queued\"")
+           << ", \"cat\": \"lane\", \"ph\": \"" << c_phases[phase] << "\", \"id\": \"" << tid << ":" << job
+           << "\", \"pid\": 1, \"tid\": " << producer << ", \"ts\": ";
+      writeTime(out_, c_times[phase]);
+      out_ << "}";
+    }
+  }
+}
+
+
+void kjellkod::register_trace(const std::shared_ptr<trace_ring>& ring_) {
+  std::lock_guard<std::mutex> lock(g_registry_lock);
+  g_registry.push_back(ring_);
+}
+
+void kjellkod::unregister_trace(const std::shared_ptr<trace_ring>& ring_) {
+  std::lock_guard<std::mutex> lock(g_registry_lock);
+  g_registry.erase(std::remove(g_registry.begin(), g_registry.end(), ring_), g_registry.end());
+}
+
+void kjellkod::dump_trace(std::ostream& out_) {
+  std::vector<std::shared_ptr<trace_ring> > rings;
+  {
+    std::lock_guard<std::mutex> lock(g_registry_lock);
+    rings = g_registry;
+  }
+  bool first = true;
+  out_ << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+  for (size_t idx = 0; idx < rings.size(); ++idx) {
+    rings[idx]->dump(out_, first);
+  }
+  out_ << "\n]}\n";
+}
@@ -0,0 +1,94 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Job tracing, a timeline of what the Actives did: when each job was sent,
+* taken from its lane, started and finished, and by which threads.
+*
+* Tracing is compiled in with ACTIVE_TRACING (cmake -DUSE_ACTIVE_TRACING=ON)
+* and switched on per Active with ActiveOptions::trace_capacity. Without it
+* the Active's send and run are exactly as before. With it, an Active that
+* is not traced pays one null check per send: the label and the producer
+* are only added, in a pooled stamp around the job, for a traced Active.
+*
+* Each traced Active owns a trace_ring, written only by its own thread, that
+* keeps the last 'capacity' jobs. It is lock-free: a slot is guarded by a
+* sequence number (seqlock) so dump_trace() can read it from any thread,
+* also while the Active is stuck in a job, which is when a timeline is
+* needed the most.
+*
+* dump_trace() writes the rings of all live Actives as Chrome trace-event
+* JSON, open it with https://ui.perfetto.dev or chrome://tracing. A job is
+* a slice on its Active's thread, the time in the lane is an async slice
+* from the send to the start, with the dequeue as an instant in between */
+
+#ifndef ACTIVE_TRACE_H_
+#define ACTIVE_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace kjellkod {
+typedef std::chrono::steady_clock trace_clock;
+
+/// Small number for the calling thread, the 'tid' in the trace
+uint32_t trace_thread_id();
+
+class trace_ring {
+public:
+  /// @param capacity number of jobs that are kept, the oldest are overwritten
+  /// @param name shown as the thread name in the trace
+  trace_ring(size_t capacity, const std::string& name);
+
+  /// Called once by the thread that records
+  void set_thread(uint32_t tid) { tid_.store(tid, std::memory_order_relaxed); }
+
+  /// Writer side, single thread
+  void record(const char* label_, uint32_t producer_, trace_clock::time_point enqueued_,
+              trace_clock::time_point dequeued_, trace_clock::time_point started_, trace_clock::time_point ended_);
+
+  /// Reader side, any thread. Writes the recorded jobs as trace events,
+  /// each preceded by a comma unless 'first_' is true
+  void dump(std::ostream& out_, bool& first_) const;
+
+  /// number of jobs recorded since the start, also those overwritten
+  uint64_t recorded() const { return head_.load(std::memory_order_acquire); }
+
+private:
+  trace_ring(const trace_ring&) = delete;
+  trace_ring& operator=(const trace_ring&) = delete;
+
+  struct Slot {
+    std::atomic<uint64_t> sequence; // odd while written, 2 * laps when written
+    std::atomic<const char*> label;
+    std::atomic<uint32_t> producer;
+    std::atomic<uint64_t> enqueued; // ns since the trace epoch
+    std::atomic<uint64_t> dequeued;
+    std::atomic<uint64_t> started;
+    std::atomic<uint64_t> ended;
+    Slot() : sequence(0), label(nullptr), producer(0), enqueued(0), dequeued(0), started(0), ended(0) {}
+  };
+
+  const std::string name_;
+  std::atomic<uint32_t> tid_;
+  std::atomic<uint64_t> head_;
+  std::vector<Slot> slots_;
+};
+
+/// An Active's ring is registered while the Active lives
+void register_trace(const std::shared_ptr<trace_ring>& ring_);
+void unregister_trace(const std::shared_ptr<trace_ring>& ring_);
+
+/// Chrome trace-event JSON of all the registered rings
+void dump_trace(std::ostream& out_);
+} // end namespace kjellkod
+
+#endif
@@ -8,13 +8,33 @@
 * to process jobs in the background.
 * Calling the Background worker to do a job is an asynchronous call, returning 
 * almost immediately. The Backgrounder will create a job and push it onto a 
-* queue that is processed in FIFO order by the Active object. */
+* queue that is processed in FIFO order by the Active object.
+*
+* The payload of a job is taken from the producer thread's message_pool and
+* is recycled when the job is done, i.e. there are no allocations per job in
+* a steady state.
+*
+* In batching mode the values are instead appended to a producer side buffer.
+* A full buffer, or one that has waited 'maxLatency', is handed to the
+* background thread as ONE job and stored with one bulk insert.
+*
+* In spill mode the values are pushed to a spill_queue, past its memory
+* part they wait in a memory-mapped journal on disk, and one drain job
+* stores whatever is queued. A producer that outruns a slow store is not
+* blocked and the memory stays bounded, see spill_queue.h */
 
 #include <vector>
 #include <chrono>
 #include <memory>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <cstdint>
+#include <atomic>
 
 #include "active.h"
+#include "message_pool.h"
+#include "spill_queue.h"
 
 
 /// Silly test background worker that only receives dummy encapsuled data  and stores them in a vector
@@ -26,6 +46,28 @@ private:
   std::unique_ptr<kjellkod::Active> active;
   std::vector<T>& receivedQ;
   unsigned int c_processTimeUs; // to fake processing time, in microseconds
+  bool usePool;                 // payloads from the message_pool, or one shared_ptr per job
+
+  // batching mode, the buffer is shared by the producers and the timer flush
+  const size_t maxBatch;        // 1: no batching, one job per value
+  const std::chrono::microseconds maxLatency;
+  std::mutex bufferLock;
+  std::vector<T> buffer;
+  uint64_t nextSequence;        // given to each batch when it leaves the buffer
+  bool flushArmed;
+
+  // bg thread only. A timer flush can overtake a full batch that is about to
+  // be sent, the batches are stored in sequence order anyway
+  uint64_t storedSequence;
+  std::map<uint64_t, std::vector<T>> early;
+  std::atomic<size_t> storedCount; // written by the bg thread only, see stored()
+
+#if defined(__unix__)
+  // spill mode, the values wait in the spill queue and at most one drain
+  // job is queued for them
+  std::unique_ptr<kjellkod::spill_queue<T>> spillQ;
+  std::atomic<bool> drainScheduled;
+#endif
 
   // Container for faking some imporant stuff type instead of a dummy value
   // so that it 'makes sense' storing it in an unique_ptr
@@ -34,26 +76,268 @@ private:
     const T value;
   };
 
+  // fake processing time, none if set to 0
+  void fakeProcessing(){
+    if(c_processTimeUs != 0){
+      std::this_thread::sleep_for(std::chrono::microseconds(c_processTimeUs));
+    }
+  }
+
+  // after the values are in receivedQ, so that stored() readers see them
+  void bgStored(size_t count_){
+    storedCount.store(storedCount.load(std::memory_order_relaxed) + count_, std::memory_order_release);
+  }
+
   // bg processing, FAKING that each job takes a  few ms
   void bgStoreData(std::shared_ptr<Data> msg_){
     receivedQ.push_back(msg_->value);
-    // fake processing time
-    std::this_thread::sleep_for(std::chrono::microseconds(c_processTimeUs));
+    bgStored(1);
+    fakeProcessing();
+  }
+
+  // the Job for a pooled payload, the payload goes back to its pool with the Job
+  struct StoreOne {
+    Backgrounder* self;
+    kjellkod::pooled<Data> msg;
+    void operator()() {
+      self->receivedQ.push_back(msg->value);
+      self->bgStored(1);
+      self->fakeProcessing();
+    }
+  };
+
+  // bg processing of a contiguous span, one bulk insert
+  void bgStoreSpan(const T* first_, size_t count_){
+    receivedQ.insert(receivedQ.end(), first_, first_ + count_);
+    bgStored(count_);
+    fakeProcessing();
+  }
+
+  void bgStoreBatch(uint64_t sequence_, std::vector<T>& batch_){
+    if(sequence_ != storedSequence){
+      early[sequence_].swap(batch_);
+      return;
+    }
+    bgStoreSpan(batch_.data(), batch_.size());
+    ++storedSequence;
+    typename std::map<uint64_t, std::vector<T>>::iterator next = early.begin();
+    while(next != early.end() && next->first == storedSequence){
+      bgStoreSpan(next->second.data(), next->second.size());
+      ++storedSequence;
+      next = early.erase(next);
+    }
+  }
+
+  // the Job, move-only so that the batch is never copied
+  struct StoreBatch {
+    Backgrounder* self;
+    uint64_t sequence;
+    std::vector<T> batch;
+    void operator()() { self->bgStoreBatch(sequence, batch); }
+  };
+
+  // bufferLock must be held
+  StoreBatch takeBuffer(){
+    StoreBatch job = { this, nextSequence++, std::vector<T>() };
+    job.batch.swap(buffer);
+    buffer.reserve(maxBatch);
+    return job;
+  }
+
+  // bg thread, the 'maxLatency' timer
+  void bgFlush(){
+    std::unique_lock<std::mutex> lock(bufferLock);
+    flushArmed = false;
+    if(buffer.empty()){
+      return;
+    }
+    StoreBatch job = takeBuffer();
+    lock.unlock();
+    job();
+  }
+
+#if defined(__unix__)
+  // bg thread. The flag is lowered before the queue is read: a value pushed
+  // after the last read below sees it lowered and sends the next drain
+  void bgDrain(){
+    drainScheduled.store(false, std::memory_order_seq_cst);
+    std::queue<T> values;
+    while(spillQ->try_and_pop_all(values)){
+      const size_t count = values.size();
+      for(; !values.empty(); values.pop()){
+        receivedQ.push_back(std::move(values.front()));
+      }
+      bgStored(count);
+      fakeProcessing();
+    }
+  }
+
+  void scheduleDrain(){
+    if(!drainScheduled.exchange(true, std::memory_order_seq_cst)){
+      active->send(std::bind(&Backgrounder::bgDrain, this));
+    }
+  }
+#endif
+
+  // batching mode: buffers the values, sends full batches and arms the
+  // flush timer when the buffer was empty
+  template<typename InputIt>
+  void buffered(InputIt first_, InputIt last_){
+    using namespace kjellkod;
+    std::vector<StoreBatch> full;
+    bool arm = false;
+    {
+      std::lock_guard<std::mutex> lock(bufferLock);
+      for(; first_ != last_; ++first_){
+        buffer.push_back(*first_);
+        if(buffer.size() >= maxBatch){
+          full.push_back(takeBuffer());
+        }
+      }
+      if(!buffer.empty() && !flushArmed){
+        flushArmed = arm = true;
+      }
+    }
+    for(size_t idx = 0; idx < full.size(); ++idx){
+      active->send(std::move(full[idx]));
+    }
+    if(arm){
+      active->send_after(maxLatency, std::bind(&Backgrounder::bgFlush, this));
+    }
   }
 
 public:
-  explicit Backgrounder(std::vector<T>& saveQ_)
-    : active(kjellkod::Active::createActive())
+  /// @param capacity_ 0 is an unbounded job queue, otherwise saveData blocks
+  ///        while the queue is full, i.e. memory stays bounded if bgStoreData is slow
+  /// @param maxBatch_ values per batch, 1 turns batching off
+  /// @param maxLatency_ max time that a value waits in a batch that is not full
+  explicit Backgrounder(std::vector<T>& saveQ_, size_t capacity_ = 0, size_t maxBatch_ = 1,
+                        std::chrono::microseconds maxLatency_ = std::chrono::microseconds(1000))
+    : active(kjellkod::Active::createActive(capacity_, overflow_policy::block))
     , receivedQ(saveQ_)
-    , c_processTimeUs(1){}
+    , c_processTimeUs(1)
+    , usePool(true)
+    , maxBatch(maxBatch_ ? maxBatch_ : 1)
+    , maxLatency(maxLatency_)
+    , nextSequence(0)
+    , flushArmed(false)
+    , storedSequence(0)
+    , storedCount(0)
+#if defined(__unix__)
+    , drainScheduled(false)
+#endif
+  {
+    buffer.reserve(maxBatch);
+  }
+
+  // the last, partial batch is flushed. The Active is gone before the
+  // buffer, which its thread may still touch, is destroyed
+  virtual ~Backgrounder(){
+    if(maxBatch > 1){
+      active->send(std::bind(&Backgrounder::bgFlush, this));
+    }
+    active.reset();
+  }
+
+  /// Fake processing time of each job (each batch in batching mode), 0 for
+  /// none. Set it before sending, the default is 1 us
+  void setProcessTime(std::chrono::microseconds processTime_){
+    c_processTimeUs = static_cast<unsigned int>(processTime_.count());
+  }
+
+  /// Payload storage of the one job per value mode: the message_pool
+  /// (default), or one std::shared_ptr per job. Set it before sending
+  void setPooled(bool pooled_){
+    usePool = pooled_;
+  }
 
-  virtual ~Backgrounder(){}
+#if defined(__unix__)
+  /// Spill mode: the values go through a spill_queue, with 'options_'.
+  /// It replaces the other modes. Set it before sending
+  /// @throw see spill_queue
+  void setSpill(const kjellkod::spill_options& options_){
+    spillQ.reset(new kjellkod::spill_queue<T>(options_));
+  }
+
+  /// values that wait in the spill journal on disk, 0 if not in spill mode
+  size_t spilled() const{
+    return spillQ ? spillQ->spilled() : 0;
+  }
+#endif
+
+  /// values stored in the save queue so far. Can be read while saving, without
+  /// touching the queue itself that the bg thread is still writing to
+  size_t stored() const{
+    return storedCount.load(std::memory_order_acquire);
+  }
+
+  /// Returns when all values saved before the call are stored, also the
+  /// ones still buffered in batching mode. The save queue can then be read
+  /// until the next saveData
+  void flush(){
+    if(maxBatch > 1){
+      active->send(std::bind(&Backgrounder::bgFlush, this));
+    }
+    active->flush();
+  }
+
+  /// runtime metrics of the Active, see ActiveMetrics
+  kjellkod::ActiveMetrics metrics() const{
+    return active->metrics();
+  }
 
   // Asynchronous msg API, for sending jobs for bg thread processing
   void saveData(const T value_){
     using namespace kjellkod;
+#if defined(__unix__)
+    if(spillQ){
+      spillQ->push(value_);
+      scheduleDrain();
+      return;
+    }
+#endif
+    if(maxBatch > 1){
+      buffered(&value_, &value_ + 1);
+      return;
+    }
+    if(usePool){
+      StoreOne job = { this, make_pooled<Data>(value_) };
+      active->send(std::move(job));
+      return;
+    }
     std::shared_ptr<Data> ptrBg(new Data(value_));
-    Callback func = std::bind(&Backgrounder::bgStoreData, this, ptrBg);
-    active->send(func);
+    // the bind expression is stored inline in the Job, no extra allocation
+    active->send(std::bind(&Backgrounder::bgStoreData, this, ptrBg));
+  }
+
+  // Same as saveData(value) for a whole batch, the jobs are handed over
+  // to the bg thread in one go
+  template<typename InputIt>
+  void saveData(InputIt first_, InputIt last_){
+    using namespace kjellkod;
+#if defined(__unix__)
+    if(spillQ){
+      for(; first_ != last_; ++first_){
+        spillQ->push(*first_);
+      }
+      scheduleDrain();
+      return;
+    }
+#endif
+    if(maxBatch > 1){
+      buffered(first_, last_);
+      return;
+    }
+    std::vector<Job> jobs;
+    for(; first_ != last_; ++first_){
+      if(usePool){
+        StoreOne job = { this, make_pooled<Data>(*first_) };
+        jobs.push_back(std::move(job));
+        continue;
+      }
+      std::shared_ptr<Data> ptrBg(new Data(*first_));
+      jobs.push_back(std::bind(&Backgrounder::bgStoreData, this, ptrBg));
+    }
+    active->send_bulk(std::make_move_iterator(jobs.begin()), std::make_move_iterator(jobs.end()));
   }
 };
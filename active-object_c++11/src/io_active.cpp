@@ -0,0 +1,182 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* IoActive, an Active that waits on an epoll set. See io_active.h */
+
+#include "io_active.h"
+
+#if defined(__linux__)
+
+#include <cerrno>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace kjellkod;
+
+namespace {
+void throwErrno(const char* what_) {
+  throw std::system_error(errno, std::system_category(), what_);
+}
+} // anonymous
+
+const int IoActive::c_max_events;
+
+
+IoActive::IoActive(const ActiveOptions& options_)
+  : queue_(options_.capacity, options_.policy)
+  , epoll_fd_(-1)
+  , wakeup_fd_(-1)
+  , sleeping_(0)
+  , done_(false) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (-1 == epoll_fd_) {
+    throwErrno("IoActive: epoll_create1");
+  }
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wakeup_fd_;
+  if (-1 == wakeup_fd_ || -1 == epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event)) {
+    const int error = errno;
+    if (-1 != wakeup_fd_) {
+      close(wakeup_fd_);
+    }
+    close(epoll_fd_);
+    throw std::system_error(error, std::system_category(), "IoActive: eventfd");
+  }
+}
+
+// tell thread to exit when the queue is drained
+IoActive::~IoActive() {
+  done_.store(true, std::memory_order_release);
+  wakeup();
+  thd_.join();
+  close(wakeup_fd_);
+  close(epoll_fd_);
+}
+
+// Same protocol as parking_spot::notify: the job, or done_, is published
+// before 'sleeping_' is read, run() raises 'sleeping_' before it looks for jobs
+void IoActive::wakeup() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (0 == sleeping_.load(std::memory_order_relaxed)) {
+    return; // run() is awake and will see the new state
+  }
+  if (1 == sleeping_.exchange(0, std::memory_order_seq_cst)) {
+    const uint64_t one = 1;
+    ssize_t written = 0;
+    do {
+      written = write(wakeup_fd_, &one, sizeof(one));
+    } while (-1 == written && EINTR == errno);
+  }
+}
+
+bool IoActive::send(Job msg_) {
+  const metrics_clock::time_point sent = metrics_clock::now();
+  const bool queued = queue_.emplace(std::move(msg_), sent);
+  wakeup();
+  return queued;
+}
+
+bool IoActive::try_send(Job msg_) {
+  const bool queued = queue_.try_push(std::move(msg_));
+  wakeup();
+  return queued;
+}
+
+void IoActive::Watch::operator()() {
+  epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+  const bool known = active->handlers_.count(fd) > 0;
+  if (-1 == epoll_ctl(active->epoll_fd_, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event)) {
+    throwErrno("IoActive::watch, epoll_ctl");
+  }
+  active->handlers_[fd] = std::move(handler);
+}
+
+active_future<void> IoActive::watch(int fd_, uint32_t events_, IoHandler handler_) {
+  Watch watch = { this, fd_, events_, std::move(handler_) };
+  return call_on(*this, std::move(watch));
+}
+
+active_future<void> IoActive::unwatch(int fd_) {
+  return call_on(*this, [this, fd_]() {
+    if (0 == handlers_.erase(fd_)) {
+      return;
+    }
+    if (-1 == epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd_, nullptr) && EBADF != errno) {
+      throwErrno("IoActive::unwatch, epoll_ctl"); // EBADF: already closed, and then gone from the set
+    }
+  });
+}
+
+bool IoActive::take(std::queue<Message>& jobs_) {
+  return queue_.try_and_pop_all(jobs_);
+}
+
+void IoActive::poll(int timeout_ms_) {
+  epoll_event events[c_max_events];
+  int ready = epoll_wait(epoll_fd_, events, c_max_events, timeout_ms_);
+  sleeping_.store(0, std::memory_order_relaxed);
+  if (-1 == ready) {
+    return; // EINTR, the loop comes back
+  }
+  for (int idx = 0; idx < ready; ++idx) {
+    const int fd = events[idx].data.fd;
+    if (wakeup_fd_ == fd) {
+      uint64_t count = 0;
+      while (sizeof(count) == read(wakeup_fd_, &count, sizeof(count))) {} // non-blocking, resets it
+      continue;
+    }
+    // a handler may be gone: an earlier handler of this batch queued an unwatch that already ran
+    std::unordered_map<int, IoHandler>::iterator handler = handlers_.find(fd);
+    if (handler != handlers_.end()) {
+      handler->second(events[idx].events);
+    }
+  }
+}
+
+// Jobs: swap-and-drain as Active::run, FIFO.
+// Between two batches the ready descriptors are polled with a zero timeout.
+// Only when there are no jobs does the thread block in epoll_wait, after
+// 'sleeping_' is raised and the queue is checked once more, see wakeup()
+//
+// ~IoActive sets done_ after its last send, so when done_ is seen and the
+// queue is empty every job, also jobs sent by jobs and handlers, has been executed
+void IoActive::run() {
+  std::queue<Message> jobs;
+  for (;;) {
+    int timeout_ms = 0;
+    if (!take(jobs)) {
+      const bool done = done_.load(std::memory_order_acquire);
+      if (done && !take(jobs)) {
+        return;
+      }
+      if (!done) {
+        sleeping_.store(1, std::memory_order_seq_cst);
+        if (!take(jobs) && !done_.load(std::memory_order_acquire)) {
+          timeout_ms = -1;
+        }
+      }
+    }
+    poll(timeout_ms);
+    while (!jobs.empty()) {
+      jobs.front().job();
+      jobs.pop();
+    }
+  }
+}
+
+std::unique_ptr<IoActive> IoActive::createIoActive(const ActiveOptions& options_) {
+  std::unique_ptr<IoActive> aPtr(new IoActive(options_));
+  aPtr->thd_.start(options_, std::bind(&IoActive::run, aPtr.get()));
+  return aPtr;
+}
+
+#endif // __linux__
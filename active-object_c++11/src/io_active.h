@@ -0,0 +1,122 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* IoActive: an Active whose background thread waits on an epoll set, so
+* that it reacts both to sent jobs and to file descriptors that are ready.
+* A socket's handler runs on the Active's own thread, there is no I/O
+* thread that has to forward each event with a send. (Linux only)
+*
+* A sent job wakes the thread through an eventfd in the epoll set. The
+* eventfd is only written when the thread is actually sleeping in
+* epoll_wait, the same rule as the parking_spot doorbell of Active: a
+* busy thread costs the sender an atomic load, not a syscall.
+*
+* Jobs and I/O take turns: the ready descriptors are polled, without
+* waiting, between two batches of jobs, so neither can starve the other.
+* Jobs are FIFO. Handlers are called with the epoll event mask (EPOLLIN ...)
+* and are added and removed through the job queue, they are only ever
+* touched by the background thread.
+*
+* Destruction drains the job queue, as ~Active. The watched descriptors
+* are not closed, they are owned by the caller. */
+
+#ifndef IO_ACTIVE_H_
+#define IO_ACTIVE_H_
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+
+#include "active.h"
+
+namespace kjellkod {
+
+/// Called on the IoActive's thread with the ready events, see epoll_ctl(2)
+typedef unique_function<void(uint32_t), 64> IoHandler;
+
+class IoActive {
+private:
+  IoActive(const IoActive&) = delete;
+  IoActive& operator=(const IoActive&) = delete;
+
+  explicit IoActive(const ActiveOptions& options_); // Construction ONLY through factory createIoActive();
+
+  // writes the eventfd, only if run() sleeps in epoll_wait
+  void wakeup();
+
+  // @return true if jobs were taken
+  bool take(std::queue<Message>& jobs_);
+
+  // epoll_wait and calls the handlers of the ready descriptors
+  void poll(int timeout_ms_);
+
+  void run();
+
+  struct Watch {
+    IoActive* active;
+    int fd;
+    uint32_t events;
+    IoHandler handler;
+    void operator()();
+  };
+
+  MessageQueue queue_;
+  int epoll_fd_;
+  int wakeup_fd_;                       // eventfd, in the epoll set
+  std::atomic<int> sleeping_;           // 1 while run() may block in epoll_wait
+  std::atomic<bool> done_;              // set by ~IoActive, the queue is drained before the thread exits
+  std::unordered_map<int, IoHandler> handlers_; // only touched by run()
+  active_thread thd_;
+
+public:
+  /// Max descriptors handled per epoll_wait
+  static const int c_max_events = 64;
+
+  virtual ~IoActive();
+
+  /// As Active::send, the job is executed on the background thread
+  /// @return false if the job was rejected or dropped, see overflow_policy
+  bool send(Job msg_);
+
+  /// Never waits for room in a full queue, see overflow_policy
+  bool try_send(Job msg_);
+
+  /// Request/response job, as Active::call
+  template<typename F>
+  active_future<typename std::result_of<F()>::type> call(F func) {
+    return call_on(*this, std::move(func));
+  }
+
+  /// 'handler_' is called on the background thread when 'fd_' has any of
+  /// 'events_' (EPOLLIN, EPOLLOUT ... also EPOLLET). A descriptor has one
+  /// handler, a second watch replaces the handler and the events.
+  /// Can also be called from a handler, e.g. for an accepted socket
+  /// @return ready when the descriptor is in the epoll set, throws
+  ///         std::system_error if epoll_ctl refused it. Do not wait for it
+  ///         on the background thread itself
+  active_future<void> watch(int fd_, uint32_t events_, IoHandler handler_);
+
+  /// The handler is removed, it is not called again once the future is ready.
+  /// Unwatch before the descriptor is closed
+  active_future<void> unwatch(int fd_);
+
+  /// number of watched descriptors. Background thread only, e.g. through call()
+  size_t watched() const { return handlers_.size(); }
+
+  /// Factory: safe construction & thread start. Only the queue's capacity
+  /// and policy and the thread's options are used, the thread always waits in epoll_wait
+  /// @throw std::system_error if the epoll set, the eventfd or the thread cannot be made
+  static std::unique_ptr<IoActive> createIoActive(const ActiveOptions& options_ = ActiveOptions());
+};
+} // end namespace kjellkod
+
+#endif // __linux__
+#endif
@@ -4,7 +4,9 @@
 * with no warranties. This code is yours to share, use and modify with no
 * strings attached and no restrictions or obligations.
 * ============================================================================
-* Please See readme or CMakeList.txt for building instructions */
+* Please See readme or CMakeList.txt for building instructions
+*
+* A demo, for real numbers see the benchmark/ target */
 
 #include <iostream>
 #include <sstream>
@@ -12,6 +14,7 @@
 #include <vector>
 #include <thread>
 #include <memory>
+#include <chrono>
 
 #include <cmath>
 #include <ctime>
@@ -22,6 +25,17 @@
 
 
 namespace {
+// bounded job queue, pushing blocks while the background thread catches up
+const size_t c_queueCapacity = 10000;
+// runIntWorkers' Backgrounder batches the values
+const size_t c_batchSize = 1024;
+const std::chrono::microseconds c_maxBatchLatency(500);
+// runSpillWorkers' Backgrounder keeps this many strings in memory
+// and stores them slower than they are saved, the rest is spilled
+const size_t c_spillMemoryItems = 1000;
+const std::chrono::microseconds c_spillProcessTime(1000);
+const size_t c_spillSegmentBytes = 1024 * 1024;
+
 void printPercentageLeft(const unsigned nbr_, unsigned & progress_, const unsigned max_){
   float percent = 100 * ((float)nbr_/max_);
   unsigned int rounded = ((int)percent/10)*10;
@@ -32,27 +46,41 @@ void printPercentageLeft(const unsigned nbr_, unsigned & progress_, const unsign
   }
 }
 
+// polls the worker's stored() counter, with a sleep, so that the main thread
+// does not steal cpu from the threads that are measured. The output vector
+// is not touched while the worker writes to it, flush() is the barrier
 template<typename T>
-void printProgress(const std::vector<T>& out_,const std::vector<T>& in_, const unsigned max_)
+void printProgress(Backgrounder<T>& worker_, const unsigned max_)
 {
   std::cout << "\nLeft to Process [%]: ";
   unsigned progress = 100;
-  do{
-    unsigned pSize = in_.size();
-    unsigned remaining = pSize - out_.size();
-    printPercentageLeft(remaining, progress, max_);
-  }while((out_.size() < max_) && progress <= 100);
+  size_t stored = 0;
+  while((stored = worker_.stored()) < max_){
+    printPercentageLeft(static_cast<unsigned>(max_ - stored), progress, max_);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  worker_.flush();
+}
+
+// wall time, clock() is the cpu time of the process, i.e. of ALL its threads
+double secondsSince(const std::chrono::steady_clock::time_point start_)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
 }
 }
 
 
-void runStrWorkers(const int c_nbrItems)
+// pushes random strings to a Backgrounder that 'configure_' has set up,
+// then verifies that all of them were stored, in order
+template<typename Configure>
+void runStringWorkers(const int c_nbrItems, const size_t capacity_, Configure configure_)
 {
   std::vector<std::string> saveToQ;
   std::vector<std::string> compareQ;
-  const clock_t start = clock();
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
   {
-    Backgrounder<std::string> worker(saveToQ);
+    Backgrounder<std::string> worker(saveToQ, capacity_);
+    configure_(worker);
     srand((unsigned)time(0));
 
     for(int idx=0; idx < c_nbrItems; ++idx)
@@ -63,28 +91,40 @@ void runStrWorkers(const int c_nbrItems)
       compareQ.push_back(oss.str());
       worker.saveData(oss.str());
     }
-    double pushTime = ((clock() - start)/(double)CLOCKS_PER_SEC);
+    double pushTime = secondsSince(start);
     std::cout<<"Finished pushing #"<<c_nbrItems<<" jobs to bg worker";
-    std::cout<<" in "<<pushTime<<" [s]"<< std::endl;
+    std::cout<<" in "<<pushTime<<" [s]";
+#if defined(__unix__)
+    if(worker.spilled() > 0){
+      std::cout<<", "<<worker.spilled()<<" on disk";
+    }
+#endif
+    std::cout<< std::endl;
 
-    printProgress(saveToQ, compareQ, c_nbrItems);
+    printProgress(worker, c_nbrItems);
   } // Trigger Backgrounder to go out of scope
-  double workTime = ((clock() - start)/(double)CLOCKS_PER_SEC);
+  double workTime = secondsSince(start);
   std::cout << "\nBackgrounder finished with processing jobs in ";
   std::cout <<workTime<<" [s]"<< std::endl;
 
   // just dummy to make sure that nothing was lost
   assert(std::equal(compareQ.begin(), compareQ.end(), saveToQ.begin()));
-  assert(saveToQ.size() == c_nbrItems);
+  assert(saveToQ.size() == static_cast<size_t>(c_nbrItems));
+}
+
+void runStrWorkers(const int c_nbrItems)
+{
+  runStringWorkers(c_nbrItems, c_queueCapacity, [](Backgrounder<std::string>&){});
 }
 
 void runIntWorkers(const int c_nbrItems)
 {
   std::vector<int> saveToQ;
   std::vector<int> compareQ;
-  const clock_t start = clock();
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
   {
-    Backgrounder<int> worker(saveToQ);
+    // batching mode, the bg thread gets the ints in spans of c_batchSize
+    Backgrounder<int> worker(saveToQ, c_queueCapacity, c_batchSize, c_maxBatchLatency);
     srand((unsigned)time(0));
 
     // all except one is random, save space for "zero" after the
@@ -100,21 +140,35 @@ void runIntWorkers(const int c_nbrItems)
     worker.saveData(0);
 
 
-    double pushTime = ((clock() - start)/(double)CLOCKS_PER_SEC);
+    double pushTime = secondsSince(start);
     std::cout<<"Finished pushing #"<<c_nbrItems<<" jobs to bg worker";
     std::cout<<" in "<<pushTime<<" [s]"<< std::endl;
 
-    printProgress(saveToQ, compareQ, c_nbrItems);
+    printProgress(worker, c_nbrItems);
   } // Trigger Backgrounder to go out of scope
-  double workTime = ((clock() - start)/(double)CLOCKS_PER_SEC);
+  double workTime = secondsSince(start);
   std::cout << "\nBackgrounder finished with processing jobs in ";
   std::cout<<" in "<<workTime<<" [s]"<< std::endl;
 
   // just dummy to make sure that nothing was lost
   assert(std::equal(compareQ.begin(), compareQ.end(), saveToQ.begin()));
-  assert(saveToQ.size() == c_nbrItems);
+  assert(saveToQ.size() == static_cast<size_t>(c_nbrItems));
 }
 
+#if defined(__unix__)
+// spill mode, past c_spillMemoryItems the strings wait in the mmapped journal
+void runSpillWorkers(const int c_nbrItems)
+{
+  runStringWorkers(c_nbrItems, 0, [](Backgrounder<std::string>& worker_){
+    kjellkod::spill_options spill;
+    spill.memory_items = c_spillMemoryItems;
+    spill.segment_bytes = c_spillSegmentBytes;
+    worker_.setProcessTime(c_spillProcessTime);
+    worker_.setSpill(spill);
+  });
+}
+#endif
+
 
 
 int main(int argc, char** argv)
@@ -126,5 +180,10 @@ int main(int argc, char** argv)
   std::cout << "\n\n" << c_nbrItems << " transactions of int" << std::endl;
   runIntWorkers(c_nbrItems);
 
+#if defined(__unix__)
+  std::cout << "\n\n" << c_nbrItems << " transactions of std::string, spilled to disk" << std::endl;
+  runSpillWorkers(c_nbrItems);
+#endif
+
   return 0;
 }
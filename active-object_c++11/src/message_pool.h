@@ -0,0 +1,194 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Recycling storage for message payloads that are made on a producer thread
+* and consumed, and freed, on the Active's thread.
+*
+* Each producer thread has its own pool per payload type. A payload is
+* taken from the pool's free list and, when the consumer is done with it,
+* pushed back onto the returned stack of the pool that it came from. The
+* producer takes the whole returned stack in one go when its free list is
+* empty. In a steady state there is no malloc/free at all, and the memory
+* never moves between malloc arenas.
+*   make_pooled: no lock, no atomic unless the free list is empty
+*   release:     one CAS on the owning pool's returned stack
+*
+* A pool outlives its thread until all of its payloads have come back. */
+
+#ifndef MESSAGE_POOL_H_
+#define MESSAGE_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace kjellkod {
+
+template<typename T>
+class message_pool {
+public:
+  struct Node {
+    typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+    Node* next;
+    message_pool* owner;
+    T* value() { return reinterpret_cast<T*>(&storage); }
+  };
+
+  /// The calling thread's pool
+  static message_pool& local() {
+    thread_local Owner owner;
+    return *owner.pool;
+  }
+
+  /// Owner thread only
+  template<typename... Args>
+  Node* acquire(Args&&... args) {
+    Node* node = free_;
+    if (nullptr == node) {
+      node = returned_.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (nullptr == node) {
+      node = new Node;
+      node->owner = this;
+      nodes_.fetch_add(1, std::memory_order_relaxed);
+      node->next = nullptr;
+    }
+    free_ = node->next;
+    try {
+      new (node->value()) T(std::forward<Args>(args)...);
+    } catch (...) {
+      node->next = free_;
+      free_ = node;
+      throw;
+    }
+    return node;
+  }
+
+  /// The node that holds a value from acquire()
+  static Node* nodeOf(T* value) {
+    static_assert(std::is_standard_layout<Node>::value, "the value is the node's first member");
+    return reinterpret_cast<Node*>(value);
+  }
+
+  /// Any thread, the payload is destroyed and the node goes back to its pool
+  static void release(Node* node) {
+    node->value()->~T();
+    message_pool* pool = node->owner;
+    Node* head = pool->returned_.load(std::memory_order_relaxed);
+    do {
+      if (closed() == head) {
+        std::atomic_thread_fence(std::memory_order_acquire); // after close() took its reference
+        delete node; // the owner thread is gone
+        pool->forget(1);
+        return;
+      }
+      node->next = head;
+    } while (!pool->returned_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  /// nodes made by this pool that still exist, free or in use
+  size_t nodes() const { return nodes_.load(std::memory_order_relaxed); }
+
+private:
+  message_pool() : free_(nullptr), returned_(nullptr), nodes_(0) {}
+  message_pool(const message_pool&) = delete;
+  message_pool& operator=(const message_pool&) = delete;
+
+  static Node* closed() {
+    static Node sentinel;
+    return &sentinel;
+  }
+
+  // the pool is deleted with its last node
+  void forget(size_t deleted) {
+    if (nodes_.fetch_sub(deleted, std::memory_order_acq_rel) == deleted) {
+      delete this;
+    }
+  }
+
+  // owner thread exit: the free nodes are deleted, nodes that come back later are deleted on return.
+  // The pool is only touched before the exchange or through its own reference: once closed() is
+  // published a release may delete the last node in use, and with it the pool
+  void close() {
+    Node* free = free_;
+    free_ = nullptr;
+    nodes_.fetch_add(1, std::memory_order_relaxed); // close's reference, also a pool without nodes is deleted once
+    size_t deleted = 0;
+    Node* lists[] = { free, returned_.exchange(closed(), std::memory_order_acq_rel) };
+    for (Node* node : lists) {
+      while (nullptr != node) {
+        Node* next = node->next;
+        delete node;
+        node = next;
+        ++deleted;
+      }
+    }
+    forget(deleted + 1);
+  }
+
+  struct Owner {
+    message_pool* pool;
+    Owner() : pool(new message_pool) {}
+    ~Owner() { pool->close(); }
+  };
+
+  Node* free_;                   // owner thread only
+  std::atomic<Node*> returned_;  // pushed by the consumers, closed() when the owner is gone
+  std::atomic<size_t> nodes_;
+};
+
+
+/// Move-only owner of a pooled payload, the unique_ptr of message_pool.
+/// Made on the producer thread with make_pooled, may be destroyed on any thread
+template<typename T>
+class pooled {
+public:
+  typedef typename message_pool<T>::Node Node;
+
+  pooled() : node_(nullptr) {}
+  explicit pooled(Node* node) : node_(node) {}
+  // noexcept, or a Job would not store it inline
+  pooled(pooled&& other) noexcept : node_(other.node_) { other.node_ = nullptr; }
+  pooled& operator=(pooled&& other) noexcept {
+    if (this != &other) {
+      reset();
+      node_ = other.node_;
+      other.node_ = nullptr;
+    }
+    return *this;
+  }
+  ~pooled() { reset(); }
+
+  T& operator*() const { return *node_->value(); }
+  T* operator->() const { return node_->value(); }
+  T* get() const { return node_ ? node_->value() : nullptr; }
+  explicit operator bool() const { return nullptr != node_; }
+
+  void reset() {
+    if (node_) {
+      message_pool<T>::release(node_);
+      node_ = nullptr;
+    }
+  }
+
+private:
+  pooled(const pooled&) = delete;
+  pooled& operator=(const pooled&) = delete;
+
+  Node* node_;
+};
+
+
+/// T made in the calling thread's pool
+template<typename T, typename... Args>
+pooled<T> make_pooled(Args&&... args) {
+  return pooled<T>(message_pool<T>::local().acquire(std::forward<Args>(args)...));
+}
+} // end namespace kjellkod
+
+#endif
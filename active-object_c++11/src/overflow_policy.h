@@ -0,0 +1,22 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* What a bounded queue does when a producer pushes to a full queue.
+* Used by shared_queue, ring_queue and the Active object.
+*
+*   block        the producer waits for room (push), or gives up after a
+*                timeout (push_for). try_push never waits, it fails
+*   reject       the push fails immediately, counted as 'rejected'
+*   drop_oldest  the oldest queued item is thrown away to make room,
+*                counted as 'dropped'. The push itself always succeeds
+*   drop_newest  the new item is thrown away, counted as 'dropped' */
+
+#ifndef OVERFLOW_POLICY_H_
+#define OVERFLOW_POLICY_H_
+
+enum class overflow_policy { block, reject, drop_oldest, drop_newest };
+
+#endif
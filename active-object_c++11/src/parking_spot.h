@@ -0,0 +1,191 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* A parking spot for ONE waiting thread, the wait_strategy decides how it
+* waits. With spin_then_park the waiter spins with a cpu 'pause' for a short
+* while and then sleeps on a futex (Linux) or a condition variable. With
+* block it goes straight to the condition variable, with busy_poll it never
+* sleeps. The notifier only makes a syscall when the waiter is actually
+* sleeping, i.e. the hot path is an atomic load.
+*
+* Used by the lock-free ring_queue (consumer waits for items), by the
+* active_future (caller waits for the result) and by the Active (waits for
+* jobs or for its next timer) */
+
+#ifndef PARKING_SPOT_H_
+#define PARKING_SPOT_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#if defined(__linux__)
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PARKING_SPOT_FUTEX
+#endif
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "wait_strategy.h"
+
+class parking_spot {
+  std::mutex m_;
+  std::condition_variable data_cond_;
+  std::atomic<int> sleeping_; // 1 while the waiter is parked, also the futex word
+  const wait_strategy strategy_;
+
+  parking_spot& operator=(const parking_spot&) = delete;
+  parking_spot(const parking_spot&) = delete;
+
+  bool usesFutex() const {
+#if defined(PARKING_SPOT_FUTEX)
+    return wait_strategy::spin_then_park == strategy_;
+#else
+    return false;
+#endif
+  }
+
+  // @return true if 'ready', false if spinning is over or 'deadline' passed
+  template<typename Clock, typename Duration, typename Ready>
+  bool spin(const std::chrono::time_point<Clock, Duration>& deadline, Ready& ready) {
+    if (wait_strategy::block == strategy_
+        || (wait_strategy::spin_then_park == strategy_ && 0 == spinTime().count())) {
+      return ready();
+    }
+    const typename Clock::time_point start = Clock::now();
+    for (unsigned spins = 1; ; ++spins) {
+      if (ready()) {
+        return true;
+      }
+      pause();
+      if (0 == spins % c_pauses_per_clock_check) {
+        const typename Clock::time_point now = Clock::now();
+        if (now >= deadline || (wait_strategy::busy_poll != strategy_ && now - start >= spinTime())) {
+          return ready();
+        }
+      }
+    }
+  }
+
+  // @return false at 'deadline'. Spurious wakeups return true, the caller checks 'ready' again
+  template<typename Clock, typename Duration>
+  bool park(std::unique_lock<std::mutex>& lock, const std::chrono::time_point<Clock, Duration>& deadline, bool forever) {
+#if defined(PARKING_SPOT_FUTEX)
+    if (usesFutex()) {
+      timespec timeout = { 0, 0 };
+      if (!forever) {
+        const typename Clock::duration left = deadline - Clock::now();
+        if (left <= Clock::duration::zero()) {
+          return false;
+        }
+        const std::chrono::nanoseconds ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+        timeout.tv_sec = static_cast<time_t>(ns.count() / 1000000000);
+        timeout.tv_nsec = static_cast<long>(ns.count() % 1000000000);
+      }
+      // returns at once if the notifier already cleared 'sleeping_'
+      syscall(SYS_futex, reinterpret_cast<int*>(&sleeping_), FUTEX_WAIT_PRIVATE, 1, forever ? nullptr : &timeout, nullptr, 0);
+      return true;
+    }
+#endif
+    if (forever) {
+      data_cond_.wait(lock);
+      return true;
+    }
+    return std::cv_status::no_timeout == data_cond_.wait_until(lock, deadline);
+  }
+
+  template<typename Clock, typename Duration, typename Ready>
+  bool waitUntil(const std::chrono::time_point<Clock, Duration>& deadline, Ready& ready, bool forever) {
+    if (spin(deadline, ready)) {
+      return true;
+    }
+    if (wait_strategy::busy_poll == strategy_) {
+      return false; // spin() only gives up at the deadline
+    }
+
+    std::unique_lock<std::mutex> lock(m_, std::defer_lock);
+    if (!usesFutex()) {
+      lock.lock();
+    }
+    bool is_ready = false;
+    for (;;) {
+      sleeping_.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in notify()
+      is_ready = ready();
+      if (is_ready || !park(lock, deadline, forever)) {
+        break;
+      }
+    }
+    sleeping_.store(0, std::memory_order_relaxed);
+    return is_ready || ready();
+  }
+
+public:
+  /// max spin time of spin_then_park, before parking
+  static std::chrono::microseconds spinTime() {
+    // spinning on a single core only steals time from the thread we wait for
+    static const std::chrono::microseconds spin_time(std::thread::hardware_concurrency() > 1 ? c_spin_time_us : 0);
+    return spin_time;
+  }
+
+  static const unsigned c_spin_time_us = 20;
+  static const unsigned c_pauses_per_clock_check = 64;
+
+  explicit parking_spot(wait_strategy strategy = wait_strategy::spin_then_park)
+    : sleeping_(0), strategy_(strategy) {}
+
+  wait_strategy strategy() const { return strategy_; }
+
+  /// tells the cpu that this is a spin loop, saves power and the other hyper thread
+  static void pause() {
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+  }
+
+  /// notifier side, must be called AFTER the state that 'ready' checks was published
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (0 == sleeping_.load(std::memory_order_relaxed)) {
+      return; // the waiter is awake and will see the new state
+    }
+#if defined(PARKING_SPOT_FUTEX)
+    if (usesFutex()) {
+      if (1 == sleeping_.exchange(0, std::memory_order_seq_cst)) {
+        syscall(SYS_futex, reinterpret_cast<int*>(&sleeping_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+      }
+      return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(m_);
+    data_cond_.notify_one();
+  }
+
+  /// waiter side, until 'ready' returns true
+  template<typename Ready>
+  void wait(Ready ready) {
+    const std::chrono::steady_clock::time_point c_never = std::chrono::steady_clock::time_point::max();
+    waitUntil(c_never, ready, true);
+  }
+
+  /// same as wait() but gives up at 'deadline'
+  /// @return the last result of 'ready'
+  template<typename Clock, typename Duration, typename Ready>
+  bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline, Ready ready) {
+    return waitUntil(deadline, ready, false);
+  }
+};
+
+#endif
@@ -0,0 +1,568 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Bounded, lock-free ring buffer queues that can be used as a drop-in
+* replacement for the mutex protected shared_queue.
+*
+*   ring_queue<T, ring_producers::multiple>  many producers, ONE consumer
+*   ring_queue<T, ring_producers::single>    one producer,   ONE consumer
+*
+* The multiple producer version is Dmitry Vyukov's bounded queue where every
+* slot carries a sequence number. Producers claim a slot with a single CAS and
+* the consumer never touches a lock as long as there is work to do.
+* Ref: http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*
+* The single producer version is a plain Lamport ring with cached indices.
+*
+* Both keep strict FIFO order in the order that the slots were claimed. With
+* several producers each producer's own jobs are kept in the order it sent them.
+*
+* The consumer spins for a short while when the queue is empty and then parks
+* on a futex (parking_spot). Producers only make the wakeup syscall when the
+* consumer is actually parked, so the normal push is lock-free.
+*
+* An owner that waits on its own doorbell, and never calls wait_and_pop,
+* gives the ring no_parking: then a push does not pay the parking_spot's
+* fence for a consumer that is never parked on the ring (Active and the
+* pipeline stages).
+*
+* The multiple producer version also takes an overflow_policy for a full ring.
+* drop_oldest lets the producer take the oldest item itself, the dequeue is a
+* CAS (the algorithm is multi consumer) so that is safe against the consumer.
+*
+* It can also be closed, as shared_queue: the top bit of the enqueue position
+* is set, so that no slot can be claimed after it. close() returns once the
+* slots claimed before it are published, and every later push fails. */
+
+#ifndef RING_QUEUE_H_
+#define RING_QUEUE_H_
+
+#include <queue>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+
+#include <chrono>
+#include <cstdint>
+
+#include "parking_spot.h"
+#include "overflow_policy.h"
+
+enum class ring_producers { multiple, single };
+
+/// Parking of a ring whose consumer is woken by its owner. wait_and_pop
+/// then yields in a loop, it is only there to keep the API the same
+struct no_parking {
+  void notify() {}
+
+  template<typename Ready>
+  void wait(Ready ready) {
+    while (!ready()) {
+      std::this_thread::yield();
+    }
+  }
+};
+
+namespace ring_detail {
+const size_t c_cache_line = 64;
+const size_t c_default_capacity = 8192;
+
+inline size_t roundUpToPowerOfTwo(size_t value_) {
+  size_t power = 2;
+  while (power < value_) {
+    power <<= 1;
+  }
+  return power;
+}
+} // ring_detail
+
+
+
+template<typename T, ring_producers Producers = ring_producers::multiple, typename Parking = parking_spot>
+class ring_queue;
+
+
+/** Multiple producer, single consumer bounded queue.
+* With the default block policy a full queue makes 'push' yield until the
+* consumer has made room, use 'try_push' to get a failure instead */
+template<typename T, typename Parking>
+class ring_queue<T, ring_producers::multiple, Parking> {
+  struct Cell {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+    T* item() { return reinterpret_cast<T*>(&storage); }
+  };
+
+  static const size_t c_closed = ~(~size_t(0) >> 1); // top bit of enqueue_pos_
+
+  Cell* const cells_;
+  const size_t mask_;
+  char pad0_[ring_detail::c_cache_line];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[ring_detail::c_cache_line];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[ring_detail::c_cache_line];
+  Parking parking_;
+  const overflow_policy policy_;
+  std::atomic<uint64_t> rejected_;
+  std::atomic<uint64_t> dropped_;
+
+  ring_queue& operator=(const ring_queue&) = delete;
+  ring_queue(const ring_queue& other) = delete;
+
+  // Claims a slot and constructs the item in place from 'args'. The slot
+  // sequence is what makes the item visible to the consumer, not enqueue_pos_.
+  // Nothing is made from 'args' when the ring is full or closed, they can be retried
+  template<typename... Args>
+  bool tryEnqueue(Args&&... args) {
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      if (0 != (pos & c_closed)) {
+        return false;
+      }
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (0 == dif) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false; // full
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    new (cell->item()) T(std::forward<Args>(args)...);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Hands the front item to 'consume' as an rvalue, then frees its slot
+  template<typename Consume>
+  bool tryConsume(Consume consume) {
+    Cell* cell;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+      if (0 == dif) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false; // empty, or the next in line is not yet published
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    T* item = cell->item();
+    consume(std::move(*item));
+    item->~T();
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryDequeue(T& popped_item) {
+    return tryConsume([&](T&& item) { popped_item = std::move(item); });
+  }
+
+  // there is no lock to amortize, the ring is simply drained one item at a time
+  bool drainInto(std::queue<T>& popped_items) {
+    bool any = false;
+    while (tryConsume([&](T&& item) { popped_items.push(std::move(item)); })) {
+      any = true;
+    }
+    return any;
+  }
+
+  // The ring was full. 'waitForRoom' is only used with the block policy
+  // and returns false if the producer gave up waiting. The consumer is not
+  // notified, except before waiting for room (it may sleep on items from this batch)
+  template<typename WaitForRoom, typename... Args>
+  bool queueWithPolicy(WaitForRoom waitForRoom, Args&&... args) {
+    while (!tryEnqueue(std::forward<Args>(args)...)) {
+      if (closed()) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      switch (policy_) {
+      case overflow_policy::block:
+        parking_.notify();
+        if (!waitForRoom()) {
+          rejected_.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        break;
+      case overflow_policy::reject:
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      case overflow_policy::drop_oldest:
+        // the consumer may beat us to it, then there is room anyway
+        if (tryConsume([](T&&) {})) {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        break;
+      case overflow_policy::drop_newest:
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template<typename WaitForRoom, typename... Args>
+  bool pushWithPolicy(WaitForRoom waitForRoom, Args&&... args) {
+    if (!queueWithPolicy(waitForRoom, std::forward<Args>(args)...)) {
+      return false;
+    }
+    parking_.notify();
+    return true;
+  }
+
+public:
+  /// @param capacity is rounded up to the closest power of two, 0 gives the default
+  /// @param policy what a push to a full ring does
+  explicit ring_queue(size_t capacity = ring_detail::c_default_capacity, overflow_policy policy = overflow_policy::block)
+    : cells_(new Cell[ring_detail::roundUpToPowerOfTwo(capacity ? capacity : ring_detail::c_default_capacity)])
+    , mask_(ring_detail::roundUpToPowerOfTwo(capacity ? capacity : ring_detail::c_default_capacity) - 1)
+    , enqueue_pos_(0)
+    , dequeue_pos_(0)
+    , policy_(policy)
+    , rejected_(0)
+    , dropped_(0) {
+    for (size_t idx = 0; idx <= mask_; ++idx) {
+      cells_[idx].sequence.store(idx, std::memory_order_relaxed);
+    }
+  }
+
+  ~ring_queue() {
+    const size_t enqueued = enqueue_pos_.load(std::memory_order_acquire) & ~c_closed;
+    for (size_t pos = dequeue_pos_.load(std::memory_order_acquire); pos != enqueued; ++pos) {
+      Cell& cell = cells_[pos & mask_];
+      if (cell.sequence.load(std::memory_order_acquire) == pos + 1) {
+        cell.item()->~T();
+      }
+    }
+    delete [] cells_;
+  }
+
+  /// Never waits, with the block policy a full queue rejects the item
+  bool try_push(T item) {
+    return pushWithPolicy([]() { return false; }, std::move(item));
+  }
+
+  /// With the block policy: yields until there is room in the queue
+  /// \return false if the item was rejected or dropped (drop_newest)
+  bool push(const T& item) {
+    return emplace(item);
+  }
+
+  bool push(T&& item) {
+    return emplace(std::move(item));
+  }
+
+  /// As push but the item is made from 'args' in its slot, there is no
+  /// temporary T. Nothing is made if the item is rejected or dropped
+  template<typename... Args>
+  bool emplace(Args&&... args) {
+    return pushWithPolicy([]() { std::this_thread::yield(); return true; }, std::forward<Args>(args)...);
+  }
+
+  /// Pushes all items in [first, last) with a single consumer wakeup, each
+  /// item is handled as by push(). Move-only items are moved in with
+  /// std::make_move_iterator
+  /// \return number of items that were queued
+  template<typename InputIt>
+  size_t push_range(InputIt first, InputIt last) {
+    return push_range(first, last, []() {});
+  }
+
+  /// As above. 'beforeWait' is called before the producer waits for room,
+  /// for a consumer that does not sleep on this queue
+  template<typename InputIt, typename BeforeWait>
+  size_t push_range(InputIt first, InputIt last, BeforeWait beforeWait) {
+    size_t queued = 0;
+    for (; first != last; ++first) {
+      if (queueWithPolicy([&]() { beforeWait(); std::this_thread::yield(); return true; }, *first)) {
+        ++queued;
+      }
+    }
+    if (0 != queued) {
+      parking_.notify();
+    }
+    return queued;
+  }
+
+  /// As push but with the block policy the item is rejected if there is
+  /// still no room after 'timeout'
+  template<typename Rep, typename Period>
+  bool push_for(T item, const std::chrono::duration<Rep, Period>& timeout) {
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    return pushWithPolicy([deadline]() {
+      std::this_thread::yield();
+      return std::chrono::steady_clock::now() < deadline;
+    }, std::move(item));
+  }
+
+  /// Never lost, whatever the policy. The ring cannot grow so this yields
+  /// until there is room. For control messages, e.g. a quit or flush message
+  /// \return false only if the ring is closed
+  bool force_push(T item) {
+    while (!tryEnqueue(std::move(item))) {
+      if (closed()) {
+        return false;
+      }
+      std::this_thread::yield();
+    }
+    parking_.notify();
+    return true;
+  }
+
+  /// Every later push fails, producers that wait for room give up. Returns
+  /// once the items of the pushes that got a slot before are in the ring,
+  /// they can still be taken
+  void close() {
+    const size_t claimed = enqueue_pos_.fetch_or(c_closed, std::memory_order_acq_rel) & ~c_closed;
+    for (size_t pos = dequeue_pos_.load(std::memory_order_acquire); pos != claimed; ++pos) {
+      while (cells_[pos & mask_].sequence.load(std::memory_order_acquire) == pos) {
+        std::this_thread::yield(); // claimed, not yet published
+      }
+    }
+  }
+
+  bool closed() const {
+    return 0 != (enqueue_pos_.load(std::memory_order_acquire) & c_closed);
+  }
+
+  /// \return immediately, with true if successful retrieval
+  bool try_and_pop(T& popped_item) {
+    return tryDequeue(popped_item);
+  }
+
+  /// Try to retrieve, if no items, spin a little, then sleep till an item is available
+  void wait_and_pop(T& popped_item) {
+    parking_.wait([&]() { return tryDequeue(popped_item); });
+  }
+
+  /// Moves all items that are available right now into 'popped_items'
+  /// \return immediately, with true if any items were retrieved
+  bool try_and_pop_all(std::queue<T>& popped_items) {
+    return drainInto(popped_items);
+  }
+
+  /// Same as try_and_pop_all but waits till at least one item is available
+  void wait_and_pop_all(std::queue<T>& popped_items) {
+    parking_.wait([&]() { return drainInto(popped_items); });
+  }
+
+  bool empty() const {
+    return 0 == size();
+  }
+
+  /// approximate when producers/consumer are active at the same time
+  unsigned size() const {
+    size_t dequeued = dequeue_pos_.load(std::memory_order_acquire);
+    size_t enqueued = enqueue_pos_.load(std::memory_order_acquire) & ~c_closed;
+    return static_cast<unsigned>(enqueued > dequeued ? enqueued - dequeued : 0);
+  }
+
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+  /// pushes that failed: the reject policy, try_push, a push_for timeout
+  /// or a closed ring
+  uint64_t rejected() const {
+    return rejected_.load(std::memory_order_relaxed);
+  }
+
+  /// items thrown away by the drop_oldest and drop_newest policies
+  uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+};
+
+
+
+/** Single producer, single consumer bounded queue.
+* Same API as the multiple producer version but with no CAS at all. Each side
+* keeps a cached copy of the other side's index so that the shared
+* index cache line is only read when the cached value says full/empty */
+template<typename T, typename Parking>
+class ring_queue<T, ring_producers::single, Parking> {
+  typedef typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type Slot;
+
+  Slot* const slots_;
+  const size_t mask_;
+  char pad0_[ring_detail::c_cache_line];
+  std::atomic<size_t> tail_;    // written by producer
+  size_t cached_head_;          // producer's copy of head_
+  char pad1_[ring_detail::c_cache_line];
+  std::atomic<size_t> head_;    // written by consumer
+  size_t cached_tail_;          // consumer's copy of tail_
+  char pad2_[ring_detail::c_cache_line];
+  Parking parking_;
+
+  ring_queue& operator=(const ring_queue&) = delete;
+  ring_queue(const ring_queue& other) = delete;
+
+  T* item(size_t pos) { return reinterpret_cast<T*>(&slots_[pos & mask_]); }
+
+  template<typename... Args>
+  bool tryEnqueue(Args&&... args) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) {
+        return false; // full
+      }
+    }
+    new (item(tail)) T(std::forward<Args>(args)...);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  template<typename Consume>
+  bool tryConsume(Consume consume) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false; // empty
+      }
+    }
+    T* value = item(head);
+    consume(std::move(*value));
+    value->~T();
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryDequeue(T& popped_item) {
+    return tryConsume([&](T&& value) { popped_item = std::move(value); });
+  }
+
+  bool drainInto(std::queue<T>& popped_items) {
+    bool any = false;
+    while (tryConsume([&](T&& value) { popped_items.push(std::move(value)); })) {
+      any = true;
+    }
+    return any;
+  }
+
+public:
+  /// @param capacity is rounded up to the closest power of two
+  explicit ring_queue(size_t capacity = 8192)
+    : slots_(new Slot[ring_detail::roundUpToPowerOfTwo(capacity)])
+    , mask_(ring_detail::roundUpToPowerOfTwo(capacity) - 1)
+    , tail_(0)
+    , cached_head_(0)
+    , head_(0)
+    , cached_tail_(0) {}
+
+  ~ring_queue() {
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    for (size_t pos = head_.load(std::memory_order_acquire); pos != tail; ++pos) {
+      item(pos)->~T();
+    }
+    delete [] slots_;
+  }
+
+  bool try_push(const T& value) {
+    if (!tryEnqueue(value)) {
+      return false;
+    }
+    parking_.notify();
+    return true;
+  }
+
+  /// 'value' is only moved from if it was queued
+  bool try_push(T&& value) {
+    if (!tryEnqueue(std::move(value))) {
+      return false;
+    }
+    parking_.notify();
+    return true;
+  }
+
+  void push(const T& value) {
+    emplace(value);
+  }
+
+  void push(T&& value) {
+    emplace(std::move(value));
+  }
+
+  /// The item is made from 'args' in its slot, yields while the ring is full
+  template<typename... Args>
+  void emplace(Args&&... args) {
+    while (!tryEnqueue(std::forward<Args>(args)...)) {
+      std::this_thread::yield();
+    }
+    parking_.notify();
+  }
+
+  /// Pushes all items in [first, last) with a single consumer wakeup
+  /// \return number of items that were queued, i.e. all of them
+  template<typename InputIt>
+  size_t push_range(InputIt first, InputIt last) {
+    size_t queued = 0;
+    for (; first != last; ++first, ++queued) {
+      while (!tryEnqueue(*first)) {
+        parking_.notify(); // the consumer may sleep on the items of this batch
+        std::this_thread::yield();
+      }
+    }
+    if (0 != queued) {
+      parking_.notify();
+    }
+    return queued;
+  }
+
+  bool try_and_pop(T& popped_item) {
+    return tryDequeue(popped_item);
+  }
+
+  void wait_and_pop(T& popped_item) {
+    parking_.wait([&]() { return tryDequeue(popped_item); });
+  }
+
+  bool try_and_pop_all(std::queue<T>& popped_items) {
+    return drainInto(popped_items);
+  }
+
+  void wait_and_pop_all(std::queue<T>& popped_items) {
+    parking_.wait([&]() { return drainInto(popped_items); });
+  }
+
+  bool empty() const {
+    return 0 == size();
+  }
+
+  unsigned size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return static_cast<unsigned>(tail > head ? tail - head : 0);
+  }
+
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+};
+
+
+template<typename T, typename Parking = parking_spot>
+using mpsc_ring_queue = ring_queue<T, ring_producers::multiple, Parking>;
+
+template<typename T, typename Parking = parking_spot>
+using spsc_ring_queue = ring_queue<T, ring_producers::single, Parking>;
+
+#endif
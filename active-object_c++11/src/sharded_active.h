@@ -0,0 +1,235 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* ShardedActive: a fixed set of Active objects where every job is sent with
+* a key, i.e. an entity id. The same key always goes to the same shard, so
+* jobs for ONE key are executed in FIFO order (the single Active guarantee)
+* while different keys are spread over all the shards' threads.
+*
+* Every shard is made with the same ActiveOptions: capacity, overflow policy
+* and thread settings.
+*
+* Metrics: number of jobs queued in each shard and the imbalance between them.
+* Optional hot-key detection samples, on average, every Nth queued key into a
+* small "space saving" top-K sketch, see Metwally et al. "Efficient
+* Computation of Frequent and Top-k Elements in Data Streams". There is one
+* sketch per shard: a key always goes to the same shard, so the sketches
+* never share a key and hotKeys() only has to merge them. A sender never
+* waits for a sketch, a sample is skipped if another sender holds it */
+
+#ifndef SHARDED_ACTIVE_H_
+#define SHARDED_ACTIVE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "active.h"
+
+namespace kjellkod {
+
+struct ShardStats {
+  std::vector<uint64_t> sent;   // jobs queued per shard, rejected or dropped sends are not counted
+  double imbalance;             // busiest shard / mean, 1.0 is perfectly even
+};
+
+
+template<typename Key, typename Hash = std::hash<Key> >
+class ShardedActive {
+public:
+  typedef std::pair<Key, uint64_t> HotKey;  // key and its estimated number of jobs
+
+private:
+  static const size_t c_cache_line = 64;
+
+  // one cache line each, no false sharing. new[] does not align to more
+  // than alignof(max_align_t) before C++17, the counters are placed in an
+  // over-allocated buffer instead
+  struct alignas(c_cache_line) ShardCounter {
+    std::atomic<uint64_t> sent;
+    ShardCounter() : sent(0) {}
+  };
+
+  static_assert(sizeof(ShardCounter) == c_cache_line, "one counter per cache line");
+
+  // call() through a shard, the job is only counted if it was queued
+  struct ShardSender {
+    ShardedActive* sharded;
+    unsigned shard;
+    bool send(Job msg_) { return sharded->sendTo(shard, std::move(msg_)); }
+  };
+
+  // space saving sketch of the keys sent to one shard
+  struct HotKeySketch {
+    std::mutex m;
+    std::vector<HotKey> keys;
+  };
+
+  bool sendTo(unsigned shard_, Job msg_) {
+    if (!shards_[shard_]->send(std::move(msg_))) {
+      return false;
+    }
+    counters_[shard_].sent.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  ShardedActive(const ShardedActive&) = delete;
+  ShardedActive& operator=(const ShardedActive&) = delete;
+
+  // std::hash of an integer is often the identity, mix the bits (murmur3 finalizer)
+  static uint64_t mix(uint64_t hash_) {
+    hash_ ^= hash_ >> 33;
+    hash_ *= 0xff51afd7ed558ccdULL;
+    hash_ ^= hash_ >> 33;
+    hash_ *= 0xc4ceb9fe1a85ec53ULL;
+    hash_ ^= hash_ >> 33;
+    return hash_;
+  }
+
+  void sample(unsigned shard_, const Key& key_) {
+    HotKeySketch& sketch = *sketches_[shard_];
+    std::unique_lock<std::mutex> lock(sketch.m, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return; // only a sample, not worth a wait on the send path
+    }
+    std::vector<HotKey>& keys = sketch.keys;
+    typename std::vector<HotKey>::iterator found = keys.begin();
+    for (; found != keys.end() && !(found->first == key_); ++found) {}
+    if (found != keys.end()) {
+      ++found->second;
+      return;
+    }
+    if (keys.size() < c_hot_key_capacity) {
+      keys.push_back(HotKey(key_, 1));
+      return;
+    }
+    // space saving: the new key replaces the least counted one and inherits its count
+    typename std::vector<HotKey>::iterator least = keys.begin();
+    for (typename std::vector<HotKey>::iterator it = keys.begin(); it != keys.end(); ++it) {
+      if (it->second < least->second) {
+        least = it;
+      }
+    }
+    least->first = key_;
+    ++least->second;
+  }
+
+  static bool moreJobs(const HotKey& lhs_, const HotKey& rhs_) {
+    return lhs_.second > rhs_.second;
+  }
+
+  static const size_t c_hot_key_capacity = 16;
+
+  std::vector<std::unique_ptr<Active> > shards_;
+  std::unique_ptr<char[]> counter_buffer_;
+  ShardCounter* counters_;             // in counter_buffer_, trivially destructible
+  Hash hash_;
+  const unsigned sample_every_;        // 0: hot-key detection is off
+  std::vector<std::unique_ptr<HotKeySketch> > sketches_; // per shard, empty if detection is off
+
+public:
+  /** @param nbr_shards number of Active objects (threads), at least one
+  *   @param sample_every_nth_key 0 to turn off hot-key detection, otherwise
+  *          on average every Nth sent key is sampled for the top-K sketch
+  *   @throw std::invalid_argument if nbr_shards is 0 */
+  explicit ShardedActive(unsigned nbr_shards, unsigned sample_every_nth_key = 0)
+    : ShardedActive(nbr_shards, ActiveOptions(), sample_every_nth_key) {}
+
+  /// As above, each shard is made with 'options', see Active::createActive.
+  /// @throw std::system_error if a shard's thread cannot be started with the options
+  ShardedActive(unsigned nbr_shards, const ActiveOptions& options, unsigned sample_every_nth_key = 0)
+    : counters_(nullptr)
+    , sample_every_(sample_every_nth_key) {
+    if (0 == nbr_shards) {
+      throw std::invalid_argument("ShardedActive: at least one shard is needed");
+    }
+    counter_buffer_.reset(new char[nbr_shards * sizeof(ShardCounter) + c_cache_line]);
+    const uintptr_t aligned = (reinterpret_cast<uintptr_t>(counter_buffer_.get()) + c_cache_line - 1) & ~(c_cache_line - 1);
+    counters_ = reinterpret_cast<ShardCounter*>(aligned);
+    for (unsigned idx = 0; idx < nbr_shards; ++idx) {
+      new (&counters_[idx]) ShardCounter();
+      shards_.push_back(Active::createActive(options));
+      if (sample_every_) {
+        sketches_.push_back(std::unique_ptr<HotKeySketch>(new HotKeySketch));
+      }
+    }
+  }
+
+  /// Drains, and stops, all the shards
+  virtual ~ShardedActive() {}
+
+  /// @return the shard that 'key' is, and always will be, sent to
+  unsigned shardFor(const Key& key_) const {
+    return static_cast<unsigned>(mix(static_cast<uint64_t>(hash_(key_))) % shards_.size());
+  }
+
+  /// Jobs with the same key are executed in FIFO order
+  /// @return false if the shard rejected or dropped the job, see overflow_policy
+  bool send(const Key& key_, Job msg_) {
+    const unsigned shard = shardFor(key_);
+    if (!shards_[shard]->send(std::move(msg_))) {
+      return false;
+    }
+    const uint64_t tick = counters_[shard].sent.fetch_add(1, std::memory_order_relaxed);
+    // the shard's count is mixed so that a periodic key pattern cannot hide from the sampling
+    if (sample_every_ && 0 == mix(tick) % sample_every_) {
+      sample(shard, key_);
+    }
+    return true;
+  }
+
+  /// Request/response job, see Active::call. A rejected job breaks the future
+  template<typename F>
+  active_future<typename std::result_of<F()>::type> call(const Key& key_, F func) {
+    ShardSender sender = { this, shardFor(key_) };
+    return call_on(sender, std::move(func));
+  }
+
+  unsigned size() const { return static_cast<unsigned>(shards_.size()); }
+
+  ShardStats stats() const {
+    ShardStats stats;
+    uint64_t total = 0;
+    uint64_t busiest = 0;
+    for (size_t idx = 0; idx < shards_.size(); ++idx) {
+      uint64_t sent = counters_[idx].sent.load(std::memory_order_relaxed);
+      stats.sent.push_back(sent);
+      total += sent;
+      busiest = std::max(busiest, sent);
+    }
+    stats.imbalance = (0 == total) ? 1.0 : busiest / (static_cast<double>(total) / shards_.size());
+    return stats;
+  }
+
+  /// @return the sampled hot keys, most jobs first, with the estimated
+  /// number of jobs. Empty if hot-key detection is off
+  std::vector<HotKey> hotKeys() const {
+    std::vector<HotKey> hot;
+    for (size_t idx = 0; idx < sketches_.size(); ++idx) {
+      std::lock_guard<std::mutex> lock(sketches_[idx]->m);
+      hot.insert(hot.end(), sketches_[idx]->keys.begin(), sketches_[idx]->keys.end());
+    }
+    std::sort(hot.begin(), hot.end(), &ShardedActive::moreJobs);
+    if (hot.size() > c_hot_key_capacity) {
+      hot.erase(hot.begin() + c_hot_key_capacity, hot.end());
+    }
+    for (size_t idx = 0; idx < hot.size(); ++idx) {
+      hot[idx].second *= sample_every_;
+    }
+    return hot;
+  }
+};
+} // end namespace kjellkod
+
+#endif
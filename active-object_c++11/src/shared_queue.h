@@ -10,35 +10,250 @@
 * ref: http://www.stdthread.co.uk/doc/headers/mutex.html
 *
 * This example was inspired by Anthony Williams lock-based data structures in
-* Ref: "C++ Concurrency In Action" http://www.manning.com/williams */
+* Ref: "C++ Concurrency In Action" http://www.manning.com/williams
+*
+* The queue is unbounded by default. With a capacity the memory stays bounded
+* when the consumer stalls, what happens to a push on a full queue is decided
+* by the overflow_policy, see overflow_policy.h
+*
+* close() is for a consumer that is about to go away: every later push fails,
+* also the ones that are blocked on a full queue, so an item is either
+* queued before the close, and can still be taken, or its push fails */
 
 #ifndef SHARED_QUEUE
 #define SHARED_QUEUE
 
 #include <queue>
 #include <mutex>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
 #include <exception>
 #include <condition_variable>
 
+#include "overflow_policy.h"
+
 /** Multiple producer, multiple consumer thread safe queue
-* Since 'return by reference' is used this queue won't throw */
+* Since 'return by reference' is used this queue won't throw.
+* Items are moved in and out, move-only types such as a Job are fine */
 template<typename T>
 class shared_queue
 {
   std::queue<T> queue_;
   mutable std::mutex m_;
   std::condition_variable data_cond_;
+  std::condition_variable room_cond_;  // producers blocked on a full queue
+  const size_t capacity_;              // 0: unbounded
+  const overflow_policy policy_;
+  unsigned waiting_producers_;
+  unsigned waiting_consumers_;
+  uint64_t rejected_;
+  uint64_t dropped_;
+  bool closed_;
 
   shared_queue& operator=(const shared_queue&) = delete;
   shared_queue(const shared_queue& other) = delete;
 
+  // lock must be held
+  bool full() const{
+    return capacity_ != 0 && queue_.size() >= capacity_;
+  }
+
+  // lock must be held. Only blocked producers are woken up, an unbounded
+  // queue, or a queue that is not full, costs nothing extra
+  void madeRoom(){
+    if(waiting_producers_ != 0){
+      room_cond_.notify_all();
+    }
+  }
+
+  // lock must be held. Same for consumers, a consumer that polls with
+  // try_and_pop_all never costs the producers a notify
+  void wakeConsumer(){
+    if(waiting_consumers_ != 0){
+      data_cond_.notify_one();
+    }
+  }
+
+  // lock must be held
+  void takeAll(std::queue<T>& popped_items){
+    if(popped_items.empty()){
+      queue_.swap(popped_items);
+    } else {
+      while(!queue_.empty()){
+        popped_items.push(std::move(queue_.front()));
+        queue_.pop();
+      }
+    }
+    madeRoom();
+  }
+
+  // lock must be held. 'waitForRoom' is only used with the block policy and
+  // returns false if the producer gave up waiting. The consumer is not
+  // notified, except before waiting for room (it may sleep on items from this batch).
+  // The item is made from 'args' in the queue, and only if it is queued
+  template<typename WaitForRoom, typename... Args>
+  bool queueWithPolicy(std::unique_lock<std::mutex>& lock, WaitForRoom waitForRoom, Args&&... args){
+    if(closed_){
+      ++rejected_;
+      return false;
+    }
+    if(full()){
+      switch(policy_){
+      case overflow_policy::block:{
+        wakeConsumer();
+        ++waiting_producers_;
+        const bool room = waitForRoom(lock);
+        --waiting_producers_;
+        if(!room || closed_){
+          ++rejected_;
+          return false;
+        }
+        break;
+      }
+      case overflow_policy::reject:
+        ++rejected_;
+        return false;
+      case overflow_policy::drop_oldest:
+        queue_.pop();
+        ++dropped_;
+        break;
+      case overflow_policy::drop_newest:
+        ++dropped_;
+        return false;
+      }
+    }
+    queue_.emplace(std::forward<Args>(args)...);
+    return true;
+  }
+
+  // lock must be held
+  template<typename WaitForRoom, typename... Args>
+  bool pushWithPolicy(std::unique_lock<std::mutex>& lock, WaitForRoom waitForRoom, Args&&... args){
+    if(!queueWithPolicy(lock, waitForRoom, std::forward<Args>(args)...)){
+      return false;
+    }
+    wakeConsumer();
+    return true;
+  }
+
+  // lock must be held, the block policy's wait
+  bool waitTillRoom(std::unique_lock<std::mutex>& waiting){
+    while(full() && !closed_){
+      room_cond_.wait(waiting);
+    }
+    return true;
+  }
+
 public:
-  shared_queue(){}
+  /// @param capacity 0 for an unbounded queue
+  /// @param policy what a push to a full queue does
+  explicit shared_queue(size_t capacity = 0, overflow_policy policy = overflow_policy::block)
+    : capacity_(capacity)
+    , policy_(policy)
+    , waiting_producers_(0)
+    , waiting_consumers_(0)
+    , rejected_(0)
+    , dropped_(0)
+    , closed_(false){}
+
+  /// \return false if the item was rejected or dropped (drop_newest)
+  bool push(const T& item){
+    return emplace(item);
+  }
+
+  bool push(T&& item){
+    return emplace(std::move(item));
+  }
+
+  /// As push but the item is made from 'args' in the queue, under the lock.
+  /// Nothing is made if the item is rejected or dropped (drop_newest)
+  template<typename... Args>
+  bool emplace(Args&&... args){
+    std::unique_lock<std::mutex> lock(m_);
+    return pushWithPolicy(lock, [this](std::unique_lock<std::mutex>& waiting){ return waitTillRoom(waiting); },
+                          std::forward<Args>(args)...);
+  }
+
+  /// Pushes all items in [first, last) with a single lock acquisition and a
+  /// single notify. Each item is handled as by push(), i.e. with the block
+  /// policy a full queue makes the rest of the batch wait for room.
+  /// Move-only items are moved in with std::make_move_iterator
+  /// \return number of items that were queued
+  template<typename InputIt>
+  size_t push_range(InputIt first, InputIt last){
+    return push_range(first, last, [](){});
+  }
 
-  void push(T item){
+  /// As above. 'beforeWait' is called, without the lock, before the producer
+  /// waits for room. For a consumer that does not sleep on this queue
+  template<typename InputIt, typename BeforeWait>
+  size_t push_range(InputIt first, InputIt last, BeforeWait beforeWait){
+    size_t queued = 0;
+    std::unique_lock<std::mutex> lock(m_);
+    for(; first != last; ++first){
+      if(queueWithPolicy(lock, [&](std::unique_lock<std::mutex>& waiting){
+           waiting.unlock();
+           beforeWait();
+           waiting.lock();
+           return waitTillRoom(waiting);
+         }, *first)){
+        ++queued;
+      }
+    }
+    if(queued != 0){
+      wakeConsumer();
+    }
+    return queued;
+  }
+
+  /// Never waits, with the block policy a full queue rejects the item
+  bool try_push(T item){
+    std::unique_lock<std::mutex> lock(m_);
+    return pushWithPolicy(lock, [](std::unique_lock<std::mutex>&){ return false; }, std::move(item));
+  }
+
+  /// As push but with the block policy the item is rejected if there is
+  /// still no room after 'timeout'
+  template<typename Rep, typename Period>
+  bool push_for(T item, const std::chrono::duration<Rep, Period>& timeout){
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(m_);
+    return pushWithPolicy(lock, [this, deadline](std::unique_lock<std::mutex>& waiting){
+      while(full() && !closed_){
+        if(std::cv_status::timeout == room_cond_.wait_until(waiting, deadline)){
+          return !full();
+        }
+      }
+      return true;
+    }, std::move(item));
+  }
+
+  /// Queued even if the queue is full, whatever the policy. For the few
+  /// control messages that must never be lost, e.g. a quit or flush message
+  /// \return false only if the queue is closed
+  bool force_push(T item){
+    std::lock_guard<std::mutex> lock(m_);
+    if(closed_){
+      return false;
+    }
+    queue_.push(std::move(item));
+    wakeConsumer();
+    return true;
+  }
+
+  /// Every later push fails, producers that wait for room give up. The
+  /// queued items can still be taken
+  void close(){
     std::lock_guard<std::mutex> lock(m_);
-    queue_.push(item);
-    data_cond_.notify_one();
+    closed_ = true;
+    madeRoom();
+  }
+
+  bool closed() const{
+    std::lock_guard<std::mutex> lock(m_);
+    return closed_;
   }
 
   /// \return immediately, with true if successful retrieval
@@ -47,20 +262,49 @@ public:
     if(queue_.empty()){
       return false;
     }
-    popped_item=queue_.front();
+    popped_item=std::move(queue_.front());
     queue_.pop();
+    madeRoom();
     return true;
   }
 
   /// Try to retrieve, if no items, wait till an item is available and try again
   void wait_and_pop(T& popped_item){
     std::unique_lock<std::mutex> lock(m_); // note: unique_lock is needed for std::condition_variable::wait
+    ++waiting_consumers_;
     while(queue_.empty())
     { //                       The 'while' loop below is equal to
       data_cond_.wait(lock);  //data_cond_.wait(lock, [](bool result){return !queue_.empty();});
     }
-    popped_item=queue_.front();
+    --waiting_consumers_;
+    popped_item=std::move(queue_.front());
     queue_.pop();
+    madeRoom();
+  }
+
+  /// Swap-and-drain: takes ALL queued items with a single lock acquisition.
+  /// If 'popped_items' is empty the containers are just swapped, otherwise
+  /// the items are appended after the ones already in 'popped_items'
+  /// \return immediately, with true if any items were retrieved
+  bool try_and_pop_all(std::queue<T>& popped_items){
+    std::lock_guard<std::mutex> lock(m_);
+    if(queue_.empty()){
+      return false;
+    }
+    takeAll(popped_items);
+    return true;
+  }
+
+  /// Same as try_and_pop_all but waits till at least one item is available
+  void wait_and_pop_all(std::queue<T>& popped_items){
+    std::unique_lock<std::mutex> lock(m_);
+    ++waiting_consumers_;
+    while(queue_.empty())
+    {
+      data_cond_.wait(lock);
+    }
+    --waiting_consumers_;
+    takeAll(popped_items);
   }
 
   bool empty() const{
@@ -72,6 +316,24 @@ public:
     std::lock_guard<std::mutex> lock(m_);
     return queue_.size();
   }
+
+  /// 0 if unbounded
+  size_t capacity() const{
+    return capacity_;
+  }
+
+  /// pushes that failed: the reject policy, try_push, a push_for timeout
+  /// or a closed queue
+  uint64_t rejected() const{
+    std::lock_guard<std::mutex> lock(m_);
+    return rejected_;
+  }
+
+  /// items thrown away by the drop_oldest and drop_newest policies
+  uint64_t dropped() const{
+    std::lock_guard<std::mutex> lock(m_);
+    return dropped_;
+  }
 };
 
 #endif
@@ -0,0 +1,261 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* spill_journal: a FIFO of byte records in memory-mapped segment files, the
+* disk part of a spill_queue (spill_queue.h). (POSIX only)
+*
+* A record is a 32 bit length followed by the bytes. Records are appended
+* to the last segment and read from the first one. A segment that has been
+* read to its end is unmapped and kept for reuse, a full journal does not
+* create a new file per segment once it has run for a while.
+*
+* At most two segments are mapped: the one that is written and the one that
+* is read. The other segments are only file descriptors, their pages are in
+* the page cache and can be written back and dropped by the kernel, they are
+* not part of the process' resident memory.
+*
+* The files are unlinked as soon as they are opened, nothing is left on
+* disk when the process exits or crashes. The journal is an overflow area,
+* it is not a persistent log that survives a restart.
+*
+* Not thread safe, spill_queue holds its lock around each call. */
+
+#ifndef SPILL_JOURNAL_H_
+#define SPILL_JOURNAL_H_
+
+#if defined(__unix__)
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace kjellkod {
+
+/// Serializer of a value that can be spilled: the number of bytes, the
+/// bytes, and the value read back from them. Specialize it for own types.
+/// Trivially copyable types and std::string have one already
+template<typename T, typename Enable = void>
+struct spill_codec;
+
+template<typename T>
+struct spill_codec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+  static size_t size(const T&) { return sizeof(T); }
+  static void write(const T& value_, char* to_) { std::memcpy(to_, &value_, sizeof(T)); }
+  static T read(const char* from_, size_t) {
+    T value;
+    std::memcpy(&value, from_, sizeof(T));
+    return value;
+  }
+};
+
+template<>
+struct spill_codec<std::string> {
+  static size_t size(const std::string& value_) { return value_.size(); }
+  static void write(const std::string& value_, char* to_) { std::memcpy(to_, value_.data(), value_.size()); }
+  static std::string read(const char* from_, size_t bytes_) { return std::string(from_, bytes_); }
+};
+
+
+/// Where and in what sizes a spill_queue puts what does not fit in memory
+struct spill_options {
+  std::string directory;  // for the segment files, they are unlinked right away
+  size_t memory_items;    // values kept in memory before the queue spills
+  size_t segment_bytes;   // size of one segment file, also the max record size
+  size_t spare_segments;  // read segments kept for reuse, the others are closed
+
+  spill_options()
+    : directory("/tmp")
+    , memory_items(100000)
+    , segment_bytes(64 * 1024 * 1024)
+    , spare_segments(2) {}
+};
+
+
+class spill_journal {
+  struct Segment {
+    int fd;
+    char* data;         // nullptr while unmapped
+    size_t write_pos;
+    size_t read_pos;
+  };
+
+  const spill_options options_;
+  std::deque<Segment> segments_;  // front: read, back: write
+  std::vector<int> spare_;        // fds of read segments, for reuse
+  size_t records_;
+  size_t files_;
+
+  spill_journal(const spill_journal&) = delete;
+  spill_journal& operator=(const spill_journal&) = delete;
+
+  static void throwErrno(int error_, const char* what_) {
+    throw std::system_error(error_, std::system_category(), what_);
+  }
+
+  // the space is allocated up front: a full disk is an exception here,
+  // not a SIGBUS when the mapping is written
+  int openSegment() {
+    static std::atomic<unsigned> s_count(0);
+    const std::string path = options_.directory + "/active-spill-" + std::to_string(getpid())
+                           + "-" + std::to_string(s_count.fetch_add(1, std::memory_order_relaxed));
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (-1 == fd) {
+      throwErrno(errno, "spill_journal: open");
+    }
+    unlink(path.c_str());
+    const int error = posix_fallocate(fd, 0, static_cast<off_t>(options_.segment_bytes));
+    if (0 != error) {
+      close(fd);
+      throwErrno(error, "spill_journal: posix_fallocate");
+    }
+    ++files_;
+    return fd;
+  }
+
+  void map(Segment& segment_) {
+    if (nullptr != segment_.data) {
+      return;
+    }
+    void* data = mmap(nullptr, options_.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment_.fd, 0);
+    if (MAP_FAILED == data) {
+      throwErrno(errno, "spill_journal: mmap");
+    }
+    segment_.data = static_cast<char*>(data);
+  }
+
+  void unmap(Segment& segment_) {
+    if (nullptr != segment_.data) {
+      munmap(segment_.data, options_.segment_bytes);
+      segment_.data = nullptr;
+    }
+  }
+
+  // a new write segment, a spare one if there is one
+  void addSegment() {
+    int fd = -1;
+    if (spare_.empty()) {
+      fd = openSegment();
+    } else {
+      fd = spare_.back();
+      spare_.pop_back();
+    }
+    Segment segment = { fd, nullptr, 0, 0 };
+    try {
+      map(segment);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    if (segments_.size() > 1) {
+      unmap(segments_.back()); // full, and not the read segment: paged out until it is read
+    }
+    segments_.push_back(segment);
+  }
+
+  // the front segment is read to its end
+  void recycleFront() {
+    Segment& front = segments_.front();
+    unmap(front);
+    if (spare_.size() < options_.spare_segments) {
+      spare_.push_back(front.fd);
+    } else {
+      close(front.fd);
+    }
+    segments_.pop_front();
+  }
+
+public:
+  /// @param options_ only directory, segment_bytes and spare_segments are used
+  explicit spill_journal(const spill_options& options)
+    : options_(options)
+    , records_(0)
+    , files_(0) {
+    if (options_.segment_bytes <= sizeof(uint32_t)) {
+      throw std::invalid_argument("spill_journal: segment_bytes is too small");
+    }
+  }
+
+  ~spill_journal() {
+    while (!segments_.empty()) {
+      recycleFront();
+    }
+    for (size_t idx = 0; idx < spare_.size(); ++idx) {
+      close(spare_[idx]);
+    }
+  }
+
+  /// Appends one record of 'bytes_' bytes, 'write_(char*)' fills it in
+  /// @throw std::length_error if the record does not fit in a segment,
+  ///        std::system_error if a segment file cannot be made
+  template<typename Write>
+  void append(size_t bytes_, Write write_) {
+    const size_t needed = sizeof(uint32_t) + bytes_;
+    if (needed > options_.segment_bytes || bytes_ > UINT32_MAX) {
+      throw std::length_error("spill_journal: record larger than a segment");
+    }
+    if (segments_.empty() || segments_.back().write_pos + needed > options_.segment_bytes) {
+      addSegment();
+    }
+    Segment& back = segments_.back();
+    const uint32_t length = static_cast<uint32_t>(bytes_);
+    std::memcpy(back.data + back.write_pos, &length, sizeof(length));
+    write_(back.data + back.write_pos + sizeof(length));
+    back.write_pos += needed;
+    ++records_;
+  }
+
+  /// Reads the oldest record with 'read_(const char*, size_t)' and removes it
+  /// @return false if the journal is empty
+  template<typename Read>
+  bool pop(Read read_) {
+    if (0 == records_) {
+      return false;
+    }
+    Segment* front = &segments_.front();
+    if (front->read_pos == front->write_pos) {
+      recycleFront(); // the records left are in the next segment
+      front = &segments_.front();
+    }
+    map(*front);
+    uint32_t length = 0;
+    std::memcpy(&length, front->data + front->read_pos, sizeof(length));
+    read_(static_cast<const char*>(front->data + front->read_pos + sizeof(length)), static_cast<size_t>(length));
+    front->read_pos += sizeof(length) + length;
+    if (0 == --records_) {
+      // empty: the only segment left is written again from its start
+      while (segments_.size() > 1) {
+        recycleFront();
+      }
+      segments_.front().read_pos = segments_.front().write_pos = 0;
+    }
+    return true;
+  }
+
+  /// records in the journal
+  size_t size() const { return records_; }
+  bool empty() const { return 0 == records_; }
+
+  /// segments in use, and segment files created so far (less than the
+  /// segments used over time when the spare ones are reused)
+  size_t segments() const { return segments_.size(); }
+  size_t files() const { return files_; }
+};
+} // end namespace kjellkod
+
+#endif // __unix__
+#endif
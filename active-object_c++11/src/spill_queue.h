@@ -0,0 +1,157 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* spill_queue: an unbounded FIFO of values that spills to disk. The first
+* 'memory_items' values are queued in memory. Past that, new values are
+* serialized (spill_codec) and appended to a memory-mapped spill_journal,
+* and they are read back, in order, once the memory part is empty.
+*
+* A producer is never blocked and nothing is dropped, as with an unbounded
+* shared_queue, but the resident memory stays bounded: at most
+* 'memory_items' values plus the two mapped segments of the journal. The
+* alternatives for a slow consumer are a bounded queue with an
+* overflow_policy, i.e. a producer that waits or values that are lost.
+*
+* FIFO order holds across the two parts: while anything is in the journal
+* new values go to the journal too, also if there is room in memory again.
+*
+* Values, not Jobs: a closure cannot be written to a file. Backgrounder
+* uses it in its spill mode for the values that it stores. (POSIX only) */
+
+#ifndef SPILL_QUEUE_H_
+#define SPILL_QUEUE_H_
+
+#if defined(__unix__)
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+#include "spill_journal.h"
+
+namespace kjellkod {
+
+template<typename T, typename Codec = spill_codec<T> >
+class spill_queue {
+  std::queue<T> memory_;
+  spill_journal journal_;
+  const size_t memory_items_;
+  mutable std::mutex m_;
+  std::condition_variable data_cond_;
+  unsigned waiting_consumers_;
+
+  spill_queue(const spill_queue&) = delete;
+  spill_queue& operator=(const spill_queue&) = delete;
+
+  // lock must be held
+  void spill(const T& item_) {
+    journal_.append(Codec::size(item_), [&item_](char* to_) { Codec::write(item_, to_); });
+  }
+
+  // lock must be held. The memory part, or if it is empty a batch of at
+  // most 'memory_items' values read back from the journal
+  bool takeAll(std::queue<T>& popped_items_) {
+    if (!memory_.empty()) {
+      if (popped_items_.empty()) {
+        memory_.swap(popped_items_);
+      } else {
+        while (!memory_.empty()) {
+          popped_items_.push(std::move(memory_.front()));
+          memory_.pop();
+        }
+      }
+      return true;
+    }
+    size_t count = 0;
+    while (count < memory_items_ && journal_.pop([&popped_items_](const char* from_, size_t bytes_) {
+             popped_items_.push(Codec::read(from_, bytes_));
+           })) {
+      ++count;
+    }
+    return count > 0;
+  }
+
+public:
+  /// @throw std::invalid_argument, std::system_error: see spill_journal
+  explicit spill_queue(const spill_options& options_ = spill_options())
+    : journal_(options_)
+    , memory_items_(options_.memory_items ? options_.memory_items : 1)
+    , waiting_consumers_(0) {}
+
+  /// Always queued, in memory or in the journal
+  /// @throw std::length_error, std::system_error if it had to be spilled
+  ///        and the journal could not take it
+  void push(const T& item_) {
+    std::lock_guard<std::mutex> lock(m_);
+    if (journal_.empty() && memory_.size() < memory_items_) {
+      memory_.push(item_);
+    } else {
+      spill(item_);
+    }
+    if (waiting_consumers_ != 0) {
+      data_cond_.notify_one();
+    }
+  }
+
+  void push(T&& item_) {
+    std::lock_guard<std::mutex> lock(m_);
+    if (journal_.empty() && memory_.size() < memory_items_) {
+      memory_.push(std::move(item_));
+    } else {
+      spill(item_);
+    }
+    if (waiting_consumers_ != 0) {
+      data_cond_.notify_one();
+    }
+  }
+
+  /// Swap-and-drain as shared_queue::try_and_pop_all. All values in memory
+  /// or, when only the journal has values, the next 'memory_items' of them
+  /// \return immediately, with true if any items were retrieved
+  bool try_and_pop_all(std::queue<T>& popped_items_) {
+    std::lock_guard<std::mutex> lock(m_);
+    return takeAll(popped_items_);
+  }
+
+  /// Same as try_and_pop_all but waits till at least one item is available
+  void wait_and_pop_all(std::queue<T>& popped_items_) {
+    std::unique_lock<std::mutex> lock(m_);
+    ++waiting_consumers_;
+    while (!takeAll(popped_items_)) {
+      data_cond_.wait(lock);
+    }
+    --waiting_consumers_;
+  }
+
+  bool empty() const {
+    std::lock_guard<std::mutex> lock(m_);
+    return memory_.empty() && journal_.empty();
+  }
+
+  /// values in memory and in the journal
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(m_);
+    return memory_.size() + journal_.size();
+  }
+
+  /// values in the journal
+  size_t spilled() const {
+    std::lock_guard<std::mutex> lock(m_);
+    return journal_.size();
+  }
+
+  /// segment files created so far, see spill_journal::files
+  size_t files() const {
+    std::lock_guard<std::mutex> lock(m_);
+    return journal_.files();
+  }
+};
+} // end namespace kjellkod
+
+#endif // __unix__
+#endif
@@ -0,0 +1,361 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Hierarchical timing wheel, 4 levels of 256 slots. Level 0 holds the timers
+* that expire within 256 ticks, level 1 within 256^2 ticks and so on. When
+* level 0 wraps around the next level 1 slot is cascaded down, i.e. a timer
+* is moved at most 3 times before it expires.
+*
+* Insert and cancel are O(1): a timer is a node in an intrusive list and
+* the id maps to its node. Nodes are recycled. Empty stretches of time are
+* skipped with a bitmap of the occupied slots, so advancing after a long
+* sleep does not visit every tick.
+*
+* NOT thread safe, the Active owns one and only touches it on its own
+* thread. A timer never fires early, at worst one tick late. */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+template<typename Job>
+class timer_wheel {
+public:
+  typedef std::chrono::steady_clock clock;
+  typedef uint64_t timer_id;
+
+  static const unsigned c_levels = 4;
+  static const unsigned c_slot_bits = 8;
+  static const unsigned c_slots = 1 << c_slot_bits;
+
+private:
+  struct Node {
+    Node* prev;
+    Node* next;
+    timer_id id;
+    uint64_t expires; // tick
+    uint64_t period;  // ticks, 0 for a one shot timer
+    unsigned level;
+    unsigned slot;
+    bool cancelled;   // cancelled by its own job
+    Job job;
+  };
+
+  // circular list per slot, the head is the oldest timer
+  struct Level {
+    Node* slots[c_slots];
+    uint64_t occupied[c_slots / 64];
+  };
+
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+
+  static unsigned firstSetFrom(const uint64_t* bits_, unsigned from_);
+
+  uint64_t toTick(clock::time_point when_) const {
+    if (when_ <= origin_) {
+      return 0;
+    }
+    const clock::duration since = when_ - origin_;
+    return static_cast<uint64_t>((since + tick_ - clock::duration(1)) / tick_); // rounded up, never early
+  }
+
+  void link(Node* node_, unsigned level_, unsigned slot_);
+  void unlink(Node* node_);
+  void place(Node* node_);
+  void cascade(unsigned level_, unsigned slot_);
+  size_t expire(unsigned slot_);
+  uint64_t nextEventTick() const;
+  void release(Node* node_);
+
+  const clock::time_point origin_;
+  const clock::duration tick_;
+  uint64_t now_;      // the next tick to process
+  uint64_t target_;   // the last tick to process in this advance()
+  Level levels_[c_levels];
+  std::unordered_map<timer_id, Node*> timers_;
+  std::vector<Node*> free_;
+  Node* running_;
+
+public:
+  explicit timer_wheel(clock::duration tick_size_ = std::chrono::milliseconds(1),
+                       clock::time_point origin_time_ = clock::now());
+  ~timer_wheel();
+
+  /// @param period_ zero for a one shot timer, otherwise the job is repeated
+  ///        every period (fixed rate, missed periods are skipped, not bunched up)
+  void add(timer_id id_, clock::time_point when_, Job job_, clock::duration period_ = clock::duration::zero());
+
+  /// Also works from the timer's own job, e.g. a periodic job that stops itself
+  /// @return false if the timer is unknown or has already expired
+  bool cancel(timer_id id_);
+
+  /// Runs the jobs of all timers that are due at 'now'
+  /// @return number of jobs that were run
+  size_t advance(clock::time_point now_time_);
+
+  /// Earliest time that advance() can have something to do. May be a
+  /// cascade instead of an expiry, i.e. it is a lower bound. Only valid if !empty()
+  clock::time_point next_deadline() const { return origin_ + tick_ * static_cast<clock::rep>(nextEventTick()); }
+
+  bool empty() const { return timers_.empty(); }
+  size_t size() const { return timers_.size(); }
+};
+
+
+template<typename Job>
+timer_wheel<Job>::timer_wheel(clock::duration tick_size_, clock::time_point origin_time_)
+  : origin_(origin_time_), tick_(tick_size_), now_(0), target_(0), running_(nullptr) {
+  for (unsigned level = 0; level < c_levels; ++level) {
+    for (unsigned slot = 0; slot < c_slots; ++slot) {
+      levels_[level].slots[slot] = nullptr;
+    }
+    for (unsigned word = 0; word < c_slots / 64; ++word) {
+      levels_[level].occupied[word] = 0;
+    }
+  }
+}
+
+template<typename Job>
+timer_wheel<Job>::~timer_wheel() {
+  for (typename std::unordered_map<timer_id, Node*>::iterator it = timers_.begin(); it != timers_.end(); ++it) {
+    delete it->second;
+  }
+  for (size_t idx = 0; idx < free_.size(); ++idx) {
+    delete free_[idx];
+  }
+}
+
+// first set bit at or after 'from', wrapping around. At least one bit must be set
+template<typename Job>
+unsigned timer_wheel<Job>::firstSetFrom(const uint64_t* bits_, unsigned from_) {
+  for (unsigned count = 0; count <= c_slots / 64; ++count) {
+    const unsigned word = ((from_ / 64) + count) % (c_slots / 64);
+    uint64_t bits = bits_[word];
+    if (0 == count) {
+      bits &= ~uint64_t(0) << (from_ % 64);
+    }
+    if (bits) {
+#if defined(__GNUC__)
+      return word * 64 + __builtin_ctzll(bits);
+#else
+      unsigned bit = 0;
+      while (!(bits & (uint64_t(1) << bit))) {
+        ++bit;
+      }
+      return word * 64 + bit;
+#endif
+    }
+  }
+  return from_; // only the bits below 'from' in its own word are set
+}
+
+template<typename Job>
+void timer_wheel<Job>::link(Node* node_, unsigned level_, unsigned slot_) {
+  node_->level = level_;
+  node_->slot = slot_;
+  Node*& head = levels_[level_].slots[slot_];
+  if (!head) {
+    node_->prev = node_->next = node_;
+    head = node_;
+    levels_[level_].occupied[slot_ / 64] |= uint64_t(1) << (slot_ % 64);
+    return;
+  }
+  node_->next = head;
+  node_->prev = head->prev;
+  head->prev->next = node_;
+  head->prev = node_;
+}
+
+template<typename Job>
+void timer_wheel<Job>::unlink(Node* node_) {
+  Node*& head = levels_[node_->level].slots[node_->slot];
+  if (node_->next == node_) {
+    head = nullptr;
+    levels_[node_->level].occupied[node_->slot / 64] &= ~(uint64_t(1) << (node_->slot % 64));
+    return;
+  }
+  node_->prev->next = node_->next;
+  node_->next->prev = node_->prev;
+  if (head == node_) {
+    head = node_->next;
+  }
+}
+
+// level by distance to 'now', slot by the expiry's bits for that level.
+// Timers beyond the last level are parked at its far end and re-placed when cascaded
+template<typename Job>
+void timer_wheel<Job>::place(Node* node_) {
+  if (node_->expires < now_) {
+    node_->expires = now_;
+  }
+  const uint64_t delta = node_->expires - now_;
+  unsigned level = 0;
+  while (level < c_levels - 1 && delta >= (uint64_t(1) << (c_slot_bits * (level + 1)))) {
+    ++level;
+  }
+  uint64_t at = node_->expires;
+  const uint64_t c_horizon = uint64_t(1) << (c_slot_bits * c_levels);
+  if (delta >= c_horizon) {
+    at = now_ + c_horizon - 1;
+  }
+  link(node_, level, (at >> (c_slot_bits * level)) & (c_slots - 1));
+}
+
+// the slot is detached first, a parked timer can be placed in the same slot again
+template<typename Job>
+void timer_wheel<Job>::cascade(unsigned level_, unsigned slot_) {
+  Node* node = levels_[level_].slots[slot_];
+  if (!node) {
+    return;
+  }
+  node->prev->next = nullptr;
+  levels_[level_].slots[slot_] = nullptr;
+  levels_[level_].occupied[slot_ / 64] &= ~(uint64_t(1) << (slot_ % 64));
+  while (node) {
+    Node* next = node->next;
+    place(node);
+    node = next;
+  }
+}
+
+// one node at a time, a job may add or cancel timers in the same slot
+template<typename Job>
+size_t timer_wheel<Job>::expire(unsigned slot_) {
+  size_t fired = 0;
+  Node*& head = levels_[0].slots[slot_];
+  while (head) {
+    Node* node = head;
+    ++fired;
+    unlink(node);
+    running_ = node;
+    node->job();
+    running_ = nullptr;
+    if (node->period && !node->cancelled) {
+      node->expires += node->period;
+      if (node->expires <= target_) {
+        node->expires += ((target_ - node->expires) / node->period + 1) * node->period;
+      }
+      place(node);
+    } else {
+      timers_.erase(node->id);
+      release(node);
+    }
+  }
+  return fired;
+}
+
+// the tick where the next occupied slot, on any level, is expired or cascaded
+template<typename Job>
+uint64_t timer_wheel<Job>::nextEventTick() const {
+  uint64_t next = ~uint64_t(0);
+  for (unsigned level = 0; level < c_levels; ++level) {
+    const Level& wheel = levels_[level];
+    bool occupied = false;
+    for (unsigned word = 0; word < c_slots / 64; ++word) {
+      occupied = occupied || (0 != wheel.occupied[word]);
+    }
+    if (!occupied) {
+      continue;
+    }
+    const unsigned shift = c_slot_bits * level;
+    const uint64_t lower = (uint64_t(1) << shift) - 1;
+    const unsigned current = (now_ >> shift) & (c_slots - 1);
+    // above level 0 the current slot was cascaded already, unless now_ is the cascade tick
+    const unsigned from = (0 == level || 0 == (now_ & lower)) ? current : (current + 1) % c_slots;
+    const unsigned slot = firstSetFrom(wheel.occupied, from);
+    const uint64_t rotation = uint64_t(1) << (shift + c_slot_bits);
+    uint64_t tick = (now_ & ~(rotation - 1)) + (uint64_t(slot) << shift);
+    if (tick < now_) {
+      tick += rotation;
+    }
+    if (tick < next) {
+      next = tick;
+    }
+  }
+  return next;
+}
+
+template<typename Job>
+void timer_wheel<Job>::release(Node* node_) {
+  node_->job = nullptr;
+  free_.push_back(node_);
+}
+
+
+template<typename Job>
+void timer_wheel<Job>::add(timer_id id_, clock::time_point when_, Job job_, clock::duration period_) {
+  Node* node = nullptr;
+  if (free_.empty()) {
+    node = new Node();
+  } else {
+    node = free_.back();
+    free_.pop_back();
+  }
+  node->id = id_;
+  node->expires = toTick(when_);
+  node->period = 0;
+  if (period_ > clock::duration::zero()) {
+    node->period = static_cast<uint64_t>((period_ + tick_ - clock::duration(1)) / tick_);
+  }
+  node->cancelled = false;
+  node->job = std::move(job_);
+  place(node);
+  timers_[id_] = node;
+}
+
+template<typename Job>
+bool timer_wheel<Job>::cancel(timer_id id_) {
+  typename std::unordered_map<timer_id, Node*>::iterator it = timers_.find(id_);
+  if (it == timers_.end()) {
+    return false;
+  }
+  Node* node = it->second;
+  if (node == running_) {
+    node->cancelled = true; // released by expire() when the job returns
+    return true;
+  }
+  unlink(node);
+  timers_.erase(it);
+  release(node);
+  return true;
+}
+
+template<typename Job>
+size_t timer_wheel<Job>::advance(clock::time_point now_time_) {
+  if (now_time_ < origin_) {
+    return 0;
+  }
+  const uint64_t target = static_cast<uint64_t>((now_time_ - origin_) / tick_);
+  target_ = target;
+  size_t fired = 0;
+  while (!timers_.empty()) {
+    const uint64_t next = nextEventTick();
+    if (next > target) {
+      break;
+    }
+    now_ = next;
+    for (unsigned level = 1; level < c_levels; ++level) {
+      if (0 != (now_ & ((uint64_t(1) << (c_slot_bits * level)) - 1))) {
+        break;
+      }
+      cascade(level, (now_ >> (c_slot_bits * level)) & (c_slots - 1));
+    }
+    fired += expire(now_ & (c_slots - 1));
+    ++now_;
+  }
+  if (now_ <= target) {
+    now_ = target + 1;
+  }
+  return fired;
+}
+
+#endif
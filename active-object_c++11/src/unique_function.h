@@ -0,0 +1,174 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* unique_function<R(Args...), InlineSize>: a move-only replacement for
+* std::function with a small buffer of 'InlineSize' bytes.
+*
+* Callables that fit in the buffer (and can be moved without throwing) are
+* stored inline, i.e. constructing, moving and calling them does NOT touch
+* the heap. Bigger callables fall back to one heap allocation.
+*
+* Since it is move-only it can also hold callables that cannot be
+* copied, such as a functor owning a std::unique_ptr. */
+
+#ifndef UNIQUE_FUNCTION_H_
+#define UNIQUE_FUNCTION_H_
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace kjellkod {
+
+template<typename Signature, size_t InlineSize = 64>
+class unique_function;
+
+
+template<typename R, typename... Args, size_t InlineSize>
+class unique_function<R(Args...), InlineSize> {
+  typedef typename std::aligned_storage<InlineSize, std::alignment_of<std::max_align_t>::value>::type Storage;
+
+  // one static table per stored callable type, i.e. a hand made vtable
+  struct Operations {
+    R (*invoke)(Storage&, Args&&...);
+    void (*move)(Storage& to, Storage& from); // move construct 'to', destroy 'from'
+    void (*destroy)(Storage&);
+  };
+
+  template<typename F>
+  struct Inline {
+    static F* get(Storage& storage_) { return reinterpret_cast<F*>(&storage_); }
+    static R invoke(Storage& storage_, Args&&... args) {
+      return (*get(storage_))(std::forward<Args>(args)...);
+    }
+    static void move(Storage& to_, Storage& from_) {
+      new (&to_) F(std::move(*get(from_)));
+      get(from_)->~F();
+    }
+    static void destroy(Storage& storage_) { get(storage_)->~F(); }
+  };
+
+  template<typename F>
+  struct OnHeap {
+    static F*& get(Storage& storage_) { return *reinterpret_cast<F**>(&storage_); }
+    static R invoke(Storage& storage_, Args&&... args) {
+      return (*get(storage_))(std::forward<Args>(args)...);
+    }
+    static void move(Storage& to_, Storage& from_) {
+      new (&to_) F*(get(from_));
+    }
+    static void destroy(Storage& storage_) { delete get(storage_); }
+  };
+
+  template<typename F>
+  struct FitsInline {
+    static const bool value = sizeof(F) <= sizeof(Storage)
+                              && std::alignment_of<Storage>::value % std::alignment_of<F>::value == 0
+                              && std::is_nothrow_move_constructible<F>::value;
+  };
+
+  template<typename Impl>
+  static const Operations* operationsFor() {
+    static const Operations operations = { &Impl::invoke, &Impl::move, &Impl::destroy };
+    return &operations;
+  }
+
+  template<typename F>
+  void store(F&& f, std::true_type /*inline*/) {
+    typedef typename std::decay<F>::type Callable;
+    new (&storage_) Callable(std::forward<F>(f));
+    operations_ = operationsFor<Inline<Callable> >();
+  }
+
+  template<typename F>
+  void store(F&& f, std::false_type /*inline*/) {
+    typedef typename std::decay<F>::type Callable;
+    new (&storage_) Callable*(new Callable(std::forward<F>(f)));
+    operations_ = operationsFor<OnHeap<Callable> >();
+  }
+
+  template<typename F>
+  static bool isEmpty(const F&) { return false; }
+  template<typename Sig>
+  static bool isEmpty(const std::function<Sig>& f) { return !f; }
+  template<typename Ret, typename... Params>
+  static bool isEmpty(Ret (*f)(Params...)) { return nullptr == f; }
+
+  void reset() {
+    if (operations_) {
+      operations_->destroy(storage_);
+      operations_ = nullptr;
+    }
+  }
+
+  Storage storage_;
+  const Operations* operations_;
+
+  unique_function(const unique_function&) = delete;
+  unique_function& operator=(const unique_function&) = delete;
+
+public:
+  static const size_t inline_size = InlineSize;
+
+  unique_function() : operations_(nullptr) {}
+  unique_function(std::nullptr_t) : operations_(nullptr) {}
+
+  template<typename F, typename = typename std::enable_if<
+             !std::is_same<typename std::decay<F>::type, unique_function>::value>::type>
+  unique_function(F&& f) : operations_(nullptr) {
+    if (isEmpty(f)) {
+      return;
+    }
+    store(std::forward<F>(f), std::integral_constant<bool, FitsInline<typename std::decay<F>::type>::value>());
+  }
+
+  // noexcept, or a callable that holds a unique_function would never fit inline
+  unique_function(unique_function&& other) noexcept : operations_(other.operations_) {
+    if (operations_) {
+      operations_->move(storage_, other.storage_);
+      other.operations_ = nullptr;
+    }
+  }
+
+  unique_function& operator=(unique_function&& other) noexcept {
+    if (this != &other) {
+      reset();
+      if (other.operations_) {
+        other.operations_->move(storage_, other.storage_);
+        operations_ = other.operations_;
+        other.operations_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  unique_function& operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+
+  ~unique_function() { reset(); }
+
+  explicit operator bool() const { return nullptr != operations_; }
+
+  /// @throw std::bad_function_call if empty, same as std::function
+  R operator()(Args... args) {
+    if (!operations_) {
+      throw std::bad_function_call();
+    }
+    return operations_->invoke(storage_, std::forward<Args>(args)...);
+  }
+
+  /// @return true if a callable of type F is stored without heap allocation
+  template<typename F>
+  static bool stores_inline() { return FitsInline<F>::value; }
+};
+
+} // end namespace kjellkod
+
+#endif
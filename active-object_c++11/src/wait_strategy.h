@@ -0,0 +1,22 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* How a thread waits for work, see parking_spot.
+* Used by the Active object, the lock-free ring_queue and active_future.
+*
+*   block           sleep on a condition variable right away. No CPU is
+*                   burnt, every wakeup goes through the mutex and the kernel
+*   spin_then_park  spin with a cpu 'pause' for a short, bounded time, then
+*                   sleep on a futex (a condition variable on non Linux).
+*                   A busy consumer is woken without any syscall
+*   busy_poll       never sleep, lowest latency but one core is kept at 100% */
+
+#ifndef WAIT_STRATEGY_H_
+#define WAIT_STRATEGY_H_
+
+enum class wait_strategy { block, spin_then_park, busy_poll };
+
+#endif
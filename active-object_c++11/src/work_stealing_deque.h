@@ -0,0 +1,137 @@
+/** ==========================================================================
+* 2010 by KjellKod.cc. This is PUBLIC DOMAIN to use at your own risk and comes
+* with no warranties. This code is yours to share, use and modify with no
+* strings attached and no restrictions or obligations.
+* ============================================================================
+*
+* Chase-Lev work stealing deque. The OWNER thread pushes and pops at the
+* bottom (LIFO, good cache locality), any other thread can steal from the
+* top (FIFO, the oldest and usually biggest pieces of work).
+*
+* The memory orderings follow the C11 version of the algorithm in
+* "Correct and Efficient Work-Stealing for Weak Memory Models"
+* by Le, Pop, Cohen and Zappa Nardelli, PPoPP 2013.
+*
+* T must be trivially copyable (normally a pointer) since slots are
+* read by thieves while the owner may write to them. The buffer grows when
+* full, old buffers are kept until destruction since a thief may still
+* be reading from them. */
+
+#ifndef WORK_STEALING_DEQUE_H_
+#define WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+template<typename T>
+class work_stealing_deque {
+  struct Array {
+    const int64_t size;
+    std::atomic<T>* const slots;
+    Array* const previous;
+
+    Array(int64_t size_, Array* previous_)
+      : size(size_), slots(new std::atomic<T>[size_]), previous(previous_) {}
+    ~Array() { delete [] slots; }
+
+    T get(int64_t index_) const { return slots[index_ & (size - 1)].load(std::memory_order_relaxed); }
+    void put(int64_t index_, T item_) { slots[index_ & (size - 1)].store(item_, std::memory_order_relaxed); }
+  };
+
+  std::atomic<int64_t> top_;
+  char pad_[64];
+  std::atomic<int64_t> bottom_;
+  std::atomic<Array*> array_;
+
+  work_stealing_deque(const work_stealing_deque&) = delete;
+  work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+  Array* grow(Array* old_, int64_t bottom_index_, int64_t top_index_) {
+    Array* bigger = new Array(old_->size * 2, old_);
+    for (int64_t index = top_index_; index < bottom_index_; ++index) {
+      bigger->put(index, old_->get(index));
+    }
+    return bigger;
+  }
+
+public:
+  enum StealResult { c_stolen, c_empty, c_lost_race };
+
+  /// @param capacity initial size, must be a power of two
+  explicit work_stealing_deque(int64_t capacity = 256)
+    : top_(0), bottom_(0), array_(new Array(capacity, nullptr)) {}
+
+  ~work_stealing_deque() {
+    Array* array = array_.load(std::memory_order_relaxed);
+    while (array) {
+      Array* previous = array->previous;
+      delete array;
+      array = previous;
+    }
+  }
+
+  /// owner only
+  void push(T item_) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if (bottom - top > array->size - 1) {
+      array = grow(array, bottom, top);
+      array_.store(array, std::memory_order_release);
+    }
+    array->put(bottom, item_);
+    // the paper uses a release fence + relaxed store, same thing on x86
+    // but a release store is also understood by ThreadSanitizer
+    bottom_.store(bottom + 1, std::memory_order_release);
+  }
+
+  /// owner only. @return false if empty
+  bool pop(T& item_) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+
+    if (top > bottom) { // empty
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    item_ = array->get(bottom);
+    if (top == bottom) { // last item, race against thieves
+      bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /// any thread. A lost race means that there might still be items to steal
+  StealResult steal(T& item_) {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return c_empty;
+    }
+
+    Array* array = array_.load(std::memory_order_acquire);
+    T item = array->get(top);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return c_lost_race;
+    }
+    item_ = item;
+    return c_stolen;
+  }
+
+  /// approximate, for statistics and idle checks
+  size_t size() const {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    return static_cast<size_t>(bottom > top ? bottom - top : 0);
+  }
+};
+
+#endif
@@ -0,0 +1,40 @@
+/* *****************************************************************
+Replacement of the global operator new/delete, see allocation_counter.h
+*************************************************************** */
+
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+#if defined(__GNUC__)
+__thread unsigned long g_allocations = 0;
+#else
+thread_local unsigned long g_allocations = 0;
+#endif
+} // anonymous
+
+unsigned long threadAllocations() {
+  return g_allocations;
+}
+
+void* operator new(std::size_t size) {
+  ++g_allocations;
+  void* ptr = std::malloc(size ? size : 1);
+  if (nullptr == ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+#if defined(__cpp_sized_deallocation)
+// C++14 and later delete with the size, it must match the replaced operator new
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+#endif
@@ -0,0 +1,23 @@
+/* *****************************************************************
+Counting of heap allocations for the unit tests.
+
+The global operator new is replaced (allocation_counter.cpp) so that
+it counts allocations made by the calling thread. Per thread so that
+other threads (i.e. an Active's background thread) cannot disturb
+the numbers.
+*************************************************************** */
+
+#ifndef ALLOCATION_COUNTER_H_
+#define ALLOCATION_COUNTER_H_
+
+/// @return number of heap allocations made by the calling thread so far
+unsigned long threadAllocations();
+
+/// Counts the calling thread's allocations from construction and on
+struct AllocationCounter {
+  unsigned long start;
+  AllocationCounter() : start(threadAllocations()) {}
+  unsigned long count() const { return threadAllocations() - start; }
+};
+
+#endif
@@ -0,0 +1,543 @@
+/* *****************************************************************
+Test of common usage of the active object
+
+FYI: Active object is an object with a background thread incapsulated.
+     Jobs are sent asynchronously to the background thread which works
+     them off in FIFO order.
+
+Tests below:
+    1. Send jobs and verify that they are all done, in order, when the
+       active object is destroyed (the queue is drained)
+
+    2. -||- verify that they're done by another thread than the caller thread
+
+    3. Bounded Active with a stalled background thread: try_send and
+       send_for fail and are counted, nothing is lost on destruction
+
+    4. Bounded Active with the drop_newest policy: dropped jobs are counted
+       and a dropped call() gives a broken_promise
+
+    5. Priority lanes: urgent jobs overtake queued normal and bulk jobs,
+       FIFO order within each lane, bulk jobs are not starved
+
+    6. Jobs sent by jobs while the Active is destroyed are also executed
+
+    7. Timers: delayed jobs run on the Active's thread, in deadline order and
+       never early. Periodic jobs until cancelled, pending timers are
+       dropped on destruction
+
+    8. send_bulk: batches of move-only Jobs and of copied Callbacks keep
+       FIFO order, also with a bounded queue smaller than the batch
+
+    9. ActiveOptions (Linux): thread name, cpu affinity, NUMA node, stack
+       size and scheduling class are applied, invalid options throw
+
+   10. Shutdown modes: shutdown_now stops after the current job and hands
+       back the pending jobs by lane, shutdown_for drains until its deadline,
+       sends after a shutdown are rejected. Senders that race with each
+       shutdown mode, also blocked ones: every accepted job is executed or
+       handed back
+
+   11. flush waits for the jobs sent before it in every lane, also when a
+       drop policy drops its marker. wait_idle also waits for jobs sent by
+       jobs and gives up at its timeout. completed() counts without a lock
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <system_error>
+
+#include "active.h"
+
+using namespace kjellkod;
+
+namespace {
+void addTo(std::vector<int>* received_, int value_) {
+  received_->push_back(value_);
+}
+
+void saveThreadId(std::thread::id* id_) {
+  *id_ = std::this_thread::get_id();
+}
+
+// Stalls the background thread until opened, so that the queue can be filled
+struct Gate {
+  std::atomic<bool> entered;
+  std::atomic<bool> open;
+  Gate() : entered(false), open(false) {}
+
+  void pass() {
+    entered = true;
+    while (!open) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void stall(Active& active_) {
+    active_.send(std::bind(&Gate::pass, this));
+    while (!entered) {
+      std::this_thread::yield();
+    }
+  }
+};
+} // anonymous
+
+
+TEST(Active, destruction_drains_the_queue_in_fifo_order) {
+  const int c_nbrJobs = 100000;
+  std::vector<int> received;
+  {
+    std::unique_ptr<Active> active(Active::createActive());
+    for (int idx = 0; idx < c_nbrJobs; ++idx) {
+      active->send(std::bind(&addTo, &received, idx));
+    }
+  } // drain, then exit
+  ASSERT_EQ(static_cast<size_t>(c_nbrJobs), received.size());
+  for (int idx = 0; idx < c_nbrJobs; ++idx) {
+    ASSERT_EQ(idx, received[idx]);
+  }
+}
+
+
+TEST(Active, jobs_run_on_the_background_thread) {
+  std::thread::id bg_thread_id;
+  {
+    std::unique_ptr<Active> active(Active::createActive());
+    active->send(std::bind(&saveThreadId, &bg_thread_id));
+  }
+  ASSERT_NE(std::thread::id(), bg_thread_id);
+  ASSERT_NE(std::this_thread::get_id(), bg_thread_id);
+}
+
+
+TEST(Active, bounded_queue_rejects_when_full) {
+  std::vector<int> received;
+  Gate gate;
+  {
+    std::unique_ptr<Active> active(Active::createActive(2, overflow_policy::block));
+    gate.stall(*active);
+    ASSERT_TRUE(active->send(std::bind(&addTo, &received, 0)));
+    ASSERT_TRUE(active->try_send(std::bind(&addTo, &received, 1)));
+    ASSERT_FALSE(active->try_send(std::bind(&addTo, &received, 2)));
+    ASSERT_FALSE(active->send_for(std::bind(&addTo, &received, 3), std::chrono::milliseconds(10)));
+    ASSERT_EQ(2u, active->rejected());
+    ASSERT_EQ(0u, active->dropped());
+    gate.open = true;
+  } // drained on destruction
+  ASSERT_EQ(2u, received.size());
+  ASSERT_EQ(0, received[0]);
+  ASSERT_EQ(1, received[1]);
+}
+
+
+TEST(Active, bounded_queue_drop_newest) {
+  std::vector<int> received;
+  Gate gate;
+  {
+    std::unique_ptr<Active> active(Active::createActive(2, overflow_policy::drop_newest));
+    gate.stall(*active);
+    for (int idx = 0; idx < 4; ++idx) {
+      ASSERT_EQ(idx < 2, active->send(std::bind(&addTo, &received, idx)));
+    }
+    active_future<int> dropped = active->call([]() { return 42; });
+    ASSERT_EQ(3u, active->dropped());
+    ASSERT_TRUE(dropped.is_ready());
+    ASSERT_THROW(dropped.get(), std::future_error);
+    gate.open = true;
+  }
+  ASSERT_EQ(2u, received.size());
+  ASSERT_EQ(1, received[1]);
+}
+
+
+namespace {
+// lane in the high bits, sequence in the low bits
+void record(std::vector<int>* received_, lane lane_, int value_) {
+  received_->push_back((static_cast<int>(lane_) << 16) | value_);
+}
+lane laneOf(int recorded_) { return static_cast<lane>(recorded_ >> 16); }
+int valueOf(int recorded_) { return recorded_ & 0xffff; }
+} // anonymous
+
+
+TEST(Active, priority_lanes) {
+  const int c_nbrJobs = 100;
+  std::vector<int> received;
+  Gate gate;
+  {
+    std::unique_ptr<Active> active(Active::createActive());
+    gate.stall(*active);
+    for (int idx = 0; idx < c_nbrJobs; ++idx) {
+      active->send(std::bind(&record, &received, lane::normal, idx));
+      active->send(std::bind(&record, &received, lane::bulk, idx), lane::bulk);
+    }
+    active->send(std::bind(&record, &received, lane::urgent, 0), lane::urgent);
+    active_future<int> health = active->call([]() { return 1; }, lane::urgent);
+    gate.open = true;
+    ASSERT_EQ(1, health.get());
+  }
+  ASSERT_EQ(static_cast<size_t>(2 * c_nbrJobs + 1), received.size());
+  ASSERT_EQ(lane::urgent, laneOf(received[0]));
+
+  int next_normal = 0, next_bulk = 0;
+  unsigned normal_in_a_row = 0;
+  for (size_t idx = 1; idx < received.size(); ++idx) {
+    if (lane::normal == laneOf(received[idx])) {
+      ASSERT_EQ(next_normal++, valueOf(received[idx]));
+      ++normal_in_a_row;
+      if (next_bulk < c_nbrJobs) {
+        ASSERT_LE(normal_in_a_row, Active::c_normal_per_bulk); // starvation guard
+      }
+    } else {
+      ASSERT_EQ(lane::bulk, laneOf(received[idx]));
+      ASSERT_EQ(next_bulk++, valueOf(received[idx]));
+      normal_in_a_row = 0;
+    }
+  }
+}
+
+
+namespace {
+void sendAgain(Active* active_, std::vector<int>* received_, int left_) {
+  received_->push_back(left_);
+  if (left_ > 0) {
+    active_->send(std::bind(&sendAgain, active_, received_, left_ - 1));
+  }
+}
+} // anonymous
+
+
+TEST(Active, jobs_sent_by_jobs_are_drained) {
+  std::vector<int> received;
+  {
+    std::unique_ptr<Active> active(Active::createActive());
+    active->send(std::bind(&sendAgain, active.get(), &received, 100));
+  }
+  ASSERT_EQ(101u, received.size());
+  ASSERT_EQ(0, received.back());
+}
+
+
+namespace {
+void addAndCount(std::vector<int>* received_, int value_, std::atomic<int>* count_) {
+  received_->push_back(value_);
+  ++*count_;
+}
+
+void waitFor(const std::atomic<int>& count_, int expected_) {
+  while (count_ < expected_) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+} // anonymous
+
+
+TEST(Active, delayed_jobs) {
+  std::vector<int> received;
+  std::atomic<int> count(0);
+  std::unique_ptr<Active> active(Active::createActive());
+  const timer_clock::time_point start = timer_clock::now();
+  ASSERT_NE(0u, active->send_after(std::chrono::milliseconds(40), std::bind(&addAndCount, &received, 40, &count)));
+  ASSERT_NE(0u, active->send_at(start + std::chrono::milliseconds(20), std::bind(&addAndCount, &received, 20, &count)));
+  const timer_id cancelled = active->send_after(std::chrono::milliseconds(30), std::bind(&addAndCount, &received, 30, &count));
+  ASSERT_TRUE(active->cancel_timer(cancelled));
+  active->send(std::bind(&addAndCount, &received, 0, &count));
+
+  waitFor(count, 3);
+  ASSERT_LE(start + std::chrono::milliseconds(40), timer_clock::now());
+  const std::vector<int> expected = { 0, 20, 40 };
+  ASSERT_EQ(expected, received);
+
+  std::thread::id id;
+  active->send_after(std::chrono::milliseconds(1), std::bind(&saveThreadId, &id));
+  while (std::thread::id() == id) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_NE(std::this_thread::get_id(), id);
+}
+
+
+TEST(Active, periodic_job_until_cancelled) {
+  std::vector<int> received;
+  std::atomic<int> count(0);
+  {
+    std::unique_ptr<Active> active(Active::createActive());
+    const timer_id periodic = active->send_every(std::chrono::milliseconds(2), std::bind(&addAndCount, &received, 1, &count));
+    active->send_after(std::chrono::hours(1), std::bind(&addAndCount, &received, 2, &count));
+    waitFor(count, 5);
+    ASSERT_TRUE(active->cancel_timer(periodic));
+    active->call([]() {}).wait(); // the cancel is done
+  } // the one hour timer is dropped, destruction does not wait for it
+  ASSERT_LE(5u, received.size());
+  ASSERT_EQ(received.end(), std::find(received.begin(), received.end(), 2));
+}
+
+
+TEST(Active, send_bulk) {
+  const int c_batch = 1000;
+  std::vector<int> received;
+  {
+    std::unique_ptr<Active> active(Active::createActive(64, overflow_policy::block));
+    std::vector<Job> jobs;
+    std::vector<Callback> callbacks;
+    for (int idx = 0; idx < c_batch; ++idx) {
+      jobs.push_back(std::bind(&addTo, &received, idx));
+      callbacks.push_back(std::bind(&addTo, &received, c_batch + idx));
+    }
+    ASSERT_EQ(static_cast<size_t>(c_batch),
+              active->send_bulk(std::make_move_iterator(jobs.begin()), std::make_move_iterator(jobs.end())));
+    ASSERT_EQ(static_cast<size_t>(c_batch), active->send_bulk(callbacks.begin(), callbacks.end(), lane::normal));
+  }
+  ASSERT_EQ(static_cast<size_t>(2 * c_batch), received.size());
+  for (int idx = 0; idx < 2 * c_batch; ++idx) {
+    ASSERT_EQ(idx, received[idx]);
+  }
+}
+
+
+TEST(Active, shutdown_now_hands_back_pending_jobs) {
+  std::vector<int> received;
+  Gate gate;
+  std::unique_ptr<Active> active(Active::createActive());
+  gate.stall(*active);
+  for (int idx = 0; idx < 10; ++idx) {
+    active->send(std::bind(&addTo, &received, 100 + idx), lane::bulk);
+    active->send(std::bind(&addTo, &received, idx));
+    active->send(std::bind(&addTo, &received, 200 + idx), lane::urgent);
+  }
+  std::thread opener([&gate]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    gate.open = true;
+  });
+  std::vector<Job> pending = active->shutdown_now(); // returns once the gate's job is done
+  opener.join();
+  ASSERT_TRUE(received.empty());
+  ASSERT_EQ(30u, pending.size());
+  for (Job& job : pending) {
+    job();
+  }
+  for (int idx = 0; idx < 10; ++idx) {
+    ASSERT_EQ(200 + idx, received[idx]);      // urgent
+    ASSERT_EQ(idx, received[10 + idx]);       // normal
+    ASSERT_EQ(100 + idx, received[20 + idx]); // bulk
+  }
+
+  ASSERT_FALSE(active->send(std::bind(&addTo, &received, -1)));
+  ASSERT_TRUE(active->shutdown_now().empty());
+}
+
+
+TEST(Active, shutdown_for_drains_until_the_deadline) {
+  const int c_nbrJobs = 100;
+  std::vector<int> received;
+  std::unique_ptr<Active> active(Active::createActive());
+  for (int idx = 0; idx < c_nbrJobs; ++idx) {
+    active->send([&received, idx]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      received.push_back(idx);
+    });
+  }
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<Job> pending = active->shutdown_for(std::chrono::milliseconds(50));
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(400)); // not the whole backlog
+  ASSERT_FALSE(pending.empty());
+  ASSERT_EQ(static_cast<size_t>(c_nbrJobs), received.size() + pending.size());
+  for (Job& job : pending) {
+    job(); // the rest, in order
+  }
+  for (int idx = 0; idx < c_nbrJobs; ++idx) {
+    ASSERT_EQ(idx, received[idx]);
+  }
+}
+
+
+TEST(Active, shutdown_drains_in_time) {
+  std::vector<int> received;
+  std::unique_ptr<Active> active(Active::createActive());
+  for (int idx = 0; idx < 10; ++idx) {
+    active->send(std::bind(&addTo, &received, idx));
+  }
+  ASSERT_TRUE(active->shutdown_for(std::chrono::seconds(10)).empty());
+  ASSERT_EQ(10u, received.size());
+  ASSERT_FALSE(active->send(std::bind(&addTo, &received, 10)));
+  active->shutdown(); // does nothing, also not the destructor
+  ASSERT_EQ(10u, received.size());
+}
+
+
+TEST(Active, sends_racing_with_shutdown_are_never_lost) {
+  enum { c_drain, c_now, c_deadline };
+  const int c_senders = 4;
+  for (int mode = c_drain; mode <= c_deadline; ++mode) {
+    for (int round = 0; round < 20; ++round) {
+      std::unique_ptr<Active> active(Active::createActive(16, overflow_policy::block)); // senders also block
+      std::atomic<uint64_t> accepted(0);
+      std::atomic<uint64_t> executed(0);
+      std::vector<std::thread> senders;
+      for (int sender = 0; sender < c_senders; ++sender) {
+        senders.push_back(std::thread([&, sender]() {
+          const lane to = (0 == sender % 3) ? lane::urgent : ((1 == sender % 3) ? lane::normal : lane::bulk);
+          for (int idx = 0; idx < 100000 && active->send([&executed]() { ++executed; }, to); ++idx) {
+            ++accepted;
+          }
+        }));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      std::vector<Job> handed_back;
+      if (c_drain == mode) {
+        active->shutdown();
+      } else if (c_now == mode) {
+        handed_back = active->shutdown_now();
+      } else {
+        handed_back = active->shutdown_for(std::chrono::microseconds(100));
+      }
+      for (std::thread& sender : senders) {
+        sender.join(); // the senders stop at a rejected send, the drain also ends without one
+      }
+      ASSERT_EQ(accepted.load(), executed.load() + handed_back.size()) << "mode " << mode << ", round " << round;
+    }
+  }
+}
+
+
+TEST(Active, flush_waits_for_all_lanes) {
+  std::unique_ptr<Active> active(Active::createActive());
+  std::atomic<int> done(0);
+  for (int idx = 0; idx < 1000; ++idx) {
+    const lane to = (0 == idx % 3) ? lane::urgent : ((1 == idx % 3) ? lane::normal : lane::bulk);
+    active->send([&done]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(10));
+      ++done;
+    }, to);
+  }
+  active->flush();
+  ASSERT_EQ(1000, done.load());
+  ASSERT_EQ(1000u, active->completed()); // the markers are not counted
+}
+
+
+TEST(Active, flush_with_a_dropped_marker) {
+  std::vector<int> received;
+  Gate gate;
+  std::unique_ptr<Active> active(Active::createActive(4, overflow_policy::drop_oldest));
+  gate.stall(*active);
+  std::thread flusher([&active]() { active->flush(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20)); // the markers are queued
+  for (int idx = 0; idx < 8; ++idx) {
+    active->send(std::bind(&addTo, &received, idx)); // pushes the normal marker out
+  }
+  ASSERT_LT(0u, active->dropped());
+  gate.open = true;
+  flusher.join(); // the marker was sent again
+  ASSERT_EQ(4u, received.size());
+}
+
+
+TEST(Active, wait_idle_also_waits_for_jobs_sent_by_jobs) {
+  std::unique_ptr<Active> active(Active::createActive());
+  std::atomic<int> hops(0);
+  std::function<void()> hop = [&]() {
+    if (++hops < 1000) {
+      active->send(hop);
+    }
+  };
+  active->send(hop);
+  ASSERT_TRUE(active->wait_idle(std::chrono::seconds(10)));
+  ASSERT_EQ(1000, hops.load());
+}
+
+
+TEST(Active, wait_idle_times_out_and_completed_counts) {
+  Gate gate;
+  std::unique_ptr<Active> active(Active::createActive());
+  gate.stall(*active);
+  ASSERT_EQ(0u, active->completed());
+  ASSERT_FALSE(active->wait_idle(std::chrono::milliseconds(20)));
+  gate.open = true;
+  ASSERT_TRUE(active->wait_idle(std::chrono::seconds(10)));
+  ASSERT_EQ(1u, active->completed()); // the gate's job, wait_idle sends nothing
+  active->flush();
+  ASSERT_TRUE(active->wait_idle(std::chrono::seconds(10)));
+  ASSERT_EQ(1u, active->completed()); // the markers are not counted
+  active->send([]() {});
+  active->shutdown();
+  active->flush(); // nothing to wait for
+  ASSERT_TRUE(active->wait_idle(std::chrono::seconds(0)));
+  ASSERT_EQ(2u, active->completed());
+}
+
+
+#if defined(__linux__)
+TEST(Active, thread_options) {
+  ActiveOptions options;
+  options.name = "active-options-test"; // truncated to 15 characters
+  options.cpus.push_back(0);
+  options.stack_size = 1024 * 1024;
+  options.sched = scheduling::batch;
+  std::unique_ptr<Active> active(Active::createActive(options));
+
+  const std::string name = active->call([]() {
+    char buffer[16] = { 0 };
+    pthread_getname_np(pthread_self(), buffer, sizeof(buffer));
+    return std::string(buffer);
+  }).get();
+  ASSERT_EQ("active-options-", name);
+
+  const bool on_cpu_0_only = active->call([]() {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    sched_getaffinity(0, sizeof(cpu_set), &cpu_set);
+    return 1 == CPU_COUNT(&cpu_set) && CPU_ISSET(0, &cpu_set);
+  }).get();
+  ASSERT_TRUE(on_cpu_0_only);
+
+  const size_t stack_size = active->call([]() {
+    pthread_attr_t attributes;
+    size_t size = 0;
+    pthread_getattr_np(pthread_self(), &attributes);
+    pthread_attr_getstacksize(&attributes, &size);
+    pthread_attr_destroy(&attributes);
+    return size;
+  }).get();
+  ASSERT_EQ(options.stack_size, stack_size);
+
+  ASSERT_EQ(SCHED_BATCH, active->call([]() { return sched_getscheduler(0); }).get());
+}
+
+
+TEST(Active, numa_node_options) {
+  const std::vector<unsigned> cpus = cpusOfNumaNode(0);
+  if (cpus.empty()) {
+    return; // no NUMA information on this machine
+  }
+  ActiveOptions options;
+  options.numa_node = 0;
+  std::unique_ptr<Active> active(Active::createActive(options));
+  const int cpu_count = active->call([]() {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    sched_getaffinity(0, sizeof(cpu_set), &cpu_set);
+    return CPU_COUNT(&cpu_set);
+  }).get();
+  ASSERT_EQ(static_cast<int>(cpus.size()), cpu_count);
+}
+
+
+TEST(Active, invalid_thread_options_throw) {
+  ActiveOptions options;
+  options.sched = scheduling::fifo;
+  options.priority = 1000; // out of range for SCHED_FIFO
+  ASSERT_THROW(Active::createActive(options), std::system_error);
+}
+#endif
@@ -0,0 +1,138 @@
+/* *****************************************************************
+Test of the C++20 coroutine support, co_await Active::schedule() and task<T>.
+Built as its own test executable with -std=c++20, see CMakeLists.txt
+
+Tests below:
+    1. co_await schedule() continues the coroutine on the Active's thread
+
+    2. A task hops between two Actives, its result and its exception
+       reach the awaiting coroutine and spawn's future
+
+    3. A rejected hop (full lane, reject policy) throws at the co_await
+
+    4. A warm hop does not allocate: the coroutine handle is stored inline
+       in the Job and the frames come from the pool, apart from the
+       queue's own (amortized) std::deque nodes
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "active.h"
+#include "active_coroutine.h"
+#include "allocation_counter.h"
+
+using namespace kjellkod;
+
+namespace {
+std::thread::id threadOf(Active& active_) {
+  return active_.call([]() { return std::this_thread::get_id(); }).get();
+}
+
+task<std::thread::id> hop(Active& active_) {
+  co_await active_.schedule();
+  co_return std::this_thread::get_id();
+}
+
+task<int> parseOn(Active& active_, std::string text_) {
+  co_await active_.schedule();
+  if (text_.empty()) {
+    throw std::invalid_argument("nothing to parse");
+  }
+  co_return std::stoi(text_);
+}
+
+// parses on one Active and adds on the other
+task<int> parseAndAdd(Active& parser_, Active& adder_, std::string text_, int term_) {
+  const int value = co_await parseOn(parser_, text_);
+  co_await adder_.schedule();
+  co_return value + term_;
+}
+
+task<void> visit(Active& first_, Active& second_, std::thread::id* visited_) {
+  co_await first_.schedule();
+  visited_[0] = std::this_thread::get_id();
+  co_await second_.schedule();
+  visited_[1] = std::this_thread::get_id();
+}
+} // anonymous
+
+
+class ActiveCoroutine : public ::testing::Test {
+protected:
+  std::unique_ptr<Active> first_;
+  std::unique_ptr<Active> second_;
+
+  virtual void SetUp() {
+    first_ = Active::createActive();
+    second_ = Active::createActive();
+  }
+};
+
+
+TEST_F(ActiveCoroutine, schedule_resumes_on_the_active) {
+  ASSERT_EQ(threadOf(*first_), spawn(hop(*first_)).get());
+  ASSERT_EQ(threadOf(*second_), spawn(hop(*second_)).get());
+
+  std::thread::id visited[2];
+  spawn(visit(*first_, *second_, visited)).get();
+  ASSERT_EQ(threadOf(*first_), visited[0]);
+  ASSERT_EQ(threadOf(*second_), visited[1]);
+}
+
+
+TEST_F(ActiveCoroutine, task_result_and_exception_between_actives) {
+  ASSERT_EQ(50, spawn(parseAndAdd(*first_, *second_, "42", 8)).get());
+  ASSERT_THROW(spawn(parseAndAdd(*first_, *second_, "", 8)).get(), std::invalid_argument);
+}
+
+
+TEST_F(ActiveCoroutine, rejected_hop_throws) {
+  std::unique_ptr<Active> full = Active::createActive(1, overflow_policy::reject);
+  std::atomic<bool> release(false);
+  std::atomic<bool> blocked(false);
+  full->send([&]() {
+    blocked = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  while (!blocked) {
+    std::this_thread::yield();
+  }
+  while (full->send([]() {})) {} // the lock-free ring may have room for more than the capacity
+
+  active_future<std::thread::id> hopped = spawn(hop(*full));
+  bool rejected = false;
+  try {
+    hopped.get();
+  } catch (const std::system_error&) {
+    rejected = true;
+  }
+  release = true;
+  ASSERT_TRUE(rejected);
+}
+
+
+TEST_F(ActiveCoroutine, warm_hop_only_allocates_queue_nodes) {
+  const int c_hops = 1000;
+  const std::thread::id worker = threadOf(*first_);
+  spawn(hop(*first_)).get(); // warm up the frame and state pools
+  AllocationCounter allocations;
+  for (int idx = 0; idx < c_hops; ++idx) {
+    ASSERT_EQ(worker, spawn(hop(*first_)).get());
+  }
+#if defined(ACTIVE_TRACING)
+  // a traced Message is bigger, one job less per node
+  ASSERT_LE(allocations.count(), static_cast<unsigned long>(c_hops / 3));
+#else
+  ASSERT_LE(allocations.count(), static_cast<unsigned long>(c_hops / 4));
+#endif
+}
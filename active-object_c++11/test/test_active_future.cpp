@@ -0,0 +1,178 @@
+/* *****************************************************************
+Test of request/response jobs with Active::call and active_future
+
+Tests below:
+    1. The return value of the background job is received through the future
+
+    2. An exception thrown by the job is rethrown by get()
+
+    3. A continuation (then) is executed on the chosen Active, also
+       when the result was already available
+
+    4. A round trip does not allocate once the state pool is warm, apart
+       from the queue's own (amortized) std::deque nodes
+
+    5. Round trip latency printouts, call().get() compared to the
+       'hand-rolled' return queue used in the Qt test work_and_return_by_queue
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "active.h"
+#include "shared_queue.h"
+#include "allocation_counter.h"
+
+using namespace kjellkod;
+
+namespace {
+int multiply(int value_, int factor_) {
+  return value_ * factor_;
+}
+
+int fail() {
+  throw std::runtime_error("job failed");
+}
+
+std::thread::id threadId() {
+  return std::this_thread::get_id();
+}
+
+void calculateAndReturn(int value_, int factor_, shared_queue<int>* result_queue_) {
+  result_queue_->push(value_ * factor_);
+}
+
+typedef std::chrono::duration<double, std::micro> Microseconds;
+
+// runs the job directly in the calling thread, isolates the future from the queue
+struct InlineExecutor {
+  void send(Job job_) { job_(); }
+};
+} // anonymous
+
+
+class ActiveFuture : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    worker_ = Active::createActive();
+    other_ = Active::createActive();
+  }
+
+  std::unique_ptr<Active> worker_;
+  std::unique_ptr<Active> other_;
+};
+
+
+TEST_F(ActiveFuture, call_returns_value) {
+  active_future<int> result = worker_->call(std::bind(&multiply, 21, 2));
+  ASSERT_TRUE(result.valid());
+  ASSERT_EQ(42, result.get());
+  ASSERT_FALSE(result.valid());
+}
+
+
+TEST_F(ActiveFuture, call_runs_on_background_thread) {
+  active_future<std::thread::id> id = worker_->call(&threadId);
+  ASSERT_NE(std::this_thread::get_id(), id.get());
+}
+
+
+TEST_F(ActiveFuture, void_call) {
+  int value = 0;
+  active_future<void> done = worker_->call([&value]() { value = 1; });
+  done.get();
+  ASSERT_EQ(1, value);
+}
+
+
+TEST_F(ActiveFuture, exception_is_rethrown_by_get) {
+  active_future<int> result = worker_->call(&fail);
+  ASSERT_THROW(result.get(), std::runtime_error);
+}
+
+
+TEST_F(ActiveFuture, then_runs_on_chosen_active) {
+  std::thread::id worker_id = worker_->call(&threadId).get();
+  std::thread::id other_id = other_->call(&threadId).get();
+
+  active_future<std::string> result = worker_->call(std::bind(&multiply, 21, 2))
+                                       .then(*other_, [other_id](int value) {
+                                         EXPECT_EQ(other_id, std::this_thread::get_id());
+                                         return std::to_string(value);
+                                       });
+  ASSERT_EQ("42", result.get());
+  ASSERT_NE(worker_id, other_id);
+}
+
+
+TEST_F(ActiveFuture, then_on_ready_future) {
+  active_future<int> ready = worker_->call(std::bind(&multiply, 2, 2));
+  ready.wait();
+  ASSERT_TRUE(ready.is_ready());
+  active_future<int> result = ready.then(*other_, [](int value) { return value * 10; });
+  ASSERT_EQ(40, result.get());
+}
+
+
+TEST_F(ActiveFuture, then_passes_on_exception) {
+  bool called = false;
+  active_future<void> result = worker_->call(&fail).then(*other_, [&called](int) { called = true; });
+  ASSERT_THROW(result.get(), std::runtime_error);
+  ASSERT_FALSE(called);
+}
+
+
+TEST_F(ActiveFuture, round_trip_does_not_allocate) {
+  InlineExecutor executor;
+  call_on(executor, std::bind(&multiply, 1, 1)).get(); // warm up the state pool
+  AllocationCounter allocations;
+  for (int idx = 0; idx < 1000; ++idx) {
+    ASSERT_EQ(idx * 2, call_on(executor, std::bind(&multiply, idx, 2)).get());
+  }
+  ASSERT_EQ(0ul, allocations.count());
+}
+
+
+// Through the Active only shared_queue's std::deque allocates, one node for several jobs
+TEST_F(ActiveFuture, round_trip_through_active_only_allocates_queue_nodes) {
+  const int c_roundTrips = 1000;
+  worker_->call(std::bind(&multiply, 1, 1)).get();
+  AllocationCounter allocations;
+  for (int idx = 0; idx < c_roundTrips; ++idx) {
+    ASSERT_EQ(idx * 2, worker_->call(std::bind(&multiply, idx, 2)).get());
+  }
+  ASSERT_LT(allocations.count(), static_cast<unsigned long>(c_roundTrips / 4));
+}
+
+
+TEST_F(ActiveFuture, round_trip_latency_compared_to_result_queue) {
+  const int c_roundTrips = 10000;
+  const int factor = 2;
+
+  shared_queue<int> result_queue;
+  auto start = std::chrono::steady_clock::now();
+  for (int idx = 0; idx < c_roundTrips; ++idx) {
+    worker_->send(std::bind(&calculateAndReturn, idx, factor, &result_queue));
+    int result;
+    result_queue.wait_and_pop(result);
+    ASSERT_EQ(idx * factor, result);
+  }
+  Microseconds by_queue = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int idx = 0; idx < c_roundTrips; ++idx) {
+    ASSERT_EQ(idx * factor, worker_->call(std::bind(&multiply, idx, factor)).get());
+  }
+  Microseconds by_future = std::chrono::steady_clock::now() - start;
+
+  std::cout << "\t\t\tAverage round trip [us]. result queue: " << by_queue.count() / c_roundTrips;
+  std::cout << ", active_future: " << by_future.count() / c_roundTrips << std::endl;
+}
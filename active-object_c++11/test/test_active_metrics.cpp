@@ -0,0 +1,173 @@
+/* *****************************************************************
+Test of the runtime metrics of the Active
+
+Tests below:
+    1. log_histogram: the buckets cover the values without gaps, the
+       precision is 25%, percentiles are upper bounds capped at max
+
+    2. An Active counts enqueued and executed jobs, the high water mark of
+       the lanes, the wait and execution times and its busy/idle time
+
+    3. A stalled Active: the depth grows, and drops are counted
+
+    4. The Active's own jobs, the flush markers and the jobs that add and
+       cancel timers, are not counted
+
+    5. Jobs handed back by shutdown_now(), from run()'s hands and from the
+       lanes, are not left behind as depth
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <vector>
+
+#include "active.h"
+
+using namespace kjellkod;
+
+namespace {
+void sleepFor(std::chrono::microseconds duration_) {
+  std::this_thread::sleep_for(duration_);
+}
+
+void waitFor(std::atomic<bool>* release_) {
+  while (!release_->load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+} // anonymous
+
+
+TEST(ActiveMetrics, histogram_buckets) {
+  for (uint64_t value = 0; value < 100000; ++value) {
+    const unsigned bucket = log_histogram::bucketOf(value);
+    ASSERT_LE(log_histogram::lowerBound(bucket), value);
+    ASSERT_GE(log_histogram::upperBound(bucket), value);
+  }
+  for (unsigned bucket = 1; bucket < log_histogram::c_buckets; ++bucket) {
+    ASSERT_EQ(log_histogram::upperBound(bucket - 1) + 1, log_histogram::lowerBound(bucket));
+    ASSERT_LE(log_histogram::upperBound(bucket) - log_histogram::lowerBound(bucket),
+              log_histogram::lowerBound(bucket) / 4 + 1);
+  }
+  ASSERT_EQ(log_histogram::c_buckets - 1, log_histogram::bucketOf(UINT64_MAX));
+
+  log_histogram histogram;
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram.record(value);
+  }
+  const histogram_snapshot snapshot = histogram.snapshot();
+  ASSERT_EQ(1000u, snapshot.count);
+  ASSERT_EQ(1000u, snapshot.max);
+  ASSERT_DOUBLE_EQ(500.5, snapshot.mean());
+  ASSERT_LE(500u, snapshot.percentile(50));
+  ASSERT_GE(625u, snapshot.percentile(50));
+  ASSERT_LE(990u, snapshot.percentile(99));
+  ASSERT_EQ(1000u, snapshot.percentile(100));
+}
+
+
+TEST(ActiveMetrics, counts_and_times) {
+  const int c_nbrJobs = 20;
+  std::unique_ptr<Active> active(Active::createActive());
+  std::atomic<bool> release(false);
+  active->send(std::bind(&waitFor, &release));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10)); // the blocking job is taken alone
+  for (int idx = 0; idx < c_nbrJobs; ++idx) {
+    active->send(std::bind(&sleepFor, std::chrono::microseconds(1000)));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  release.store(true);
+  active->call([]() { return 0; }).get();
+
+  const ActiveMetrics metrics = active->metrics();
+  ASSERT_EQ(static_cast<uint64_t>(c_nbrJobs + 2), metrics.enqueued);
+  ASSERT_LE(static_cast<uint64_t>(c_nbrJobs + 1), metrics.executed); // the call() may not yet be counted
+  ASSERT_GE(1u, metrics.depth);
+  ASSERT_LE(static_cast<uint64_t>(c_nbrJobs), metrics.high_water);
+  ASSERT_EQ(0u, metrics.rejected + metrics.dropped);
+  // the jobs sent behind the blocking job waited at least 20 ms
+  ASSERT_LE(20000000u, metrics.wait_ns.max);
+  ASSERT_LE(1000000u, metrics.service_ns.percentile(50));
+  ASSERT_LT(std::chrono::milliseconds(40), metrics.busy);
+  ASSERT_LT(0.0, metrics.busy_ratio());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  const ActiveMetrics later = active->metrics();
+  ASSERT_LT(metrics.idle + std::chrono::milliseconds(40), later.idle);
+  ASSERT_GT(metrics.busy_ratio(), later.busy_ratio());
+  std::cout << "\t\t\twait p50/p99/max [us]: " << later.wait_ns.percentile(50) / 1000 << "/"
+            << later.wait_ns.percentile(99) / 1000 << "/" << later.wait_ns.max / 1000
+            << ", busy ratio: " << later.busy_ratio() << std::endl;
+}
+
+
+TEST(ActiveMetrics, stalled_active) {
+  const size_t c_capacity = 64;
+  std::unique_ptr<Active> active(Active::createActive(c_capacity, overflow_policy::drop_newest));
+  std::atomic<bool> release(false);
+  active->send(std::bind(&waitFor, &release));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10)); // the blocking job is taken
+  for (size_t idx = 0; idx < 2 * c_capacity; ++idx) {
+    active->send([]() {});
+  }
+  const ActiveMetrics stalled = active->metrics();
+  ASSERT_LE(c_capacity + 1, stalled.depth);
+  ASSERT_LE(c_capacity, stalled.dropped);
+  ASSERT_EQ(0u, stalled.executed);
+  release.store(true);
+}
+
+
+TEST(ActiveMetrics, own_jobs_are_not_counted) {
+  std::unique_ptr<Active> active(Active::createActive());
+  for (int idx = 0; idx < 10; ++idx) {
+    active->send([]() {});
+  }
+  active->flush();
+  const timer_id id = active->send_after(std::chrono::hours(1), []() {});
+  ASSERT_TRUE(active->cancel_timer(id));
+  active->flush();
+  ASSERT_TRUE(active->wait_idle(std::chrono::seconds(10))); // the last marker is done, not only returned
+
+  const ActiveMetrics metrics = active->metrics();
+  ASSERT_EQ(10u, active->completed());
+  ASSERT_EQ(10u, metrics.executed);
+  ASSERT_EQ(10u, metrics.enqueued);
+  ASSERT_EQ(0u, metrics.depth);
+}
+
+
+TEST(ActiveMetrics, handed_back_jobs_are_not_counted) {
+  std::unique_ptr<Active> active(Active::createActive());
+  std::atomic<bool> first(false), second(false);
+  active->send(std::bind(&waitFor, &first));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10)); // the first blocking job is taken
+  active->send(std::bind(&waitFor, &second));
+  for (int idx = 0; idx < 10; ++idx) {
+    active->send([]() {});
+  }
+  first.store(true);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10)); // the second one is taken with the 10 jobs
+  for (int idx = 0; idx < 5; ++idx) {
+    active->send([]() {}); // still in the lane
+  }
+  std::thread opener([&second]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    second.store(true);
+  });
+  const std::vector<Job> pending = active->shutdown_now();
+  opener.join();
+
+  ASSERT_EQ(15u, pending.size());
+  const ActiveMetrics metrics = active->metrics();
+  ASSERT_EQ(2u, metrics.executed);
+  ASSERT_EQ(2u, metrics.enqueued);
+  ASSERT_EQ(0u, metrics.depth);
+}
@@ -0,0 +1,162 @@
+/* *****************************************************************
+Test of ActivePipeline, Actives chained as stages
+
+Tests below:
+    1. Items go through all the stages in FIFO order, the type changes
+       from stage to stage and move-only items are never copied
+
+    2. Each stage runs on its own thread
+
+    3. Backpressure: a slow last stage makes the stages before it, and
+       push(), wait. The rings never hold more than their capacity and the
+       slow stage is reported as the bottleneck
+
+    4. try_push gives up on a full first stage and keeps the item
+
+    5. Stages on bounded Actives with a reject or drop policy: the drains
+       are never lost, every item reaches the sink
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "active_pipeline.h"
+
+using namespace kjellkod;
+
+namespace {
+std::unique_ptr<int> parse(const std::string& text_) {
+  return std::unique_ptr<int>(new int(std::stoi(text_)));
+}
+
+std::unique_ptr<int> twice(std::unique_ptr<int> value_) {
+  *value_ *= 2;
+  return value_;
+}
+} // anonymous
+
+
+TEST(ActivePipeline, items_pass_all_stages_in_order) {
+  const int c_items = 10000;
+  std::vector<int> persisted;
+  {
+    std::unique_ptr<ActivePipeline<std::string> > pipeline = PipelineBuilder<std::string>(64)
+        .stage("parse", &parse)
+        .stage("twice", &twice)
+        .sink("persist", [&persisted](std::unique_ptr<int> value_) { persisted.push_back(*value_); });
+    ASSERT_EQ(3u, pipeline->size());
+    for (int idx = 0; idx < c_items; ++idx) {
+      pipeline->push(std::to_string(idx));
+    }
+
+    PipelineStats stats = pipeline->stats();
+    ASSERT_EQ(3u, stats.stages.size());
+    ASSERT_EQ("parse", stats.stages[0].name);
+    ASSERT_EQ("persist", stats.stages[2].name);
+  } // drains all the stages
+
+  ASSERT_EQ(static_cast<size_t>(c_items), persisted.size());
+  for (int idx = 0; idx < c_items; ++idx) {
+    ASSERT_EQ(idx * 2, persisted[idx]);
+  }
+}
+
+
+TEST(ActivePipeline, each_stage_has_its_own_thread) {
+  std::thread::id seen[3];
+  std::atomic<int> done(0);
+  std::unique_ptr<ActivePipeline<int> > pipeline = PipelineBuilder<int>()
+      .stage("first", [&seen](int value_) { seen[0] = std::this_thread::get_id(); return value_; })
+      .stage("second", [&seen](int value_) { seen[1] = std::this_thread::get_id(); return value_; })
+      .sink("third", [&seen, &done](int) { seen[2] = std::this_thread::get_id(); done = 1; });
+  pipeline->push(1);
+  while (0 == done) {
+    std::this_thread::yield();
+  }
+  std::set<std::thread::id> threads(seen, seen + 3);
+  ASSERT_EQ(3u, threads.size());
+  ASSERT_EQ(0u, threads.count(std::this_thread::get_id()));
+}
+
+
+TEST(ActivePipeline, backpressure_and_bottleneck) {
+  const int c_items = 200;
+  const size_t c_capacity = 4;
+  std::atomic<size_t> most_queued(0);
+  std::atomic<int> persisted(0);
+  std::unique_ptr<ActivePipeline<int> > pipeline = PipelineBuilder<int>(c_capacity)
+      .stage("fast", [](int value_) { return value_; })
+      .sink("slow", [&](int) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        ++persisted;
+      });
+  for (int idx = 0; idx < c_items; ++idx) {
+    pipeline->push(idx);
+    PipelineStats stats = pipeline->stats();
+    for (size_t stage = 0; stage < stats.stages.size(); ++stage) {
+      if (stats.stages[stage].queued > most_queued) {
+        most_queued = stats.stages[stage].queued;
+      }
+    }
+  }
+  // the producer got far ahead of the sink, it must have waited
+  PipelineStats stats = pipeline->stats();
+  ASSERT_LE(most_queued.load(), c_capacity);
+  ASSERT_GT(stats.stalled.count(), 0);
+  ASSERT_GT(stats.stages[0].stalled.count(), 0);
+  ASSERT_EQ(1u, stats.bottleneck);
+  ASSERT_GT(stats.stages[1].utilization, stats.stages[0].utilization);
+  pipeline.reset();
+  ASSERT_EQ(c_items, persisted.load());
+}
+
+
+TEST(ActivePipeline, try_push_keeps_the_item_when_full) {
+  std::atomic<bool> release(false);
+  std::atomic<int> persisted(0);
+  std::unique_ptr<ActivePipeline<std::unique_ptr<int> > > pipeline = PipelineBuilder<std::unique_ptr<int> >(2)
+      .sink("blocked", [&](std::unique_ptr<int>) {
+        while (!release) {
+          std::this_thread::yield();
+        }
+        ++persisted;
+      });
+  int queued = 0;
+  std::unique_ptr<int> item(new int(0));
+  while (queued < 100 && pipeline->try_push(std::move(item))) {
+    item.reset(new int(++queued));
+  }
+  ASSERT_LT(queued, 100);
+  ASSERT_TRUE(item != nullptr); // not moved from
+  release = true;
+  pipeline.reset();
+  ASSERT_EQ(queued, persisted.load());
+}
+
+TEST(ActivePipeline, bounded_stages_never_lose_a_drain) {
+  const int c_items = 20000;
+  const overflow_policy policies[] = { overflow_policy::reject, overflow_policy::drop_newest, overflow_policy::drop_oldest };
+  for (overflow_policy policy : policies) {
+    ActiveOptions options;
+    options.capacity = 1;
+    options.policy = policy;
+    std::atomic<int> persisted(0);
+    {
+      std::unique_ptr<ActivePipeline<int> > pipeline = PipelineBuilder<int>(4)
+          .stage(options, [](int value_) { return value_ + 1; })
+          .sink(options, [&persisted](int) { ++persisted; });
+      for (int idx = 0; idx < c_items; ++idx) {
+        pipeline->push(idx);
+      }
+    }
+    ASSERT_EQ(c_items, persisted.load());
+  }
+}
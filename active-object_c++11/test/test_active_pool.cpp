@@ -0,0 +1,149 @@
+/* *****************************************************************
+Test of the ActivePool, N background threads with work stealing
+
+Tests below:
+    1. All jobs are enqueued and executed, destruction drains the pool
+
+    2. Jobs sent from jobs (spawned into the worker's own deque)
+       are also executed before destruction finishes
+
+    3. Idle workers steal: one worker spawns jobs and then blocks,
+       the spawned jobs are executed by the other workers
+
+    4. call() works the same as for the Active
+
+    5. Sends from a job do not allocate in a steady state, the Job
+       nodes are recycled
+
+    6. Idle workers sleep, they burn no cpu while one long job runs
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "active_pool.h"
+#include "allocation_counter.h"
+
+using namespace kjellkod;
+
+namespace {
+void addTo(std::atomic<long>* sum_, int value_) {
+  sum_->fetch_add(value_);
+}
+
+void spawn(ActivePool* pool_, std::atomic<long>* sum_, int depth_) {
+  sum_->fetch_add(1);
+  if (depth_ > 0) {
+    pool_->send(std::bind(&spawn, pool_, sum_, depth_ - 1));
+    pool_->send(std::bind(&spawn, pool_, sum_, depth_ - 1));
+  }
+}
+
+void saveThreadId(std::mutex* m_, std::set<std::thread::id>* ids_) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  std::lock_guard<std::mutex> lock(*m_);
+  ids_->insert(std::this_thread::get_id());
+}
+
+// Spawns jobs into its own deque, then blocks so that they have to be stolen
+void spawnAndBlock(ActivePool* pool_, std::mutex* m_, std::set<std::thread::id>* ids_) {
+  for (int idx = 0; idx < 20; ++idx) {
+    pool_->send(std::bind(&saveThreadId, m_, ids_));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+
+// CPU bound job, the pool's scaling is measured in benchmark/benchmark.cpp
+unsigned intWork(unsigned value_) {
+  unsigned hash = value_;
+  for (int round = 0; round < 2000; ++round) {
+    hash = hash * 2654435761u + round;
+  }
+  return hash;
+}
+} // anonymous
+
+
+TEST(ActivePool, destruction_drains_all_jobs) {
+  const int c_nbrJobs = 100000;
+  std::atomic<long> sum(0);
+  long check = 0;
+  {
+    std::unique_ptr<ActivePool> pool = ActivePool::createActivePool(4);
+    ASSERT_EQ(4u, pool->size());
+    for (int idx = 0; idx < c_nbrJobs; ++idx) {
+      check += idx;
+      ASSERT_TRUE(pool->send(std::bind(&addTo, &sum, idx)));
+    }
+  }
+  ASSERT_EQ(check, sum.load());
+}
+
+
+TEST(ActivePool, jobs_sent_from_jobs_are_drained) {
+  std::atomic<long> sum(0);
+  {
+    std::unique_ptr<ActivePool> pool = ActivePool::createActivePool(3);
+    pool->send(std::bind(&spawn, pool.get(), &sum, 10));
+  }
+  ASSERT_EQ((1 << 11) - 1, sum.load());
+}
+
+
+TEST(ActivePool, idle_workers_steal) {
+  std::mutex m;
+  std::set<std::thread::id> ids;
+  {
+    std::unique_ptr<ActivePool> pool = ActivePool::createActivePool(4);
+    pool->send(std::bind(&spawnAndBlock, pool.get(), &m, &ids));
+  }
+  ASSERT_GT(ids.size(), 1u);
+}
+
+
+TEST(ActivePool, call_returns_value) {
+  std::unique_ptr<ActivePool> pool = ActivePool::createActivePool(2);
+  active_future<unsigned> result = pool->call(std::bind(&intWork, 42u));
+  ASSERT_EQ(intWork(42u), result.get());
+}
+
+
+TEST(ActivePool, sends_from_jobs_recycle_the_nodes) {
+  const int c_nbrJobs = 1000;
+  std::atomic<int> executed(0);
+  std::unique_ptr<ActivePool> pool = ActivePool::createActivePool(1); // the nodes come from this worker's pool
+  auto sendAll = [&pool, &executed, c_nbrJobs]() {
+    AllocationCounter counter;
+    for (int idx = 0; idx < c_nbrJobs; ++idx) {
+      pool->send([&executed]() { executed.fetch_add(1); });
+    }
+    return counter.count();
+  };
+  for (int round = 1; round <= 3; ++round) {
+    const unsigned long allocations = pool->call(sendAll).get();
+    while (executed.load() < round * c_nbrJobs) {
+      std::this_thread::yield();
+    }
+    if (round > 1) {
+      ASSERT_EQ(0u, allocations); // the first round made the nodes and grew the deque
+    }
+  }
+}
+
+
+TEST(ActivePool, idle_workers_sleep) {
+  std::unique_ptr<ActivePool> pool = ActivePool::createActivePool(4);
+  const std::clock_t start = std::clock(); // cpu time of all the threads
+  pool->call([]() { std::this_thread::sleep_for(std::chrono::milliseconds(200)); }).get();
+  const double cpu_ms = 1000.0 * (std::clock() - start) / CLOCKS_PER_SEC;
+  ASSERT_LT(cpu_ms, 100.0);
+}
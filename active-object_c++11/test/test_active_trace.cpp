@@ -0,0 +1,133 @@
+/* *****************************************************************
+Test of the job tracing, see active_trace.h
+
+Tests below:
+    1. trace_ring: recorded jobs are dumped as trace events, only the
+       last 'capacity' jobs are kept
+
+    2. A dump while the ring is written only holds whole records
+
+    3. With ACTIVE_TRACING: a traced Active's jobs, with their labels, are
+       in dump_trace(), also while the Active is stuck in a job. An Active
+       that is not traced, or destroyed, is not
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <chrono>
+
+#include "active.h"
+#include "active_trace.h"
+
+using namespace kjellkod;
+
+namespace {
+size_t countOf(const std::string& text_, const std::string& what_) {
+  size_t count = 0;
+  for (size_t pos = text_.find(what_); pos != std::string::npos; pos = text_.find(what_, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+std::string dumpOf(const trace_ring& ring_) {
+  std::ostringstream out;
+  bool first = true;
+  ring_.dump(out, first);
+  return out.str();
+}
+} // anonymous
+
+
+TEST(ActiveTrace, ring_keeps_the_last_jobs) {
+  trace_ring ring(8, "ring \"test\"");
+  ring.set_thread(trace_thread_id());
+  const trace_clock::time_point now = trace_clock::now();
+  for (int idx = 0; idx < 20; ++idx) {
+    ring.record(0 == idx % 2 ? "even" : "odd", 7, now, now + std::chrono::microseconds(1),
+                now + std::chrono::microseconds(2), now + std::chrono::microseconds(5));
+  }
+  ASSERT_EQ(20u, ring.recorded());
+  const std::string dump = dumpOf(ring);
+  ASSERT_EQ(1u, countOf(dump, "\"ph\": \"M\""));
+  ASSERT_EQ(1u, countOf(dump, "ring \\\"test\\\"")); // escaped
+  ASSERT_EQ(8u, countOf(dump, "\"ph\": \"X\""));
+  ASSERT_EQ(8u, countOf(dump, "\"ph\": \"b\""));
+  ASSERT_EQ(8u, countOf(dump, "\"ph\": \"e\""));
+  ASSERT_EQ(4u, countOf(dump, "\"name\": \"even\""));
+  ASSERT_EQ(0u, countOf(dump, "\"job\": 11,"));
+  ASSERT_EQ(1u, countOf(dump, "\"job\": 12,"));
+  ASSERT_EQ(8u, countOf(dump, "\"dur\": 3.000"));
+}
+
+
+TEST(ActiveTrace, dump_while_recording) {
+  trace_ring ring(64, "writer");
+  std::atomic<bool> stop(false);
+  std::thread writer([&]() {
+    ring.set_thread(trace_thread_id());
+    while (!stop.load()) {
+      const trace_clock::time_point now = trace_clock::now();
+      ring.record("job", 1, now, now, now, now + std::chrono::microseconds(1));
+    }
+  });
+  for (int idx = 0; idx < 200; ++idx) {
+    const std::string dump = dumpOf(ring);
+    ASSERT_EQ(countOf(dump, "\"ph\": \"X\""), countOf(dump, "\"ph\": \"b\""));
+    ASSERT_EQ(countOf(dump, "\"ph\": \"X\""), countOf(dump, "\"dur\": 1.000"));
+    ASSERT_GE(64u, countOf(dump, "\"ph\": \"X\""));
+  }
+  stop.store(true);
+  writer.join();
+}
+
+
+#if defined(ACTIVE_TRACING)
+TEST(ActiveTrace, traced_active) {
+  ActiveOptions options;
+  options.name = "traced";
+  options.trace_capacity = 100;
+  std::unique_ptr<Active> traced(Active::createActive(options));
+  std::unique_ptr<Active> untraced(Active::createActive());
+  untraced->send([]() {}, "untraced-job");
+
+  std::atomic<bool> release(false);
+  for (int idx = 0; idx < 10; ++idx) {
+    traced->send([]() {}, "labeled");
+  }
+  traced->send([]() {});
+  traced->send([&]() {
+    while (!release.load()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }, "stuck");
+  traced->send([]() {}, "behind the stuck job", lane::bulk);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  std::ostringstream stuck;
+  dump_trace(stuck);
+  ASSERT_EQ(1u, countOf(stuck.str(), "\"name\": \"traced\""));
+  ASSERT_EQ(10u, countOf(stuck.str(), "\"name\": \"labeled\", \"cat\": \"job\""));
+  ASSERT_EQ(1u, countOf(stuck.str(), "\"name\": \"job\", \"cat\": \"job\""));
+  ASSERT_EQ(0u, countOf(stuck.str(), "stuck"));
+  ASSERT_EQ(0u, countOf(stuck.str(), "untraced-job"));
+
+  release.store(true);
+  traced->flush(); // all three lanes, "behind the stuck job" is in the bulk lane
+  std::ostringstream done;
+  dump_trace(done);
+  ASSERT_EQ(1u, countOf(done.str(), "\"name\": \"stuck\""));
+  ASSERT_EQ(1u, countOf(done.str(), "\"name\": \"behind the stuck job\""));
+
+  traced.reset();
+  std::ostringstream gone;
+  dump_trace(gone);
+  ASSERT_EQ(0u, countOf(gone.str(), "\"name\": \"traced\""));
+}
+#endif
@@ -0,0 +1,180 @@
+/* *****************************************************************
+Test of the Backgrounder example worker, mostly its batching mode
+
+Tests below:
+    1. Batching keeps FIFO order, also for the partial batches that are
+       flushed by the latency timer and by the destructor
+
+    2. Several producers, each producer's values are stored in order
+
+    3. Throughput printouts, one job per value vs batching.
+       Not a verification, just numbers to compare
+
+    4. One job per value with pooled std::string payloads
+
+    5. flush() is a barrier, also for a partially filled batch, and
+       stored() counts while the worker is still saving
+
+    6. Spill mode: a slow worker, the values wait on disk and are
+       stored in FIFO order, from one value and from ranges
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include "backgrounder.h"
+
+
+TEST(Backgrounder, batching_keeps_fifo_order) {
+  std::vector<int> received;
+  {
+    Backgrounder<int> worker(received, 0, 64, std::chrono::microseconds(100));
+    for (int idx = 0; idx < 1000; ++idx) {
+      worker.saveData(idx);
+      if (0 == idx % 300) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5)); // the timer flushes a partial batch
+      }
+    }
+    std::vector<int> range;
+    for (int idx = 1000; idx < 1100; ++idx) {
+      range.push_back(idx);
+    }
+    worker.saveData(range.begin(), range.end());
+    worker.saveData(1100);
+  } // the last partial batch is flushed
+  ASSERT_EQ(1101u, received.size());
+  for (int idx = 0; idx < 1101; ++idx) {
+    ASSERT_EQ(idx, received[idx]);
+  }
+}
+
+
+TEST(Backgrounder, batching_with_several_producers) {
+  const int c_producers = 4;
+  const int c_perProducer = 20000;
+  std::vector<int> received;
+  {
+    Backgrounder<int> worker(received, 1000, 256, std::chrono::microseconds(200));
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < c_producers; ++producer) {
+      producers.push_back(std::thread([&worker, producer]() {
+        for (int idx = 0; idx < c_perProducer; ++idx) {
+          worker.saveData((producer << 24) | idx);
+        }
+      }));
+    }
+    for (size_t idx = 0; idx < producers.size(); ++idx) {
+      producers[idx].join();
+    }
+  }
+  ASSERT_EQ(static_cast<size_t>(c_producers * c_perProducer), received.size());
+  std::vector<int> next(c_producers, 0);
+  for (size_t idx = 0; idx < received.size(); ++idx) {
+    const int producer = received[idx] >> 24;
+    ASSERT_EQ(next[producer]++, received[idx] & 0xffffff);
+  }
+}
+
+
+namespace {
+double itemsPerSecond(size_t maxBatch_) {
+  const int c_nbrItems = 10000; // one job per value sleeps for each item
+  std::vector<int> received;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  {
+    Backgrounder<int> worker(received, 10000, maxBatch_);
+    for (int idx = 0; idx < c_nbrItems; ++idx) {
+      worker.saveData(idx);
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return c_nbrItems / elapsed.count();
+}
+} // anonymous
+
+
+TEST(Backgrounder, throughput_batched_vs_one_job_per_value) {
+  std::cout << "\t\t\tBackgrounder<int> [items/s]. one job per value: " << static_cast<long>(itemsPerSecond(1));
+  std::cout << ", batches of 1024: " << static_cast<long>(itemsPerSecond(1024)) << std::endl;
+}
+
+
+TEST(Backgrounder, pooled_payloads_keep_fifo_order) {
+  const int c_nbrValues = 10000;
+  std::vector<std::string> received;
+  {
+    Backgrounder<std::string> worker(received);
+    worker.setProcessTime(std::chrono::microseconds(0));
+    for (int idx = 0; idx < c_nbrValues; ++idx) {
+      worker.saveData(std::to_string(idx));
+    }
+  }
+  ASSERT_EQ(static_cast<size_t>(c_nbrValues), received.size());
+  for (int idx = 0; idx < c_nbrValues; ++idx) {
+    ASSERT_EQ(std::to_string(idx), received[idx]);
+  }
+}
+
+
+TEST(Backgrounder, flush_and_stored) {
+  std::vector<int> received;
+  Backgrounder<int> worker(received, 0, 64, std::chrono::seconds(60)); // the timer never flushes
+  for (int idx = 0; idx < 1000; ++idx) {
+    worker.saveData(idx);
+    ASSERT_LE(worker.stored(), static_cast<size_t>(idx) + 1);
+  }
+  worker.flush();
+  ASSERT_EQ(1000u, worker.stored());
+  ASSERT_EQ(1000u, received.size()); // the bg thread is done with it
+  for (int idx = 0; idx < 1000; ++idx) {
+    ASSERT_EQ(idx, received[idx]);
+  }
+}
+
+#if defined(__unix__)
+TEST(Backgrounder, spill_mode_keeps_fifo_order) {
+  const int c_values = 20000;
+  std::vector<std::string> received;
+  std::vector<std::string> expected;
+  {
+    kjellkod::spill_options options;
+    options.memory_items = 100;
+    options.segment_bytes = 16 * 1024;
+    Backgrounder<std::string> worker(received);
+    worker.setProcessTime(std::chrono::microseconds(200)); // per drained batch
+    worker.setSpill(options);
+    for (int idx = 0; idx < c_values; ++idx) {
+      expected.push_back(std::to_string(idx));
+      if (idx % 10 == 9) {
+        worker.saveData(expected.end() - 10, expected.end());
+      } else if (idx % 10 < 5) {
+        worker.saveData(expected.back());
+      }
+    }
+    ASSERT_GT(worker.spilled(), 0u); // the producer outran the worker
+    worker.flush();
+    ASSERT_EQ(0u, worker.spilled());
+    worker.saveData("last");
+    expected.push_back("last");
+  } // the destructor stores the rest
+
+  // a value saved from a range is saved twice when idx % 10 < 5
+  std::vector<std::string> saved;
+  for (int idx = 0; idx < c_values; ++idx) {
+    if (idx % 10 < 5) {
+      saved.push_back(expected[idx]);
+    }
+    if (idx % 10 == 9) {
+      saved.insert(saved.end(), expected.begin() + idx - 9, expected.begin() + idx + 1);
+    }
+  }
+  saved.push_back("last");
+  ASSERT_EQ(saved, received);
+}
+#endif
@@ -0,0 +1,202 @@
+/* *****************************************************************
+Test of IoActive, an Active that also waits for file descriptors (Linux)
+
+Tests below:
+    1. Jobs are executed in FIFO order on one other thread, also when
+       sent to an idle (sleeping) thread, and the queue is drained on
+       destruction
+
+    2. A pipe's handler runs on the Active's thread, the same thread as
+       its jobs, and stops being called after unwatch
+
+    3. socketpair echo: the handler reads and answers on the Active's thread
+
+    4. A never ending stream of jobs does not starve the descriptors
+
+    5. watch of an invalid descriptor fails through the future
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "io_active.h"
+
+using namespace kjellkod;
+
+namespace {
+struct Pipe {
+  int fds[2];
+  Pipe() { EXPECT_EQ(0, pipe(fds)); }
+  ~Pipe() {
+    close(fds[0]);
+    close(fds[1]);
+  }
+  int readEnd() const { return fds[0]; }
+  int writeEnd() const { return fds[1]; }
+};
+} // anonymous
+
+
+TEST(IoActive, jobs_in_order_and_drained) {
+  const int c_jobs = 10000;
+  std::vector<int> executed;
+  std::thread::id worker;
+  {
+    std::unique_ptr<IoActive> io = IoActive::createIoActive();
+    for (int idx = 0; idx < c_jobs; ++idx) {
+      io->send([idx, &executed, &worker]() {
+        executed.push_back(idx);
+        worker = std::this_thread::get_id();
+      });
+      if (0 == idx % 1000) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2)); // let it fall asleep in epoll_wait
+      }
+    }
+    ASSERT_EQ(c_jobs, io->call([&executed]() { return static_cast<int>(executed.size()); }).get());
+    io->send([]() {});
+  }
+  ASSERT_EQ(static_cast<size_t>(c_jobs), executed.size());
+  for (int idx = 0; idx < c_jobs; ++idx) {
+    ASSERT_EQ(idx, executed[idx]);
+  }
+  ASSERT_NE(std::this_thread::get_id(), worker);
+}
+
+TEST(IoActive, pipe_handler_on_the_active_thread) {
+  Pipe pipe;
+  std::unique_ptr<IoActive> io = IoActive::createIoActive();
+  const std::thread::id worker = io->call([]() { return std::this_thread::get_id(); }).get();
+
+  std::atomic<int> bytes(0);
+  std::atomic<int> calls(0);
+  std::atomic<bool> wrong_thread(false);
+  const int read_end = pipe.readEnd();
+  io->watch(read_end, EPOLLIN, [&, read_end, worker](uint32_t events_) {
+    EXPECT_TRUE(0 != (events_ & EPOLLIN));
+    wrong_thread = wrong_thread || (std::this_thread::get_id() != worker);
+    char buffer[64];
+    const ssize_t got = read(read_end, buffer, sizeof(buffer));
+    if (got > 0) {
+      bytes += static_cast<int>(got);
+    }
+    ++calls;
+  }).get();
+  ASSERT_EQ(1u, io->call([&io]() { return io->watched(); }).get());
+
+  const std::string c_text = "hello";
+  for (int idx = 0; idx < 10; ++idx) {
+    ASSERT_EQ(static_cast<ssize_t>(c_text.size()), write(pipe.writeEnd(), c_text.data(), c_text.size()));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (bytes.load() < static_cast<int>(c_text.size()) * (idx + 1) && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+  }
+  ASSERT_EQ(static_cast<int>(c_text.size()) * 10, bytes.load());
+  ASSERT_FALSE(wrong_thread.load());
+
+  io->unwatch(read_end).get();
+  ASSERT_EQ(0u, io->call([&io]() { return io->watched(); }).get());
+  const int calls_before = calls.load();
+  ASSERT_EQ(1, write(pipe.writeEnd(), "x", 1));
+  io->call([]() { return 0; }).get(); // a poll happens before each batch of jobs
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(calls_before, calls.load());
+}
+
+TEST(IoActive, socketpair_echo) {
+  int sockets[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+  {
+    std::unique_ptr<IoActive> io = IoActive::createIoActive();
+    const int server = sockets[1];
+    io->watch(server, EPOLLIN, [server](uint32_t) {
+      char buffer[256];
+      const ssize_t got = read(server, buffer, sizeof(buffer));
+      if (got > 0) {
+        EXPECT_EQ(got, write(server, buffer, got));
+      }
+    }).get();
+
+    for (int idx = 0; idx < 100; ++idx) {
+      const std::string request = "ping " + std::to_string(idx);
+      ASSERT_EQ(static_cast<ssize_t>(request.size()), write(sockets[0], request.data(), request.size()));
+      std::string reply;
+      while (reply.size() < request.size()) {
+        char buffer[256];
+        const ssize_t got = read(sockets[0], buffer, sizeof(buffer)); // blocks until the echo
+        ASSERT_GT(got, 0);
+        reply.append(buffer, got);
+      }
+      ASSERT_EQ(request, reply);
+    }
+    io->unwatch(server).get();
+  }
+  close(sockets[0]);
+  close(sockets[1]);
+}
+
+// a job that sends itself again keeps the queue non-empty until the pipe is seen
+namespace {
+struct Spinner {
+  IoActive* io;
+  std::atomic<bool>* stop;
+  std::atomic<int>* spins;
+  void operator()() {
+    ++*spins;
+    if (!stop->load()) {
+      io->send(Spinner(*this));
+    }
+  }
+};
+} // anonymous
+
+TEST(IoActive, busy_jobs_do_not_starve_descriptors) {
+  Pipe pipe;
+  std::atomic<bool> stop(false);
+  std::atomic<int> spins(0);
+  {
+    std::unique_ptr<IoActive> io = IoActive::createIoActive();
+    const int read_end = pipe.readEnd();
+    io->watch(read_end, EPOLLIN, [read_end, &stop](uint32_t) {
+      char byte = 0;
+      EXPECT_EQ(1, read(read_end, &byte, 1));
+      stop = true;
+    }).get();
+    Spinner spinner = { io.get(), &stop, &spins };
+    io->send(spinner);
+    while (spins.load() < 100) {
+      std::this_thread::yield();
+    }
+    ASSERT_EQ(1, write(pipe.writeEnd(), "x", 1));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!stop.load() && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+    ASSERT_TRUE(stop.load());
+    io->unwatch(read_end).get();
+  }
+}
+
+TEST(IoActive, watch_invalid_descriptor_throws) {
+  std::unique_ptr<IoActive> io = IoActive::createIoActive();
+  active_future<void> watched = io->watch(-1, EPOLLIN, [](uint32_t) {});
+  ASSERT_THROW(watched.get(), std::system_error);
+  ASSERT_EQ(0u, io->call([&io]() { return io->watched(); }).get());
+}
+
+#endif // __linux__
@@ -0,0 +1,168 @@
+/* *****************************************************************
+Test of the message_pool, recycled payload storage
+
+Tests below:
+    1. Payloads released on another thread are reused by the producer,
+       no allocations in a steady state
+
+    2. Several producers, each with its own pool, one consumer
+
+    3. A producer thread exits while its payloads are still in use, they
+       are destroyed and freed when the consumer releases them
+
+    4. A job that holds a pooled payload is stored inline in a Job
+
+    5. A producer thread exits while another thread releases all of its
+       payloads, the pool is deleted once, after its owner is done with it
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "message_pool.h"
+#include "shared_queue.h"
+#include "unique_function.h"
+#include "allocation_counter.h"
+
+using namespace kjellkod;
+
+namespace {
+std::atomic<int> g_alive(0);
+
+struct Payload {
+  int value;
+  explicit Payload(int value_) : value(value_) { ++g_alive; }
+  ~Payload() { --g_alive; }
+};
+} // anonymous
+
+
+TEST(MessagePool, reuse_after_release_on_another_thread) {
+  const int c_rounds = 100;
+  const int c_inFlight = 32;
+  shared_queue<pooled<Payload> > toConsumer;
+  shared_queue<int> done;
+  std::thread consumer([&]() {
+    for (int idx = 0; idx < c_rounds * c_inFlight; ++idx) {
+      pooled<Payload> payload;
+      toConsumer.wait_and_pop(payload);
+      ASSERT_EQ(idx, payload->value);
+      payload.reset(); // back to the producer's pool
+      if (c_inFlight - 1 == idx % c_inFlight) {
+        done.push(idx);
+      }
+    }
+  });
+
+  unsigned long steadyAllocations = 0;
+  for (int round = 0; round < c_rounds; ++round) {
+    AllocationCounter allocations;
+    for (int idx = 0; idx < c_inFlight; ++idx) {
+      toConsumer.push(make_pooled<Payload>(round * c_inFlight + idx));
+    }
+    int last = 0;
+    done.wait_and_pop(last);
+    if (round > 0) {
+      steadyAllocations += allocations.count();
+    }
+  }
+  consumer.join();
+  ASSERT_EQ(0, g_alive.load());
+  ASSERT_EQ(static_cast<size_t>(c_inFlight), message_pool<Payload>::local().nodes());
+  // only the shared_queue's deque nodes, the payloads are recycled
+  ASSERT_GT(static_cast<unsigned long>(c_rounds * c_inFlight / 4), steadyAllocations);
+}
+
+
+TEST(MessagePool, several_producers) {
+  const int c_producers = 4;
+  const int c_perProducer = 20000;
+  shared_queue<pooled<Payload> > toConsumer(64);
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < c_producers; ++producer) {
+    producers.push_back(std::thread([&toConsumer, producer]() {
+      for (int idx = 0; idx < c_perProducer; ++idx) {
+        toConsumer.push(make_pooled<Payload>((producer << 24) | idx));
+      }
+    }));
+  }
+  std::vector<int> next(c_producers, 0);
+  for (int idx = 0; idx < c_producers * c_perProducer; ++idx) {
+    pooled<Payload> payload;
+    toConsumer.wait_and_pop(payload);
+    const int producer = payload->value >> 24;
+    ASSERT_EQ(next[producer]++, payload->value & 0xffffff);
+  }
+  for (size_t idx = 0; idx < producers.size(); ++idx) {
+    producers[idx].join();
+  }
+  ASSERT_EQ(0, g_alive.load());
+}
+
+
+TEST(MessagePool, producer_exits_before_release) {
+  std::vector<pooled<Payload> > inUse;
+  std::thread producer([&inUse]() {
+    for (int idx = 0; idx < 100; ++idx) {
+      inUse.push_back(make_pooled<Payload>(idx));
+    }
+    inUse.erase(inUse.begin(), inUse.begin() + 50); // released while the owner lives
+  });
+  producer.join();
+  ASSERT_EQ(50, g_alive.load());
+  ASSERT_EQ(50, inUse.front()->value);
+  inUse.clear(); // the pool is gone with its last payload
+  ASSERT_EQ(0, g_alive.load());
+}
+
+
+TEST(MessagePool, producer_exits_while_all_payloads_are_released) {
+  const int c_rounds = 500;
+  shared_queue<pooled<Payload> > toConsumer;
+  std::thread consumer([&toConsumer]() {
+    for (int idx = 0; idx < c_rounds; ++idx) {
+      pooled<Payload> payload;
+      toConsumer.wait_and_pop(payload);
+      payload.reset(); // races with the producer's exit
+    }
+  });
+  for (int round = 0; round < c_rounds; ++round) {
+    std::thread producer([&toConsumer]() {
+      toConsumer.push(make_pooled<Payload>(0)); // the only node, held by the consumer
+    });
+    producer.join();
+  }
+  consumer.join();
+  ASSERT_EQ(0, g_alive.load());
+}
+
+
+namespace {
+struct ConsumePayload {
+  int* sum;
+  pooled<Payload> payload;
+  void operator()() { *sum += payload->value; }
+};
+} // anonymous
+
+
+TEST(MessagePool, pooled_job_is_stored_inline) {
+  int sum = 0;
+  { // warm up the pool
+    ConsumePayload consume = { &sum, make_pooled<Payload>(1) };
+  }
+  AllocationCounter allocations;
+  for (int idx = 0; idx < 100; ++idx) {
+    ConsumePayload consume = { &sum, make_pooled<Payload>(idx) };
+    unique_function<void(), 64> job(std::move(consume));
+    job();
+  }
+  ASSERT_EQ(0ul, allocations.count());
+  ASSERT_EQ(4950, sum);
+  ASSERT_EQ(0, g_alive.load());
+}
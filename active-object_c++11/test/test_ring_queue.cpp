@@ -0,0 +1,301 @@
+/* *****************************************************************
+Test of the lock-free ring_queue and comparison with the mutex
+protected shared_queue.
+
+Tests below:
+    1. One producer, the FIFO order must be kept also when the ring wraps around
+       and the producer has to wait for room (small capacity)
+
+    2. Several producers, all items arrive and each producer's items
+       arrive in the order they were pushed
+
+    3. The SPSC specialization keeps FIFO order
+
+    4. Overflow policies of the bounded multiple producer ring
+
+    5. Throughput printouts, shared_queue vs ring_queue for
+       1 and 4 producers. Not a verification, just numbers to compare
+
+    6. push_range into a ring smaller than the batch, FIFO order is kept
+
+    7. emplace makes the item in its slot, move-only items work
+
+    8. A ring without parking, its owner wakes the consumer: FIFO and
+       nothing lost, also when the ring wraps around and push waits for room
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <queue>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+#include "shared_queue.h"
+#include "ring_queue.h"
+
+
+namespace {
+const int c_nbrItems = 200000;
+
+// producer 'id' in the high bits, sequence in the low bits
+int encode(int producer_, int sequence_) {
+  return (producer_ << 24) | sequence_;
+}
+
+template<typename Queue>
+void produce(Queue& queue_, int producer_, int count_) {
+  for (int idx = 0; idx < count_; ++idx) {
+    queue_.push(encode(producer_, idx));
+  }
+}
+
+/// @return true if all items arrived and each producer's items are in order
+template<typename Queue>
+bool consumeInOrder(Queue& queue_, int producers_, int count_) {
+  std::vector<int> expected(producers_, 0);
+  for (int idx = 0; idx < producers_ * count_; ++idx) {
+    int item;
+    queue_.wait_and_pop(item);
+    int producer = item >> 24;
+    int sequence = item & 0xFFFFFF;
+    if (expected[producer] != sequence) {
+      return false;
+    }
+    ++expected[producer];
+  }
+  return queue_.empty();
+}
+
+/// @return items per second for 'producers_' threads pushing to one consumer
+template<typename Queue>
+double measureThroughput(Queue& queue_, int producers_) {
+  const int count = c_nbrItems / producers_;
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int producer = 0; producer < producers_; ++producer) {
+    threads.push_back(std::thread(&produce<Queue>, std::ref(queue_), producer, count));
+  }
+  bool ok = consumeInOrder(queue_, producers_, count);
+  for (size_t idx = 0; idx < threads.size(); ++idx) {
+    threads[idx].join();
+  }
+  auto stop = std::chrono::steady_clock::now();
+  EXPECT_TRUE(ok);
+  double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(stop - start).count();
+  return (producers_ * count) / seconds;
+}
+} // anonymous
+
+
+
+TEST(RingQueue, capacity_is_power_of_two) {
+  mpsc_ring_queue<int> mpsc(1000);
+  spsc_ring_queue<int> spsc(3);
+  EXPECT_EQ(1024u, mpsc.capacity());
+  EXPECT_EQ(4u, spsc.capacity());
+}
+
+
+TEST(RingQueue, try_push_fails_when_full) {
+  mpsc_ring_queue<int> queue(4);
+  for (int idx = 0; idx < 4; ++idx) {
+    ASSERT_TRUE(queue.try_push(idx));
+  }
+  ASSERT_FALSE(queue.try_push(4));
+  ASSERT_EQ(4u, queue.size());
+
+  int item = -1;
+  ASSERT_TRUE(queue.try_and_pop(item));
+  ASSERT_EQ(0, item);
+  ASSERT_TRUE(queue.try_push(4));
+}
+
+
+TEST(RingQueue, overflow_policies) {
+  mpsc_ring_queue<int> rejecting(4, overflow_policy::reject);
+  mpsc_ring_queue<int> oldest(4, overflow_policy::drop_oldest);
+  mpsc_ring_queue<int> newest(4, overflow_policy::drop_newest);
+  mpsc_ring_queue<int> blocking(4, overflow_policy::block);
+  for (int idx = 0; idx < 6; ++idx) {
+    ASSERT_EQ(idx < 4, rejecting.push(idx));
+    ASSERT_TRUE(oldest.push(idx));
+    ASSERT_EQ(idx < 4, newest.push(idx));
+  }
+  ASSERT_EQ(2u, rejecting.rejected());
+  ASSERT_EQ(2u, oldest.dropped());
+  ASSERT_EQ(2u, newest.dropped());
+
+  int item = -1;
+  ASSERT_TRUE(oldest.try_and_pop(item));
+  ASSERT_EQ(2, item);
+  ASSERT_TRUE(newest.try_and_pop(item));
+  ASSERT_EQ(0, item);
+
+  for (int idx = 0; idx < 4; ++idx) {
+    ASSERT_TRUE(blocking.push(idx));
+  }
+  ASSERT_FALSE(blocking.push_for(4, std::chrono::milliseconds(5)));
+  ASSERT_EQ(1u, blocking.rejected());
+}
+
+
+TEST(RingQueue, single_producer_fifo_with_wrap_around) {
+  mpsc_ring_queue<int> queue(16);
+  std::thread producer(&produce<mpsc_ring_queue<int> >, std::ref(queue), 0, c_nbrItems);
+  ASSERT_TRUE(consumeInOrder(queue, 1, c_nbrItems));
+  producer.join();
+}
+
+
+TEST(RingQueue, multiple_producers_keep_per_producer_order) {
+  const int producers = 4;
+  mpsc_ring_queue<int> queue(64);
+  std::vector<std::thread> threads;
+  for (int producer = 0; producer < producers; ++producer) {
+    threads.push_back(std::thread(&produce<mpsc_ring_queue<int> >, std::ref(queue), producer, c_nbrItems / producers));
+  }
+  ASSERT_TRUE(consumeInOrder(queue, producers, c_nbrItems / producers));
+  for (size_t idx = 0; idx < threads.size(); ++idx) {
+    threads[idx].join();
+  }
+}
+
+
+TEST(RingQueue, spsc_fifo_with_wrap_around) {
+  spsc_ring_queue<int> queue(16);
+  std::thread producer(&produce<spsc_ring_queue<int> >, std::ref(queue), 0, c_nbrItems);
+  ASSERT_TRUE(consumeInOrder(queue, 1, c_nbrItems));
+  producer.join();
+}
+
+
+TEST(RingQueue, non_trivial_items_are_destroyed) {
+  std::shared_ptr<int> counted(new int(1));
+  {
+    mpsc_ring_queue<std::shared_ptr<int> > queue(8);
+    queue.push(counted);
+    queue.push(counted);
+    std::shared_ptr<int> popped;
+    queue.wait_and_pop(popped);
+    ASSERT_EQ(3, counted.use_count());
+  }
+  ASSERT_EQ(1, counted.use_count());
+}
+
+
+TEST(RingQueue, throughput_compared_to_shared_queue) {
+  for (int producers = 1; producers <= 4; producers *= 4) {
+    shared_queue<int> locked;
+    mpsc_ring_queue<int> lockfree;
+    double locked_rate = measureThroughput(locked, producers);
+    double lockfree_rate = measureThroughput(lockfree, producers);
+    std::cout << "\t\t\t" << producers << " producer(s) [items/s]. shared_queue: " << static_cast<long>(locked_rate);
+    std::cout << ", mpsc_ring_queue: " << static_cast<long>(lockfree_rate) << std::endl;
+  }
+  spsc_ring_queue<int> spsc;
+  std::cout << "\t\t\t1 producer [items/s]. spsc_ring_queue: ";
+  std::cout << static_cast<long>(measureThroughput(spsc, 1)) << std::endl;
+}
+
+
+TEST(RingQueue, pop_all_drains_in_fifo_order) {
+  mpsc_ring_queue<int> queue(16);
+  for (int idx = 0; idx < 10; ++idx) {
+    queue.push(idx);
+  }
+  std::queue<int> batch;
+  queue.wait_and_pop_all(batch);
+  ASSERT_TRUE(queue.empty());
+  ASSERT_FALSE(queue.try_and_pop_all(batch));
+  ASSERT_EQ(10u, batch.size());
+  for (int idx = 0; idx < 10; ++idx) {
+    ASSERT_EQ(idx, batch.front());
+    batch.pop();
+  }
+}
+
+
+TEST(RingQueue, push_range_bigger_than_the_ring) {
+  const int c_batch = 1000;
+  std::vector<int> batch;
+  for (int idx = 0; idx < c_batch; ++idx) {
+    batch.push_back(idx);
+  }
+  mpsc_ring_queue<int> mpsc(16);
+  spsc_ring_queue<int> spsc(16);
+  std::vector<int> from_mpsc, from_spsc;
+  std::thread consumer([&]() {
+    while (from_mpsc.size() < batch.size() || from_spsc.size() < batch.size()) {
+      int item = -1;
+      if (mpsc.try_and_pop(item)) {
+        from_mpsc.push_back(item);
+      }
+      if (spsc.try_and_pop(item)) {
+        from_spsc.push_back(item);
+      }
+    }
+  });
+  ASSERT_EQ(static_cast<size_t>(c_batch), mpsc.push_range(batch.begin(), batch.end()));
+  ASSERT_EQ(static_cast<size_t>(c_batch), spsc.push_range(batch.begin(), batch.end()));
+  consumer.join();
+  ASSERT_EQ(batch, from_mpsc);
+  ASSERT_EQ(batch, from_spsc);
+}
+
+
+TEST(RingQueue, emplace_and_move_only_items) {
+  mpsc_ring_queue<std::unique_ptr<int> > mpsc(2, overflow_policy::reject);
+  spsc_ring_queue<std::unique_ptr<int> > spsc(2);
+  ASSERT_TRUE(mpsc.emplace(new int(1)));
+  ASSERT_TRUE(mpsc.push(std::unique_ptr<int>(new int(2))));
+  std::unique_ptr<int> rejected(new int(3));
+  ASSERT_FALSE(mpsc.try_push(std::move(rejected)));
+  spsc.emplace(new int(1));
+  spsc.push(std::unique_ptr<int>(new int(2)));
+
+  std::unique_ptr<int> item;
+  for (int idx = 1; idx <= 2; ++idx) {
+    ASSERT_TRUE(mpsc.try_and_pop(item));
+    ASSERT_EQ(idx, *item);
+    ASSERT_TRUE(spsc.try_and_pop(item));
+    ASSERT_EQ(idx, *item);
+  }
+  ASSERT_TRUE(mpsc.empty());
+  ASSERT_TRUE(spsc.empty());
+}
+
+TEST(RingQueue, no_parking_owner_signals) {
+  mpsc_ring_queue<int, no_parking> mpsc(16);
+  spsc_ring_queue<int, no_parking> spsc(16);
+  std::atomic<int> signalled(0); // the owner's doorbell, here a counter that is polled
+  std::thread producer([&]() {
+    for (int idx = 0; idx < c_nbrItems; ++idx) {
+      mpsc.push(idx);
+      spsc.push(idx);
+      signalled.fetch_add(1, std::memory_order_release);
+    }
+  });
+  int from_mpsc = 0;
+  int from_spsc = 0;
+  std::queue<int> batch;
+  while (from_mpsc < c_nbrItems || from_spsc < c_nbrItems) {
+    if (0 == signalled.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (mpsc.try_and_pop_all(batch); !batch.empty(); batch.pop()) {
+      ASSERT_EQ(from_mpsc++, batch.front());
+    }
+    for (spsc.try_and_pop_all(batch); !batch.empty(); batch.pop()) {
+      ASSERT_EQ(from_spsc++, batch.front());
+    }
+  }
+  producer.join();
+  ASSERT_TRUE(mpsc.empty());
+  ASSERT_TRUE(spsc.empty());
+}
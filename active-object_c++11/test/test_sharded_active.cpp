@@ -0,0 +1,153 @@
+/* *****************************************************************
+Test of the ShardedActive, key affine routing to a set of Active objects
+
+Tests below:
+    1. The same key is always routed to the same shard
+
+    2. Jobs for each key are executed in FIFO order also when several
+       producer threads send for many keys at the same time
+
+    3. Different keys are spread over the shards (imbalance metric)
+
+    4. Hot-key detection finds a key that gets most of the jobs
+
+    5. Bounded shards from ActiveOptions: a rejected send returns false, and
+       only queued jobs are counted, also by the hot-key sampling. Zero
+       shards is refused
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sharded_active.h"
+
+using namespace kjellkod;
+
+namespace {
+// only touched by the shard that owns 'key_', i.e. one thread per key
+void appendForKey(std::vector<std::vector<int> >* received_, int key_, int value_) {
+  (*received_)[key_].push_back(value_);
+}
+
+void noop() {}
+
+void produce(ShardedActive<int>* sharded_, std::vector<std::vector<int> >* received_,
+             int first_key_, int nbr_keys_, int nbr_jobs_) {
+  for (int value = 0; value < nbr_jobs_; ++value) {
+    for (int key = first_key_; key < first_key_ + nbr_keys_; ++key) {
+      sharded_->send(key, std::bind(&appendForKey, received_, key, value));
+    }
+  }
+}
+} // anonymous
+
+
+TEST(ShardedActive, same_key_same_shard) {
+  ShardedActive<std::string> sharded(8);
+  ASSERT_EQ(8u, sharded.size());
+  ASSERT_EQ(sharded.shardFor("customer-42"), sharded.shardFor("customer-42"));
+  ASSERT_LT(sharded.shardFor("customer-42"), 8u);
+}
+
+
+TEST(ShardedActive, fifo_order_per_key) {
+  const int c_producers = 4;
+  const int c_keysPerProducer = 25;
+  const int c_jobsPerKey = 1000;
+  std::vector<std::vector<int> > received(c_producers * c_keysPerProducer);
+  {
+    ShardedActive<int> sharded(4);
+    std::vector<std::thread> producers;
+    for (int idx = 0; idx < c_producers; ++idx) {
+      producers.push_back(std::thread(&produce, &sharded, &received,
+                                      idx * c_keysPerProducer, c_keysPerProducer, c_jobsPerKey));
+    }
+    for (size_t idx = 0; idx < producers.size(); ++idx) {
+      producers[idx].join();
+    }
+  } // drain all shards
+
+  for (size_t key = 0; key < received.size(); ++key) {
+    ASSERT_EQ(static_cast<size_t>(c_jobsPerKey), received[key].size());
+    for (int value = 0; value < c_jobsPerKey; ++value) {
+      ASSERT_EQ(value, received[key][value]);
+    }
+  }
+}
+
+
+TEST(ShardedActive, keys_are_spread_over_shards) {
+  ShardedActive<int> sharded(4);
+  for (int key = 0; key < 10000; ++key) {
+    sharded.send(key, &noop);
+  }
+  ShardStats stats = sharded.stats();
+  ASSERT_EQ(4u, stats.sent.size());
+  for (size_t idx = 0; idx < stats.sent.size(); ++idx) {
+    ASSERT_GT(stats.sent[idx], 0u);
+  }
+  ASSERT_LT(stats.imbalance, 1.2);
+  ASSERT_TRUE(sharded.hotKeys().empty()); // detection is off
+}
+
+
+TEST(ShardedActive, hot_key_detection) {
+  ShardedActive<int> sharded(4, 10);
+  for (int idx = 0; idx < 10000; ++idx) {
+    const int key = (idx % 2) ? 7 : idx; // every other job is for key 7
+    sharded.send(key, &noop);
+  }
+  std::vector<ShardedActive<int>::HotKey> hot = sharded.hotKeys();
+  ASSERT_FALSE(hot.empty());
+  ASSERT_EQ(7, hot[0].first);
+  ASSERT_GT(hot[0].second, 4000u);
+
+  ShardStats stats = sharded.stats();
+  ASSERT_GE(stats.sent[sharded.shardFor(7)], 5000u);
+  ASSERT_GT(stats.imbalance, 1.5); // the hot key's shard is overloaded
+}
+
+TEST(ShardedActive, bounded_shards_count_only_queued_jobs) {
+  ASSERT_THROW(ShardedActive<int>(0), std::invalid_argument);
+
+  ActiveOptions options;
+  options.capacity = 2;
+  options.policy = overflow_policy::reject;
+  ShardedActive<int> sharded(1, options, 1); // every queued key is sampled
+  std::atomic<bool> started(false);
+  std::atomic<bool> release(false);
+  ASSERT_TRUE(sharded.send(1, [&]() {
+    started = true;
+    while (!release.load()) {
+      std::this_thread::yield();
+    }
+  }));
+  while (!started.load()) {
+    std::this_thread::yield();
+  }
+  std::atomic<uint64_t> executed(0);
+  uint64_t queued = 1;
+  while (sharded.send(1, [&executed]() { ++executed; })) { // the shard is busy, its lane fills up
+    ++queued;
+  }
+  ASSERT_THROW(sharded.call(1, []() { return 0; }).get(), std::future_error);
+  ASSERT_EQ(queued, sharded.stats().sent[0]);
+  const ShardedActive<int>& view = sharded;
+  ASSERT_EQ(1u, view.hotKeys().size());
+  ASSERT_EQ(queued, view.hotKeys()[0].second); // the rejected sends are not sampled
+  release = true;
+  while (executed.load() < queued - 1) {
+    std::this_thread::yield();
+  }
+  ASSERT_EQ(42, sharded.call(1, []() { return 42; }).get());
+  ASSERT_EQ(queued + 1, sharded.stats().sent[0]);
+}
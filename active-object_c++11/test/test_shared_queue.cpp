@@ -0,0 +1,252 @@
+/* *****************************************************************
+Test of the mutex protected shared_queue.
+
+Tests below:
+    1. Normal FIFO push and pop
+
+    2. Swap-and-drain, all queued items are taken in one go and in FIFO order
+
+    3. Swap-and-drain into a container that already has items appends to it
+
+    4. wait_and_pop_all sleeps until a producer pushes something
+
+    5. Bounded queue, the overflow policies: reject, drop_oldest, drop_newest
+       and the rejected/dropped counters
+
+    6. Bounded queue with the block policy: push waits for the consumer,
+       try_push and push_for (timeout) give up
+
+    7. push_range: a batch is queued in FIFO order, a batch bigger than a
+       bounded queue follows the policy item by item
+
+    8. Items are moved, never copied: push of an rvalue, emplace, the pops
+       and push_range with move iterators. Move-only items work
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <queue>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <string>
+#include <iterator>
+
+#include "shared_queue.h"
+
+
+TEST(SharedQueue, fifo_push_and_pop) {
+  shared_queue<int> queue;
+  for (int idx = 0; idx < 10; ++idx) {
+    queue.push(idx);
+  }
+  for (int idx = 0; idx < 10; ++idx) {
+    int item = -1;
+    ASSERT_TRUE(queue.try_and_pop(item));
+    ASSERT_EQ(idx, item);
+  }
+  ASSERT_TRUE(queue.empty());
+}
+
+
+TEST(SharedQueue, pop_all_takes_everything_in_fifo_order) {
+  shared_queue<int> queue;
+  std::queue<int> batch;
+  ASSERT_FALSE(queue.try_and_pop_all(batch));
+
+  for (int idx = 0; idx < 1000; ++idx) {
+    queue.push(idx);
+  }
+  ASSERT_TRUE(queue.try_and_pop_all(batch));
+  ASSERT_TRUE(queue.empty());
+  ASSERT_EQ(1000u, batch.size());
+  for (int idx = 0; idx < 1000; ++idx) {
+    ASSERT_EQ(idx, batch.front());
+    batch.pop();
+  }
+}
+
+
+TEST(SharedQueue, pop_all_appends_to_non_empty_batch) {
+  shared_queue<int> queue;
+  std::queue<int> batch;
+  batch.push(0);
+  queue.push(1);
+  queue.push(2);
+  queue.wait_and_pop_all(batch);
+  ASSERT_EQ(3u, batch.size());
+  for (int idx = 0; idx < 3; ++idx) {
+    ASSERT_EQ(idx, batch.front());
+    batch.pop();
+  }
+}
+
+
+TEST(SharedQueue, wait_and_pop_all_waits_for_producer) {
+  shared_queue<int> queue;
+  std::thread producer([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    queue.push(42);
+  });
+  std::queue<int> batch;
+  queue.wait_and_pop_all(batch);
+  producer.join();
+  ASSERT_EQ(1u, batch.size());
+  ASSERT_EQ(42, batch.front());
+}
+
+
+namespace {
+std::vector<int> popAll(shared_queue<int>& queue_) {
+  std::vector<int> items;
+  int item = -1;
+  while (queue_.try_and_pop(item)) {
+    items.push_back(item);
+  }
+  return items;
+}
+} // anonymous
+
+
+TEST(SharedQueue, bounded_reject) {
+  shared_queue<int> queue(2, overflow_policy::reject);
+  ASSERT_EQ(2u, queue.capacity());
+  ASSERT_TRUE(queue.push(0));
+  ASSERT_TRUE(queue.push(1));
+  ASSERT_FALSE(queue.push(2));
+  ASSERT_FALSE(queue.try_push(3));
+  ASSERT_EQ(2u, queue.size());
+  ASSERT_EQ(2u, queue.rejected());
+  ASSERT_EQ(0u, queue.dropped());
+}
+
+
+TEST(SharedQueue, bounded_drop_oldest_and_drop_newest) {
+  shared_queue<int> oldest(3, overflow_policy::drop_oldest);
+  shared_queue<int> newest(3, overflow_policy::drop_newest);
+  for (int idx = 0; idx < 5; ++idx) {
+    ASSERT_TRUE(oldest.push(idx));
+    ASSERT_EQ(idx < 3, newest.push(idx));
+  }
+  ASSERT_EQ(2u, oldest.dropped());
+  ASSERT_EQ(2u, newest.dropped());
+  ASSERT_EQ(0u, oldest.rejected() + newest.rejected());
+
+  std::vector<int> kept = popAll(oldest);
+  ASSERT_EQ(3u, kept.size());
+  ASSERT_EQ(2, kept[0]);
+  ASSERT_EQ(4, kept[2]);
+  kept = popAll(newest);
+  ASSERT_EQ(3u, kept.size());
+  ASSERT_EQ(0, kept[0]);
+  ASSERT_EQ(2, kept[2]);
+}
+
+
+TEST(SharedQueue, bounded_block_waits_for_the_consumer) {
+  shared_queue<int> queue(1, overflow_policy::block);
+  ASSERT_TRUE(queue.push(0));
+  ASSERT_FALSE(queue.try_push(1));
+  ASSERT_FALSE(queue.push_for(1, std::chrono::milliseconds(10)));
+  ASSERT_EQ(2u, queue.rejected());
+
+  std::thread consumer([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    int item = -1;
+    queue.wait_and_pop(item);
+  });
+  ASSERT_TRUE(queue.push(1)); // blocks till the consumer made room
+  consumer.join();
+  ASSERT_EQ(1u, queue.size());
+  ASSERT_EQ(0u, queue.dropped());
+}
+
+
+TEST(SharedQueue, push_range) {
+  std::vector<int> batch;
+  for (int idx = 0; idx < 10; ++idx) {
+    batch.push_back(idx);
+  }
+  shared_queue<int> queue;
+  queue.push(-1);
+  ASSERT_EQ(10u, queue.push_range(batch.begin(), batch.end()));
+  std::vector<int> popped = popAll(queue);
+  ASSERT_EQ(11u, popped.size());
+  for (int idx = 0; idx < 10; ++idx) {
+    ASSERT_EQ(idx, popped[idx + 1]);
+  }
+
+  shared_queue<int> bounded(4, overflow_policy::reject);
+  ASSERT_EQ(4u, bounded.push_range(batch.begin(), batch.end()));
+  ASSERT_EQ(6u, bounded.rejected());
+
+  // the consumer sleeps on an empty queue and must be woken up before the
+  // producer waits for room in the middle of the batch
+  shared_queue<int> blocking(2, overflow_policy::block);
+  std::vector<int> consumed;
+  std::thread consumer([&]() {
+    while (consumed.size() < batch.size()) {
+      int item = -1;
+      blocking.wait_and_pop(item);
+      consumed.push_back(item);
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  ASSERT_EQ(10u, blocking.push_range(batch.begin(), batch.end()));
+  consumer.join();
+  ASSERT_EQ(batch, consumed);
+}
+
+
+namespace {
+struct Counted {
+  static int copies;
+  std::string text;
+  explicit Counted(const std::string& text_ = "") : text(text_) {}
+  Counted(const Counted& other) : text(other.text) { ++copies; }
+  Counted(Counted&& other) : text(std::move(other.text)) {}
+  Counted& operator=(const Counted& other) { text = other.text; ++copies; return *this; }
+  Counted& operator=(Counted&& other) { text = std::move(other.text); return *this; }
+};
+int Counted::copies = 0;
+} // anonymous
+
+TEST(SharedQueue, items_are_moved_never_copied) {
+  Counted::copies = 0;
+  shared_queue<Counted> queue;
+  queue.push(Counted("pushed"));
+  ASSERT_TRUE(queue.emplace("emplaced"));
+  std::vector<Counted> batch(2, Counted("batch"));
+  Counted::copies = 0;
+  ASSERT_EQ(2u, queue.push_range(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end())));
+
+  Counted item;
+  ASSERT_TRUE(queue.try_and_pop(item));
+  ASSERT_EQ("pushed", item.text);
+  queue.wait_and_pop(item);
+  ASSERT_EQ("emplaced", item.text);
+  std::queue<Counted> rest;
+  ASSERT_TRUE(queue.try_and_pop_all(rest));
+  ASSERT_EQ(2u, rest.size());
+  ASSERT_EQ(0, Counted::copies);
+
+  // an lvalue is still copied in, once
+  const Counted kept("kept");
+  queue.push(kept);
+  ASSERT_EQ(1, Counted::copies);
+}
+
+
+TEST(SharedQueue, move_only_items) {
+  shared_queue<std::unique_ptr<int> > queue(2, overflow_policy::reject);
+  ASSERT_TRUE(queue.push(std::unique_ptr<int>(new int(1))));
+  ASSERT_TRUE(queue.emplace(new int(2)));
+  ASSERT_FALSE(queue.try_push(std::unique_ptr<int>(new int(3))));
+  std::unique_ptr<int> item;
+  ASSERT_TRUE(queue.try_and_pop(item));
+  ASSERT_EQ(1, *item);
+  ASSERT_TRUE(queue.try_and_pop(item));
+  ASSERT_EQ(2, *item);
+}
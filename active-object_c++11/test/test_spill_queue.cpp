@@ -0,0 +1,152 @@
+/* *****************************************************************
+Test of spill_queue, the FIFO that spills to a memory-mapped journal
+
+Tests below:
+    1. Past the memory part the values are spilled, and they come back
+       in FIFO order
+
+    2. While the journal has values new ones go to the journal too, strings
+       of any length cross the segment boundaries in order
+
+    3. Segment files are recycled, filling and draining again and again
+       does not create new files
+
+    4. A value larger than a segment is refused, the queue is unchanged
+
+    5. One producer and one waiting consumer, nothing lost or reordered
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#if defined(__unix__)
+
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "spill_queue.h"
+
+using namespace kjellkod;
+
+namespace {
+spill_options smallOptions(size_t memory_items_, size_t segment_bytes_) {
+  spill_options options;
+  options.memory_items = memory_items_;
+  options.segment_bytes = segment_bytes_;
+  return options;
+}
+
+std::string text(int idx_) {
+  return std::string(static_cast<size_t>(idx_ % 97), 'a' + idx_ % 26) + std::to_string(idx_);
+}
+} // anonymous
+
+
+TEST(SpillQueue, spilled_values_come_back_in_order) {
+  const int c_values = 10000;
+  spill_queue<int> queue(smallOptions(100, 4096));
+  for (int idx = 0; idx < c_values; ++idx) {
+    queue.push(idx);
+  }
+  ASSERT_EQ(static_cast<size_t>(c_values), queue.size());
+  ASSERT_EQ(static_cast<size_t>(c_values - 100), queue.spilled());
+  ASSERT_GT(queue.files(), 1u);
+
+  std::queue<int> popped;
+  int expected = 0;
+  while (queue.try_and_pop_all(popped)) {
+    ASSERT_LE(popped.size(), 100u); // bounded also when read back
+    for (; !popped.empty(); popped.pop()) {
+      ASSERT_EQ(expected++, popped.front());
+    }
+  }
+  ASSERT_EQ(c_values, expected);
+  ASSERT_TRUE(queue.empty());
+  ASSERT_EQ(0u, queue.spilled());
+}
+
+TEST(SpillQueue, fifo_while_the_journal_drains) {
+  spill_queue<std::string> queue(smallOptions(10, 1024));
+  int pushed = 0;
+  int expected = 0;
+  std::queue<std::string> popped;
+  for (int round = 0; round < 200; ++round) {
+    for (int idx = 0; idx < 25; ++idx) {
+      queue.push(text(pushed++));
+    }
+    ASSERT_TRUE(queue.try_and_pop_all(popped)); // memory has room again, the journal is not empty
+    for (; !popped.empty(); popped.pop()) {
+      ASSERT_EQ(text(expected++), popped.front());
+    }
+  }
+  while (queue.try_and_pop_all(popped)) {
+    for (; !popped.empty(); popped.pop()) {
+      ASSERT_EQ(text(expected++), popped.front());
+    }
+  }
+  ASSERT_EQ(pushed, expected);
+}
+
+TEST(SpillQueue, segments_are_recycled) {
+  spill_options options = smallOptions(1, 1024);
+  options.spare_segments = 16;
+  spill_queue<uint64_t> queue(options);
+  std::queue<uint64_t> popped;
+  size_t files = 0;
+  for (int round = 0; round < 100; ++round) {
+    for (uint64_t idx = 0; idx < 500; ++idx) {
+      queue.push(idx);
+    }
+    if (0 == round) {
+      files = queue.files();
+      ASSERT_GT(files, 2u);
+      ASSERT_LT(files, options.spare_segments);
+    }
+    uint64_t expected = 0;
+    while (queue.try_and_pop_all(popped)) {
+      for (; !popped.empty(); popped.pop()) {
+        ASSERT_EQ(expected++, popped.front());
+      }
+    }
+    ASSERT_EQ(500u, expected);
+  }
+  ASSERT_EQ(files, queue.files()); // every later round ran on the first round's files
+}
+
+TEST(SpillQueue, value_larger_than_a_segment) {
+  spill_queue<std::string> queue(smallOptions(1, 256));
+  queue.push("in memory");
+  ASSERT_THROW(queue.push(std::string(1000, 'x')), std::length_error);
+  queue.push("spilled");
+  ASSERT_EQ(2u, queue.size());
+  std::queue<std::string> popped;
+  ASSERT_TRUE(queue.try_and_pop_all(popped));
+  ASSERT_TRUE(queue.try_and_pop_all(popped));
+  ASSERT_EQ(2u, popped.size());
+  ASSERT_EQ("in memory", popped.front());
+  ASSERT_EQ("spilled", popped.back());
+}
+
+TEST(SpillQueue, producer_and_waiting_consumer) {
+  const int c_values = 200000;
+  spill_queue<int> queue(smallOptions(1000, 64 * 1024));
+  std::thread producer([&queue]() {
+    for (int idx = 0; idx < c_values; ++idx) {
+      queue.push(idx);
+    }
+  });
+  std::queue<int> popped;
+  int expected = 0;
+  while (expected < c_values) {
+    queue.wait_and_pop_all(popped);
+    for (; !popped.empty(); popped.pop()) {
+      ASSERT_EQ(expected++, popped.front());
+    }
+  }
+  producer.join();
+  ASSERT_TRUE(queue.empty());
+}
+
+#endif // __unix__
@@ -0,0 +1,173 @@
+/* *****************************************************************
+Test of the hierarchical timer_wheel. Time is given explicitly to
+advance() so the tests do not depend on the real clock.
+
+Tests below:
+    1. One shot timers expire in deadline order, never early,
+       also timers that are cascaded from the higher levels
+
+    2. Cancel before expiry, cancel of an expired timer
+
+    3. Periodic timers, fixed rate, stopped from their own job
+
+    4. Many pending timers, and a far away timer beyond the last level
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+#include "timer_wheel.h"
+#include "unique_function.h"
+
+using namespace kjellkod;
+
+namespace {
+typedef unique_function<void()> Job;
+typedef timer_wheel<Job> Wheel;
+typedef Wheel::clock::time_point TimePoint;
+typedef std::chrono::milliseconds ms;
+
+void addTo(std::vector<int>* received_, int value_) {
+  received_->push_back(value_);
+}
+} // anonymous
+
+
+TEST(TimerWheel, expires_in_deadline_order) {
+  const TimePoint origin = Wheel::clock::now();
+  Wheel wheel(ms(1), origin);
+  Wheel sleeper(ms(1), origin);
+  std::vector<int> received, receivedAfterSleep;
+  // level 0, level 1 and level 2 delays, added out of order
+  const std::vector<int> c_delays = { 70000, 5, 300, 255, 256, 65536, 1 };
+  for (int delay : c_delays) {
+    wheel.add(delay, origin + ms(delay), std::bind(&addTo, &received, delay));
+    sleeper.add(delay, origin + ms(delay), std::bind(&addTo, &receivedAfterSleep, delay));
+  }
+  ASSERT_EQ(7u, wheel.size());
+  ASSERT_EQ(0u, wheel.advance(origin));
+
+  std::vector<int> expected = c_delays;
+  std::sort(expected.begin(), expected.end());
+  for (int delay : expected) {
+    wheel.advance(origin + ms(delay - 1));
+    ASSERT_EQ(received.end(), std::find(received.begin(), received.end(), delay)) << "early: " << delay;
+    wheel.advance(origin + ms(delay));
+    ASSERT_EQ(delay, received.back()) << "late: " << delay;
+  }
+  ASSERT_TRUE(wheel.empty());
+  ASSERT_EQ(expected, received);
+
+  // one big step after a long "sleep"
+  ASSERT_EQ(7u, sleeper.advance(origin + ms(100000)));
+  ASSERT_EQ(expected, receivedAfterSleep);
+}
+
+
+TEST(TimerWheel, next_deadline_is_a_lower_bound) {
+  const TimePoint origin = Wheel::clock::now();
+  Wheel wheel(ms(1), origin);
+  std::vector<int> received;
+  wheel.add(1, origin + ms(1000), std::bind(&addTo, &received, 1));
+  // step from deadline to deadline, as the Active does
+  int steps = 0;
+  while (!wheel.empty()) {
+    const TimePoint next = wheel.next_deadline();
+    ASSERT_LE(next, origin + ms(1000));
+    wheel.advance(next);
+    ++steps;
+  }
+  ASSERT_EQ(1u, received.size());
+  ASSERT_GT(5, steps); // a cascade or two, not one step per tick
+}
+
+
+TEST(TimerWheel, cancel) {
+  const TimePoint origin = Wheel::clock::now();
+  Wheel wheel(ms(1), origin);
+  std::vector<int> received;
+  wheel.add(1, origin + ms(10), std::bind(&addTo, &received, 1));
+  wheel.add(2, origin + ms(10), std::bind(&addTo, &received, 2));
+  wheel.add(3, origin + ms(1000), std::bind(&addTo, &received, 3));
+  ASSERT_TRUE(wheel.cancel(1));
+  ASSERT_TRUE(wheel.cancel(3));
+  ASSERT_FALSE(wheel.cancel(3));
+  ASSERT_EQ(1u, wheel.advance(origin + ms(2000)));
+  ASSERT_FALSE(wheel.cancel(2)); // already expired
+  ASSERT_EQ(1u, received.size());
+  ASSERT_EQ(2, received[0]);
+}
+
+
+namespace {
+struct StopAfter {
+  Wheel* wheel;
+  int* runs;
+  int max;
+  void operator()() {
+    if (++*runs == max) {
+      wheel->cancel(1);
+    }
+  }
+};
+} // anonymous
+
+
+TEST(TimerWheel, periodic) {
+  const TimePoint origin = Wheel::clock::now();
+  Wheel wheel(ms(1), origin);
+  int runs = 0;
+  StopAfter stop = { &wheel, &runs, 5 };
+  wheel.add(1, origin + ms(10), stop, ms(10));
+
+  wheel.advance(origin + ms(10));
+  ASSERT_EQ(1, runs);
+  wheel.advance(origin + ms(19));
+  ASSERT_EQ(1, runs);
+  wheel.advance(origin + ms(20));
+  ASSERT_EQ(2, runs);
+  // a long stall does not bunch up the missed periods
+  wheel.advance(origin + ms(500));
+  ASSERT_EQ(3, runs);
+  wheel.advance(origin + ms(509));
+  ASSERT_EQ(3, runs);
+  wheel.advance(origin + ms(510));
+  ASSERT_EQ(4, runs);
+  wheel.advance(origin + ms(520));
+  ASSERT_EQ(5, runs); // cancelled itself
+  ASSERT_TRUE(wheel.empty());
+  wheel.advance(origin + ms(1000));
+  ASSERT_EQ(5, runs);
+}
+
+
+TEST(TimerWheel, many_timers_and_far_away_timer) {
+  const TimePoint origin = Wheel::clock::now();
+  Wheel wheel(ms(1), origin);
+  std::vector<int> received;
+  const int c_nbrTimers = 200000;
+  for (int idx = 0; idx < c_nbrTimers; ++idx) {
+    wheel.add(idx + 1, origin + ms(idx % 100000), std::bind(&addTo, &received, idx));
+  }
+  for (int idx = 0; idx < c_nbrTimers; idx += 2) {
+    wheel.cancel(idx + 1);
+  }
+  const std::chrono::hours c_farAway(24 * 100); // beyond 2^32 ticks
+  wheel.add(0, origin + c_farAway, std::bind(&addTo, &received, -1));
+
+  ASSERT_EQ(static_cast<size_t>(c_nbrTimers / 2), wheel.advance(origin + ms(100000)));
+  ASSERT_EQ(1u, wheel.size());
+  for (size_t idx = 1; idx < received.size(); ++idx) {
+    ASSERT_LE(received[idx - 1] % 100000, received[idx] % 100000);
+  }
+
+  wheel.advance(origin + c_farAway - ms(1));
+  ASSERT_EQ(1u, wheel.size());
+  ASSERT_EQ(1u, wheel.advance(origin + c_farAway));
+  ASSERT_EQ(-1, received.back());
+}
@@ -0,0 +1,215 @@
+/* *****************************************************************
+Test of the move-only unique_function used as the Active Job type
+
+Heap allocations are counted per thread, see allocation_counter.h
+
+Tests below:
+    1. Small lambdas are stored inline: creating, moving and calling
+       them does not allocate
+
+    2. Too big callables fall back to ONE heap allocation and are
+       properly destroyed
+
+    3. Move-only callables (owning a unique_ptr) can be stored and called,
+       also a callable that holds a Job is stored inline when it fits
+
+    4. Enqueueing small lambdas with Active::send into the lock-free ring
+       does not allocate at all, the std::deque in shared_queue only
+       allocates a node every few jobs
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <type_traits>
+#include <string>
+#include <functional>
+
+#include "active.h"
+#include "ring_queue.h"
+#include "shared_queue.h"
+#include "unique_function.h"
+#include "allocation_counter.h"
+
+using namespace kjellkod;
+
+namespace {
+struct Big {
+  char payload[128];
+  int* calls;
+  void operator()() { ++*calls; }
+};
+
+struct OwnsPointer {
+  std::unique_ptr<int> value;
+  int* result;
+  explicit OwnsPointer(int* result_) : value(new int(42)), result(result_) {}
+  OwnsPointer(OwnsPointer&& other) noexcept : value(std::move(other.value)), result(other.result) {}
+  void operator()() { *result = *value; }
+};
+
+void increment(int* value_) { ++*value_; }
+} // anonymous
+
+
+TEST(UniqueFunction, small_lambda_is_stored_inline) {
+  int a = 0, b = 0, c = 0;
+  int* pa = &a; int* pb = &b; int* pc = &c;
+  AllocationCounter allocations;
+  {
+    unique_function<void(), 64> job([pa, pb, pc]() { ++*pa; ++*pb; ++*pc; });
+    unique_function<void(), 64> moved(std::move(job));
+    ASSERT_FALSE(job);
+    moved();
+    job = std::move(moved);
+    job();
+  }
+  ASSERT_EQ(0ul, allocations.count());
+  ASSERT_EQ(2, a);
+  ASSERT_EQ(2, b);
+  ASSERT_EQ(2, c);
+}
+
+
+TEST(UniqueFunction, bind_of_shared_ptr_is_stored_inline) {
+  std::shared_ptr<int> value(new int(0));
+  AllocationCounter allocations;
+  unique_function<void(), 64> job(std::bind(&increment, value.get()));
+  job();
+  ASSERT_EQ(0ul, allocations.count());
+  ASSERT_EQ(1, *value);
+}
+
+
+TEST(UniqueFunction, big_callable_is_heap_allocated_once) {
+  int calls = 0;
+  Big big;
+  big.calls = &calls;
+  ASSERT_FALSE((unique_function<void(), 64>::stores_inline<Big>()));
+  AllocationCounter allocations;
+  {
+    unique_function<void(), 64> job(big);
+    unique_function<void(), 64> moved(std::move(job));
+    moved();
+  }
+  ASSERT_EQ(1ul, allocations.count());
+  ASSERT_EQ(1, calls);
+}
+
+
+TEST(UniqueFunction, inline_size_is_configurable) {
+  ASSERT_TRUE((unique_function<void(), 256>::stores_inline<Big>()));
+  int calls = 0;
+  Big big;
+  big.calls = &calls;
+  AllocationCounter allocations;
+  unique_function<void(), 256> job(big);
+  job();
+  ASSERT_EQ(0ul, allocations.count());
+  ASSERT_EQ(1, calls);
+}
+
+
+TEST(UniqueFunction, move_only_callable) {
+  int result = 0;
+  OwnsPointer owner(&result);
+  unique_function<void()> job(std::move(owner));
+  job();
+  ASSERT_EQ(42, result);
+}
+
+
+namespace {
+typedef unique_function<void(), 64> InnerJob;
+
+// as the wrappers of call_on, then() and the timers, a callable that holds a Job
+struct HoldsJob {
+  InnerJob job;
+  void operator()() { job(); }
+};
+} // anonymous
+
+
+TEST(UniqueFunction, callable_holding_a_job_is_stored_inline) {
+  ASSERT_TRUE(std::is_nothrow_move_constructible<InnerJob>::value);
+  ASSERT_TRUE((unique_function<void(), 128>::stores_inline<HoldsJob>()));
+  int calls = 0;
+  HoldsJob outer = { InnerJob([&calls]() { ++calls; }) };
+  AllocationCounter allocations;
+  unique_function<void(), 128> wrapped(std::move(outer));
+  unique_function<void(), 128> moved(std::move(wrapped));
+  moved();
+  ASSERT_EQ(0ul, allocations.count());
+  ASSERT_EQ(1, calls);
+}
+
+
+TEST(UniqueFunction, return_values_and_arguments) {
+  unique_function<std::string(const std::string&, int)> repeat(
+    [](const std::string& text, int times) {
+      std::string result;
+      for (int idx = 0; idx < times; ++idx) {
+        result += text;
+      }
+      return result;
+    });
+  ASSERT_EQ("abab", repeat("ab", 2));
+}
+
+
+TEST(UniqueFunction, empty_throws_like_std_function) {
+  unique_function<void()> empty;
+  std::function<void()> empty_std;
+  unique_function<void()> from_empty_std(empty_std);
+  ASSERT_FALSE(empty);
+  ASSERT_FALSE(from_empty_std);
+  ASSERT_THROW(empty(), std::bad_function_call);
+}
+
+
+TEST(UniqueFunction, enqueue_to_ring_without_allocation) {
+  const int c_nbrJobs = 1000;
+  int counter = 0;
+  int* ptr = &counter;
+  mpsc_ring_queue<Job> queue(c_nbrJobs);
+  AllocationCounter allocations;
+  for (int idx = 0; idx < c_nbrJobs; ++idx) {
+    queue.push([ptr, idx]() { *ptr += idx; });
+  }
+  ASSERT_EQ(0ul, allocations.count());
+
+  Job job;
+  while (queue.try_and_pop(job)) {
+    job();
+  }
+  ASSERT_EQ(c_nbrJobs * (c_nbrJobs - 1) / 2, counter);
+}
+
+
+TEST(UniqueFunction, active_send_allocates_less_than_std_function) {
+  const int c_nbrJobs = 1000;
+  int counter = 0;
+  int* ptr = &counter;
+  unsigned long job_allocations = 0;
+  unsigned long callback_allocations = 0;
+  {
+    std::unique_ptr<Active> active(Active::createActive());
+    AllocationCounter allocations;
+    for (int idx = 0; idx < c_nbrJobs; ++idx) {
+      active->send([ptr, idx]() { *ptr += idx; });
+    }
+    job_allocations = allocations.count();
+
+    AllocationCounter callback_counter;
+    for (int idx = 0; idx < c_nbrJobs; ++idx) {
+      Callback callback = std::bind(&increment, ptr);
+      active->send(callback);
+    }
+    callback_allocations = callback_counter.count();
+  }
+  // shared_queue's std::deque allocates one node for several jobs
+  ASSERT_LT(job_allocations, static_cast<unsigned long>(c_nbrJobs / 2));
+  ASSERT_LT(job_allocations, callback_allocations);
+  ASSERT_EQ(c_nbrJobs * (c_nbrJobs - 1) / 2 + c_nbrJobs, counter);
+}
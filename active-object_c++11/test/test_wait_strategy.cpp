@@ -0,0 +1,153 @@
+/* *****************************************************************
+Test of the wait strategies: block, spin_then_park and busy_poll
+
+Tests below:
+    1. parking_spot: a waiter is woken up by notify() and wait_until()
+       gives up at the deadline, in every mode
+
+    2. An Active with each wait strategy executes all jobs in FIFO order,
+       block is the default
+
+    3. Latency histogram printouts, send-to-execute latency of an Active
+       in each mode when the jobs arrive with short and with long gaps.
+       Not a verification, just numbers to compare
+
+*************************************************************** */
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <functional>
+
+#include "active.h"
+
+using namespace kjellkod;
+
+namespace {
+const wait_strategy c_strategies[] = { wait_strategy::block, wait_strategy::spin_then_park, wait_strategy::busy_poll };
+
+const char* nameOf(wait_strategy strategy_) {
+  switch (strategy_) {
+  case wait_strategy::block: return "block";
+  case wait_strategy::spin_then_park: return "spin_then_park";
+  case wait_strategy::busy_poll: return "busy_poll";
+  }
+  return "";
+}
+
+void addTo(std::vector<int>* received_, int value_) {
+  received_->push_back(value_);
+}
+} // anonymous
+
+
+TEST(WaitStrategy, parking_spot_notify_and_timeout) {
+  for (wait_strategy strategy : c_strategies) {
+    parking_spot parking(strategy);
+    std::atomic<bool> flag(false);
+    std::thread notifier([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5)); // long enough to park
+      flag.store(true);
+      parking.notify();
+    });
+    parking.wait([&]() { return flag.load(); });
+    notifier.join();
+    ASSERT_TRUE(flag.load()) << nameOf(strategy);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::chrono::steady_clock::time_point deadline = start + std::chrono::milliseconds(5);
+    ASSERT_FALSE(parking.wait_until(deadline, []() { return false; })) << nameOf(strategy);
+    ASSERT_LE(deadline, std::chrono::steady_clock::now()) << nameOf(strategy);
+  }
+}
+
+
+TEST(WaitStrategy, active_executes_all_jobs) {
+  const int c_nbrJobs = 10000;
+  for (wait_strategy strategy : c_strategies) {
+    std::vector<int> received;
+    {
+      std::unique_ptr<Active> active(Active::createActive(0, overflow_policy::block, strategy));
+      for (int idx = 0; idx < c_nbrJobs; ++idx) {
+        active->send(std::bind(&addTo, &received, idx));
+        if (0 == idx % 1000) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1)); // let it go idle
+        }
+      }
+    }
+    ASSERT_EQ(static_cast<size_t>(c_nbrJobs), received.size()) << nameOf(strategy);
+    for (int idx = 0; idx < c_nbrJobs; ++idx) {
+      ASSERT_EQ(idx, received[idx]);
+    }
+  }
+}
+
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+void recordLatency(std::vector<long>* latencies_, Clock::time_point sent_) {
+  latencies_->push_back(static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent_).count()));
+}
+
+// power of two buckets in microseconds, and the percentiles
+void printHistogram(const char* name_, const std::chrono::microseconds& gap_, std::vector<long> latencies_) {
+  std::sort(latencies_.begin(), latencies_.end());
+  const size_t count = latencies_.size();
+  std::cout << "\t\t\t" << std::setw(15) << name_ << ", gap " << std::setw(4) << gap_.count() << " [us]. latency [us]"
+            << " p50: " << latencies_[count / 2] / 1000.0
+            << " p90: " << latencies_[count * 9 / 10] / 1000.0
+            << " p99: " << latencies_[count * 99 / 100] / 1000.0
+            << " max: " << latencies_.back() / 1000.0 << std::endl;
+  std::cout << "\t\t\t\t";
+  long limit = 1000;
+  size_t idx = 0;
+  while (idx < count) {
+    size_t in_bucket = 0;
+    while (idx < count && latencies_[idx] < limit) {
+      ++in_bucket;
+      ++idx;
+    }
+    if (in_bucket) {
+      std::cout << "<" << limit / 1000 << ":" << in_bucket << " ";
+    }
+    limit *= 2;
+  }
+  std::cout << std::endl;
+}
+} // anonymous
+
+
+TEST(WaitStrategy, block_is_the_default) {
+  ASSERT_EQ(wait_strategy::block, ActiveOptions().strategy);
+}
+
+
+TEST(WaitStrategy, latency_histogram_printouts) {
+  const int c_nbrJobs = 2000;
+  const std::chrono::microseconds c_gaps[] = { std::chrono::microseconds(5), std::chrono::microseconds(200) };
+  for (const std::chrono::microseconds& gap : c_gaps) {
+    for (wait_strategy strategy : c_strategies) {
+      std::vector<long> latencies;
+      latencies.reserve(c_nbrJobs);
+      {
+        std::unique_ptr<Active> active(Active::createActive(0, overflow_policy::block, strategy));
+        for (int idx = 0; idx < c_nbrJobs; ++idx) {
+          const Clock::time_point next = Clock::now() + gap;
+          active->send(std::bind(&recordLatency, &latencies, Clock::now()));
+          while (Clock::now() < next) {
+            parking_spot::pause(); // sleep_for is too coarse for short gaps
+          }
+        }
+      }
+      printHistogram(nameOf(strategy), gap, latencies);
+    }
+  }
+}
@@ -13,6 +13,25 @@
 
 #include "activeqthread.h"
 
+namespace
+{
+  // where flush() waits for its marker job
+  struct FlushPoint
+  {
+    QMutex mutex;
+    QWaitCondition reached;
+    bool passed;
+  };
+
+  // the marker job, after it has unlocked the flush point is not touched again
+  void passFlushPoint(FlushPoint *point)
+  {
+    QMutexLocker lock(&point->mutex);
+    point->passed = true;
+    point->reached.wakeAll();
+  }
+} // anonymous
+
 // Factory: safe construction of object before thread start
 std::auto_ptr<ActiveQThread> ActiveQThread::createActiveQThread()
 {
@@ -37,6 +56,19 @@ void ActiveQThread::send(ActiveCallback msg)
   job_queue_.push(msg);
 }
 
+// The queue is FIFO, when the marker has run so have all the jobs before it
+void ActiveQThread::flush()
+{
+  FlushPoint point;
+  point.passed = false;
+  send(std::tr1::bind(&passFlushPoint, &point));
+  QMutexLocker lock(&point.mutex);
+  while (!point.passed)
+  {
+    point.reached.wait(&point.mutex);
+  }
+}
+
 /// Private will only be called through factory function
 ActiveQThread::ActiveQThread() : QThread() // no parent for thread, it is managed HERE
   , done_(false) {}
@@ -58,6 +58,12 @@ class ActiveQThread : public QThread {
       * @param msg the function callback */
     void send(ActiveCallback msg);
 
+  public:
+    /** Waits until all jobs sent before the call have been executed, e.g.
+    * before reading what the jobs wrote. No dummy job round trip is needed.
+    * Must not be called by a job, it would wait for itself */
+    void flush();
+
   private:
     /// private constructor only reachable through @ref createActiveQThread
     explicit ActiveQThread();
@@ -6,12 +6,16 @@
 * making it safe for thread communication.
 *
 * This exampel  was inspired by Anthony Williams lock-based data structures in
-* Ref: "C++ Concurrency In Action" http://www.manning.com/williams */
+* Ref: "C++ Concurrency In Action" http://www.manning.com/williams
+*
+* With a C++11 compiler items are moved in and out of the queue, and
+* move-only items work. A C++98 build copies, as before */
 
 #ifndef SHARED_QUEUE
 #define SHARED_QUEUE
 
 #include <queue>
+#include <utility>
 #include <QMutexLocker>
 #include <QMutex>
 #include <QWaitCondition>
@@ -26,7 +30,7 @@ class shared_queue
   public:
     shared_queue() {}
 
-    void push(T item_)
+    void push(const T &item_)
     {
       QMutexLocker lock(&mutex_);
       queue_.push(item_);
@@ -34,6 +38,28 @@ class shared_queue
       wait_condition_.wakeOne();
     }
 
+#if defined(Q_COMPILER_RVALUE_REFS)
+    void push(T &&item_)
+    {
+      QMutexLocker lock(&mutex_);
+      queue_.push(std::move(item_));
+      lock.unlock();
+      wait_condition_.wakeOne();
+    }
+#endif
+
+#if defined(Q_COMPILER_RVALUE_REFS) && defined(Q_COMPILER_VARIADIC_TEMPLATES)
+    /// the item is made from 'args_' in the queue, there is no temporary
+    template<typename... Args>
+    void emplace(Args &&... args_)
+    {
+      QMutexLocker lock(&mutex_);
+      queue_.emplace(std::forward<Args>(args_)...);
+      lock.unlock();
+      wait_condition_.wakeOne();
+    }
+#endif
+
     /// wait until a queue has item - safe for multiple consumers
     void wait_and_pop(T &item)
     {
@@ -42,8 +68,7 @@ class shared_queue
       {
         wait_condition_.wait(&mutex_);
       }
-      item = queue_.front();
-      queue_.pop();
+      takeFront(item);
     }
 
     /// try to get an item, returns true if successful
@@ -54,8 +79,7 @@ class shared_queue
       {
         return false;
       }
-      item_ = queue_.front();
-      queue_.pop();
+      takeFront(item_);
       return true;
     }
 
@@ -72,6 +96,17 @@ class shared_queue
     }
 
   private:
+    // lock must be held
+    void takeFront(T &item_)
+    {
+#if defined(Q_COMPILER_RVALUE_REFS)
+      item_ = std::move(queue_.front());
+#else
+      item_ = queue_.front();
+#endif
+      queue_.pop();
+    }
+
     std::queue<T> queue_;
     mutable QMutex mutex_;
     QWaitCondition wait_condition_;
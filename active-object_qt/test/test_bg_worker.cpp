@@ -33,6 +33,9 @@ Tests below:
        In the normal case (for example a driver the keeps pumping data up) you would
        normally wring your own thing with 'fixed/coded' input/output queues
 
+    5. flush(): wait for the jobs sent so far, without destroying the
+       active object and without a job of our own
+
 
        Information that is outside the scope of this active object
        ===========================================================
@@ -269,3 +272,19 @@ TEST_F(Test_ThreadCommunication, work_and_return_by_queue) {
   std::cout << ", maximum took: " << maxTime << std::endl;
 
 }
+
+
+// flush() is a barrier: the values are read while the active object lives on
+TEST_F(Test_ThreadCommunication, flush_waits_for_the_sent_jobs) {
+  int check = 0;
+  for (int i = 0; i < 1000; ++i) {
+    check += i;
+    add(i);
+  }
+  worker_->flush();
+  ASSERT_EQ(check, addition_);
+
+  saveBgThreadId();
+  worker_->flush();
+  ASSERT_NE(bg_thread_id_, 0);
+}
@@ -35,7 +35,8 @@ int Test_ThreadCommunication::calculate_and_reset(int start, int stop) {
   for (int i = start; i < stop; ++i) {
     worker_->addition(i);
   }
-  // wait for queue, to drain get the result and restart worker from zero
+  worker_->flush(); // wait for the additions to be done
+  // get the result and restart worker from zero
   return worker_->reset_counter();
 }
 
@@ -69,7 +70,7 @@ TEST_F(Test_ThreadCommunication, bg_calculations) {
 // i.e. we're running two threads.
 TEST_F(Test_ThreadCommunication, different_threads) {
   worker_->save_thread_id(); // save thread_id in the background
-  worker_->reset_counter();  // wait for the message queue to drain (id saved)
+  worker_->flush();  // wait for the sent jobs to be done (id saved)
   EXPECT_NE(worker_->thread_id(), worker_->creator_thread_id());
   EXPECT_NE(0, worker_->thread_id());
 }